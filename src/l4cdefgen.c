@@ -8,6 +8,7 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -25,10 +26,19 @@
 
 #define FAIL(s) do {perror(s); abort(); } while (0)
 
+/*
+ * #timestamp-format styles, or'ed: the L<LEVEL> shorthands of a module
+ * with one log through <MOD>_TS_LOG and <MOD>_TS_LOG_MAYBE instead of the
+ * LT and plain families
+ */
+#define L4CGEN_TS_EPOCH 0x01
+#define L4CGEN_TS_DATETIME 0x02
+
 typedef struct _l4cgen_module {
     mnbytes_t *mid;
     mnbytes_t *name;
     mnarray_t messages;
+    unsigned tsfmt;
 } l4cgen_module_t;
 
 typedef struct _l4cgen_message {
@@ -37,7 +47,28 @@ typedef struct _l4cgen_message {
     mnbytes_t *value;
 } l4cgen_message_t;
 
+/*
+ * #context: <NAME>_<MOD>_L<LEVEL> wrappers prepending fmt and args to the
+ * messages of the modules in scope, or of every module
+ */
+typedef struct _l4cgen_context {
+    mnbytes_t *name;
+    mnbytes_t *fmt;
+    mnbytes_t *args;
+    /* mnbytes_t * */
+    mnarray_t scope;
+} l4cgen_context_t;
+
 static mnhash_t modules;
+/*
+ * l4cgen_module_t *, in the order of first appearance: ids are assigned in
+ * definition order, so that they stay the same from one build to another
+ */
+static mnarray_t modorder;
+/* #timestamp-format before the first module section */
+static unsigned tsfmt_default;
+/* l4cgen_context_t */
+static mnarray_t contexts;
 
 
 #ifndef NDEBUG
@@ -58,12 +89,15 @@ static struct option optinfo[] = {
     {"lib", required_argument, NULL, 'L'},
 #define L4CDEFGEN_OPT_VERBOSE    5
     {"verbose", no_argument, NULL, 'v'},
+#define L4CDEFGEN_OPT_CXX       6
+    {"cxx", required_argument, NULL, 'X'},
 };
 
 
 static int verbose;
 static char *cout;
 static char *hout;
+static char *xout;
 static char *lib;
 
 static void
@@ -77,6 +111,8 @@ usage(char *p)
 "  --lib=NAME|-LNAME            Library name. Required.\n"
 "  --hout=PATH|-HPATH           Output header. Default <libname>-logdef.h.\n"
 "  --cout=PATH|-CPATH           Output source. Default <libname>-logdef.c.\n"
+"  --cxx=PATH|-XPATH            Also output C++ message descriptors for\n"
+"                               mnl4c.hpp.\n"
 "  --verbose|-v                 Increase verbosity.\n"
 ,
         basename(p));
@@ -113,25 +149,46 @@ render_head(FILE *fhout, FILE *fcout, const char *hout, const char *lib)
     macroname_translate(hout_macroname);
     fprintf(fcout, "#include <mnl4c.h>\n");
     fprintf(fcout, "#include \"%s\"\n", hout);
-    fprintf(fcout,
-        "void\n"
-        "%s_init_logdef(mnl4c_logger_t logger)\n"
-        "{\n",
-        lib);
+    fprintf(fcout, "int %s_logdef_base = -1;\n", lib);
 
     fprintf(fhout,
         "#ifndef %s\n"
         "#define %s\n"
+        "#include <mnl4c.h>\n"
         "#ifdef __cplusplus\n"
         "extern \"C\" {\n"
-        "#endif\n",
+        "#endif\n"
+        "extern int %s_logdef_base;\n",
+        BDATA(hout_macroname),
         BDATA(hout_macroname),
-        BDATA(hout_macroname));
+        lib);
     BYTES_DECREF(&hout_macroname);
 
 }
 
 
+static void
+render_xhead(FILE *fxout, const char *xout, const char *hout, const char *lib)
+{
+    mnbytes_t *xout_macroname;
+
+    xout_macroname = bytes_new_from_str(xout);
+
+    macroname_translate(xout_macroname);
+    fprintf(fxout,
+        "#ifndef %s\n"
+        "#define %s\n"
+        "#include <mnl4c.hpp>\n"
+        "#include \"%s\"\n"
+        "namespace %s_logdef {\n",
+        BDATA(xout_macroname),
+        BDATA(xout_macroname),
+        hout,
+        lib);
+    BYTES_DECREF(&xout_macroname);
+}
+
+
 static int
 l4cgen_message_init(void *o)
 {
@@ -159,6 +216,7 @@ l4cgen_module_init(l4cgen_module_t *mod)
 {
     mod->mid = NULL;
     mod->name = NULL;
+    mod->tsfmt = 0;
     if (array_init(&mod->messages, sizeof(l4cgen_message_t), 0,
             l4cgen_message_init,
             l4cgen_message_fini) != 0) {
@@ -231,6 +289,165 @@ l4cgen_module_cmp(void const *oa, void const *ob)
 }
 
 
+static int
+l4cgen_scope_fini(void *o)
+{
+    mnbytes_t **mid = o;
+    BYTES_DECREF(mid);
+    return 0;
+}
+
+
+static int
+l4cgen_context_init(void *o)
+{
+    l4cgen_context_t *ctx = o;
+    ctx->name = NULL;
+    ctx->fmt = NULL;
+    ctx->args = NULL;
+    if (array_init(&ctx->scope, sizeof(mnbytes_t *), 0,
+            NULL,
+            l4cgen_scope_fini) != 0) {
+        FAIL("array_init");
+    }
+    return 0;
+}
+
+
+static int
+l4cgen_context_fini(void *o)
+{
+    l4cgen_context_t *ctx = o;
+    BYTES_DECREF(&ctx->name);
+    BYTES_DECREF(&ctx->fmt);
+    BYTES_DECREF(&ctx->args);
+    (void)array_fini(&ctx->scope);
+    return 0;
+}
+
+
+/*
+ * Next atom of s separated by any of sep, NUL-terminated in place, or
+ * NULL at the end of s.
+ */
+static char *
+next_atom(char **s, const char *sep)
+{
+    char *res;
+
+    *s += strspn(*s, sep);
+    if (**s == '\0') {
+        return NULL;
+    }
+    res = *s;
+    *s += strcspn(*s, sep);
+    if (**s != '\0') {
+        *(*s)++ = '\0';
+    }
+    return res;
+}
+
+
+/*
+ * A line starting with '#': one of the directives below, the name right
+ * after the '#', anything else is a comment ("# context ..." included).
+ *
+ *  #timestamp-format epoch|datetime|epoch datetime
+ *      in a module section, for that module, before the first one, for
+ *      every module without its own
+ *  #context NAME
+ *  #context-format "literal"
+ *  #context-args expr, ...
+ *  #context-scope MOD ...
+ *      define a context and its fields, the scope defaults to every module
+ */
+static void
+process_directive(const char *fname,
+                  int lineno,
+                  char *s,
+                  l4cgen_module_t *current_mod,
+                  l4cgen_context_t **pctx)
+{
+    char *directive, *a, *end;
+
+    if (*s == ' ' || *s == '\t' ||
+        (directive = next_atom(&s, " \t")) == NULL) {
+        return;
+    }
+    /* trailing blanks */
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        --end;
+    }
+    *end = '\0';
+    s += strspn(s, " \t");
+
+    if (strcmp(directive, "timestamp-format") == 0) {
+        unsigned tsfmt = 0;
+
+        while ((a = next_atom(&s, " \t")) != NULL) {
+            if (strcmp(a, "epoch") == 0) {
+                tsfmt |= L4CGEN_TS_EPOCH;
+            } else if (strcmp(a, "datetime") == 0) {
+                tsfmt |= L4CGEN_TS_DATETIME;
+            } else {
+                errx(1, "%s:%d: unknown timestamp format %s",
+                     fname, lineno, a);
+            }
+        }
+        if (tsfmt == 0) {
+            errx(1, "%s:%d: missing timestamp format", fname, lineno);
+        }
+        if (current_mod != NULL) {
+            current_mod->tsfmt = tsfmt;
+        } else {
+            tsfmt_default = tsfmt;
+        }
+
+    } else if (strcmp(directive, "context") == 0) {
+        if ((a = next_atom(&s, " \t")) == NULL || *s != '\0') {
+            errx(1, "%s:%d: #context takes one name", fname, lineno);
+        }
+        if (MNUNLIKELY((*pctx = array_incr(&contexts)) == NULL)) {
+            FAIL("array_incr");
+        }
+        (*pctx)->name = bytes_new_from_str(a);
+
+    } else if (strncmp(directive, "context-", 8) == 0) {
+        l4cgen_context_t *ctx = *pctx;
+
+        if (ctx == NULL) {
+            errx(1, "%s:%d: #%s outside of #context",
+                 fname, lineno, directive);
+        }
+        if (strcmp(directive, "context-format") == 0) {
+            if (end - s < 2 || *s != '"' || end[-1] != '"') {
+                errx(1, "%s:%d: #context-format takes a string literal",
+                     fname, lineno);
+            }
+            BYTES_DECREF(&ctx->fmt);
+            ctx->fmt = bytes_new_from_str(s);
+        } else if (strcmp(directive, "context-args") == 0) {
+            BYTES_DECREF(&ctx->args);
+            if (*s != '\0') {
+                ctx->args = bytes_new_from_str(s);
+            }
+        } else if (strcmp(directive, "context-scope") == 0) {
+            while ((a = next_atom(&s, " \t,")) != NULL) {
+                mnbytes_t **mid;
+
+                if (MNUNLIKELY((mid = array_incr(&ctx->scope)) == NULL)) {
+                    FAIL("array_incr");
+                }
+                *mid = bytes_new_from_str(a);
+            }
+        } else {
+            errx(1, "%s:%d: unknown directive #%s", fname, lineno, directive);
+        }
+    }
+}
+
+
 #define PROCESS_LOGDEF_STATE_MODULE 0
 #define PROCESS_LOGDEF_STATE_MESSAGE 1
 #define PROCESS_LOGDEF_STATE_STR(st)                                           \
@@ -249,9 +466,11 @@ process_logdef(const char *fname)
     size_t linesz;
     ssize_t nread;
     int state = PROCESS_LOGDEF_STATE_MODULE;
-    l4cgen_module_t *current_mod, probe_mod;
+    l4cgen_module_t *current_mod, probe_mod, **pmod;
     UNUSED l4cgen_message_t *current_msg;
+    l4cgen_context_t *current_ctx;
     mnhash_item_t *hit;
+    int lineno;
 
     if ((fp = fopen(fname, "r")) == NULL) {
         if (verbose > 0) {
@@ -264,10 +483,13 @@ process_logdef(const char *fname)
     linesz = 0;
     current_mod = NULL;
     current_msg = NULL;
+    current_ctx = NULL;
+    lineno = 0;
 
     while ((nread = getline(&line, &linesz, fp)) > 0) {
         UNUSED char *a, *b, *c;
 
+        ++lineno;
         /* clear eol symbol */
         if (line[nread - 1] == '\n') {
             line[nread - 1] = '\0';
@@ -281,6 +503,10 @@ process_logdef(const char *fname)
         while (*a == ' ') {
             ++a;
         }
+        if (*a == '#') {
+            process_directive(fname, lineno, a + 1, current_mod, &current_ctx);
+            continue;
+        }
         if ((b = strchr(a, ' ')) == NULL) {
             goto miss2;
         }
@@ -318,10 +544,6 @@ process_logdef(const char *fname)
             fprintf(stderr, "b=%s\n", b);
             fprintf(stderr, "c=%s\n", c);
         }
-        if (*a == '#') {
-            /* comment */
-            continue;
-        }
         if (current_mod == NULL) {
             if (verbose) {
                 fprintf(stderr, "No module context, ignoring line: %s\n", line);
@@ -351,10 +573,6 @@ miss3:
             fprintf(stderr, "a=%s\n", a);
             fprintf(stderr, "b=%s\n", b);
         }
-        if (*a == '#') {
-            /* comment */
-            continue;
-        }
 
         if (state == PROCESS_LOGDEF_STATE_MODULE) {
             /* previous module section was empty*/
@@ -369,6 +587,10 @@ miss3:
             current_mod->mid = probe_mod.mid;
             current_mod->name = bytes_new_from_str(b);
             hash_set_item(&modules, current_mod, NULL);
+            if (MNUNLIKELY((pmod = array_incr(&modorder)) == NULL)) {
+                FAIL("array_incr");
+            }
+            *pmod = current_mod;
         } else {
             BYTES_DECREF(&probe_mod.mid);
             current_mod = hit->key;
@@ -386,6 +608,289 @@ end:
 }
 
 
+/*
+ * Emit <MOD>_<MSG>_WRITE(bs, sz, ...), appending the formatted message to
+ * bs, and <MOD>_<MSG>_VWRITE for slim call sites: a serializer taking a
+ * va_list, defined in the .c file, or NULL.  When the format is a single
+ * literal using only %d %i %u %x %X (optionally l, ll, z), %c, %s, %f,
+ * %.Nf and %%, it expands to a serializer that appends literal runs as
+ * they are and converts the arguments with the mnl4c_bs_*() helpers.
+ * Anything else (flags, width, other conversions, escapes that could
+ * spell a '%') falls back to bytestream_nprintf().
+ */
+static void
+render_serializer(FILE *fhout,
+                  FILE *fcout,
+                  const char *mod,
+                  const char *msg,
+                  const char *value)
+{
+    const char *p, *end;
+    char *params, *body, *vargs, *vcall;
+    size_t paramssz, bodysz, vargssz, vcallsz;
+    FILE *fparams, *fbody, *fvargs, *fvcall;
+    int nargs;
+    bool inlit, first, ok;
+
+    params = NULL;
+    body = NULL;
+    vargs = NULL;
+    vcall = NULL;
+    if ((fparams = open_memstream(&params, &paramssz)) == NULL) {
+        FAIL("open_memstream");
+    }
+    if ((fbody = open_memstream(&body, &bodysz)) == NULL) {
+        FAIL("open_memstream");
+    }
+    if ((fvargs = open_memstream(&vargs, &vargssz)) == NULL) {
+        FAIL("open_memstream");
+    }
+    if ((fvcall = open_memstream(&vcall, &vcallsz)) == NULL) {
+        FAIL("open_memstream");
+    }
+
+    ok = false;
+    nargs = 0;
+    inlit = false;
+    first = true;
+    end = value + strlen(value);
+    if (end - value < 2 || *value != '"' || end[-1] != '"') {
+        goto out;
+    }
+
+#define SERIALIZER_ITEM()                                                      \
+    do {                                                                       \
+        fprintf(fbody, first ? "    if (" : " ||\n        ");                  \
+        first = false;                                                         \
+    } while (0)                                                                \
+
+
+#define SERIALIZER_LIT_OPEN()                                                  \
+    do {                                                                       \
+        if (!inlit) {                                                          \
+            SERIALIZER_ITEM();                                                 \
+            fprintf(fbody, "MNL4C_BS_LIT(bs, \"");                             \
+            inlit = true;                                                      \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+#define SERIALIZER_LIT_CLOSE()                                                 \
+    do {                                                                       \
+        if (inlit) {                                                           \
+            fprintf(fbody, "\") < 0");                                         \
+            inlit = false;                                                     \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+    for (p = value + 1, --end; p < end;) {
+        const char *lmod, *type, *call;
+        int prec;
+        char conv;
+
+        if (*p == '"') {
+            /* concatenated literals */
+            goto out;
+        }
+        if (*p == '\\') {
+            if (p + 1 == end ||
+                isdigit(p[1]) ||
+                p[1] == 'x' ||
+                p[1] == 'u' ||
+                p[1] == 'U') {
+                goto out;
+            }
+            SERIALIZER_LIT_OPEN();
+            fputc(p[0], fbody);
+            fputc(p[1], fbody);
+            p += 2;
+            continue;
+        }
+        if (*p != '%') {
+            SERIALIZER_LIT_OPEN();
+            fputc(*p++, fbody);
+            continue;
+        }
+        ++p;
+        if (*p == '%') {
+            SERIALIZER_LIT_OPEN();
+            fputc(*p++, fbody);
+            continue;
+        }
+
+        prec = -1;
+        if (*p == '.') {
+            ++p;
+            if (!isdigit(*p)) {
+                goto out;
+            }
+            prec = *p++ - '0';
+            if (isdigit(*p)) {
+                goto out;
+            }
+        }
+        if (strncmp(p, "ll", 2) == 0) {
+            lmod = "ll";
+        } else if (*p == 'l') {
+            lmod = "l";
+        } else if (*p == 'z') {
+            lmod = "z";
+        } else {
+            lmod = "";
+        }
+        p += strlen(lmod);
+        conv = *p++;
+
+        switch (conv) {
+        case 'd':
+        case 'i':
+            type = *lmod == '\0' ? "int" :
+                   strcmp(lmod, "l") == 0 ? "long" :
+                   strcmp(lmod, "ll") == 0 ? "long long" : "ssize_t";
+            call = "mnl4c_bs_ll(bs, a%d)";
+            break;
+
+        case 'u':
+        case 'x':
+        case 'X':
+            type = *lmod == '\0' ? "unsigned" :
+                   strcmp(lmod, "l") == 0 ? "unsigned long" :
+                   strcmp(lmod, "ll") == 0 ? "unsigned long long" : "size_t";
+            call = conv == 'u' ? "mnl4c_bs_ull(bs, a%d)" :
+                   conv == 'x' ? "mnl4c_bs_hex(bs, a%d, false)" :
+                                 "mnl4c_bs_hex(bs, a%d, true)";
+            break;
+
+        case 'c':
+            type = "int";
+            call = "mnl4c_bs_chr(bs, a%d)";
+            break;
+
+        case 's':
+            /* any char pointer, the format check has vetted it */
+            type = "const void *";
+            call = "mnl4c_bs_str(bs, a%d)";
+            break;
+
+        case 'f':
+            if (*lmod != '\0' && strcmp(lmod, "l") != 0) {
+                goto out;
+            }
+            lmod = "";
+            type = "double";
+            call = "mnl4c_bs_fixed(bs, a%d, %d)";
+            break;
+
+        default:
+            goto out;
+        }
+        if ((prec >= 0 && conv != 'f') ||
+            (*lmod != '\0' && conv == 'c') ||
+            (*lmod != '\0' && conv == 's')) {
+            goto out;
+        }
+
+        SERIALIZER_LIT_CLOSE();
+        SERIALIZER_ITEM();
+        fprintf(fbody, call, nargs, prec < 0 ? 6 : prec);
+        fprintf(fbody, " < 0");
+        fprintf(fparams,
+                ",\n%*s%s%sa%d",
+                (int)(strlen(mod) + strlen(msg) + 12),
+                "",
+                type,
+                type[strlen(type) - 1] == '*' ? "" : " ",
+                nargs);
+        /* all types above are promoted already */
+        fprintf(fvargs,
+                "    %s%sa%d = va_arg(ap, %s);\n",
+                type,
+                type[strlen(type) - 1] == '*' ? "" : " ",
+                nargs,
+                type);
+        fprintf(fvcall, ", a%d", nargs);
+        ++nargs;
+    }
+    SERIALIZER_LIT_CLOSE();
+    if (!first) {
+        fprintf(fbody,
+                ") {\n"
+                "        SEOD(bs) = start;\n"
+                "        return -1;\n"
+                "    }\n");
+    }
+
+#undef SERIALIZER_ITEM
+#undef SERIALIZER_LIT_OPEN
+#undef SERIALIZER_LIT_CLOSE
+
+    ok = true;
+
+out:
+    fclose(fparams);
+    fclose(fbody);
+    fclose(fvargs);
+    fclose(fvcall);
+
+    if (ok) {
+        fprintf(fhout,
+            "static inline ssize_t\n"
+            "%s_%s_serialize(mnbytestream_t *bs,\n"
+            "%*sssize_t sz%s)\n"
+            "{\n"
+            "    off_t start = SEOD(bs);\n"
+            "\n"
+            "%s"
+            "    if (SEOD(bs) - start >= sz) {\n"
+            "        SEOD(bs) = start;\n"
+            "        return -1;\n"
+            "    }\n"
+            "    return SEOD(bs) - start;\n"
+            "}\n"
+            "#define %s_%s_WRITE(bs, sz, ...) "
+                "(MNL4C_PRINTFLIKE_CHECK(%s_%s_FMT, ##__VA_ARGS__), "
+                "%s_%s_serialize((bs), (sz), ##__VA_ARGS__))\n",
+            mod, msg,
+            (int)(strlen(mod) + strlen(msg) + 12), "", params,
+            body,
+            mod, msg,
+            mod, msg,
+            mod, msg);
+        fprintf(fhout,
+            "ssize_t %s_%s_vwrite(mnbytestream_t *, ssize_t, va_list);\n"
+            "#define %s_%s_VWRITE %s_%s_vwrite\n",
+            mod, msg,
+            mod, msg,
+            mod, msg);
+        fprintf(fcout,
+            "ssize_t\n"
+            "%s_%s_vwrite(mnbytestream_t *bs, ssize_t sz, va_list ap)\n"
+            "{\n"
+            "%s"
+            "%s"
+            "\n"
+            "    return %s_%s_serialize(bs, sz%s);\n"
+            "}\n",
+            mod, msg,
+            vargs,
+            nargs == 0 ? "    (void)ap;\n" : "",
+            mod, msg, vcall);
+    } else {
+        fprintf(fhout,
+            "#define %s_%s_WRITE(bs, sz, ...) "
+                "bytestream_nprintf((bs), (sz), %s_%s_FMT, ##__VA_ARGS__)\n"
+            "#define %s_%s_VWRITE NULL\n",
+            mod, msg,
+            mod, msg,
+            mod, msg);
+    }
+    free(params);
+    free(body);
+    free(vargs);
+    free(vcall);
+}
+
 
 static int
 mycb2(void *o, void *udata)
@@ -394,6 +899,7 @@ mycb2(void *o, void *udata)
     struct {
         FILE *fhout;
         FILE *fcout;
+        FILE *fxout;
         const char *lib;
         l4cgen_module_t *mod;
         int idx;
@@ -407,20 +913,62 @@ mycb2(void *o, void *udata)
     }
 
     fprintf(params->fhout,
-        "#define %s_%s_ID %d\n"
+        "#define %s_%s_ID (%s_logdef_base + %d)\n"
+        "#define %s_%s_IDX %d\n"
+        "#define %s_%s_LEVEL %s\n"
         "#define %s_%s_FMT %s\n",
         BDATA(params->mod->mid),
         BDATA(msg->mid),
+        params->lib,
         params->idx,
         BDATA(params->mod->mid),
         BDATA(msg->mid),
+        params->idx,
+        BDATA(params->mod->mid),
+        BDATA(msg->mid),
+        BDATA(msg->level),
+        BDATA(params->mod->mid),
+        BDATA(msg->mid),
         BDATA(msg->value));
 
+    /* messages below the compile-time floor are neither registered nor
+       serialized out of line */
     fprintf(params->fcout,
-        "    %s_LREG(logger, %s, %s);\n",
+        "#if %s_%s_LEVEL <= %s_MIN_LEVEL\n"
+        "MNL4C_MSGDEF(%s, %s, %s, %d);\n",
         BDATA(params->mod->mid),
-        BDATA(msg->level),
-        BDATA(msg->mid));
+        BDATA(msg->mid),
+        BDATA(params->mod->mid),
+        params->lib,
+        BDATA(params->mod->mid),
+        BDATA(msg->mid),
+        params->idx);
+    render_serializer(params->fhout,
+                      params->fcout,
+                      BCDATA(params->mod->mid),
+                      BCDATA(msg->mid),
+                      BCDATA(msg->value));
+    fprintf(params->fcout, "#endif\n");
+
+    if (params->fxout != NULL) {
+        fprintf(params->fxout,
+            "struct %s {\n"
+            "    static int id() { return %s_%s_ID; }\n"
+            "    static constexpr int level = %s_%s_LEVEL;\n"
+            "    static constexpr int min_level = %s_MIN_LEVEL;\n"
+            "    static constexpr const char *mod = %s_NAME;\n"
+            "    static constexpr const char fmt[] = %s_%s_FMT;\n"
+            "};\n",
+            BDATA(msg->mid),
+            BDATA(params->mod->mid),
+            BDATA(msg->mid),
+            BDATA(params->mod->mid),
+            BDATA(msg->mid),
+            BDATA(params->mod->mid),
+            BDATA(params->mod->mid),
+            BDATA(params->mod->mid),
+            BDATA(msg->mid));
+    }
 
     ++params->idx;
 
@@ -434,110 +982,158 @@ mycb1(void *key, UNUSED void *value, void *udata)
     struct {
         FILE *fhout;
         FILE *fcout;
+        FILE *fxout;
         const char *lib;
         l4cgen_module_t *mod;
         int idx;
     } *params = udata;
+    unsigned tsfmt;
+    const char *lt, *context_lt, *dbg, *context_dbg;
 
     //assert(mod->mid != NULL);
     //assert(mod->name != NULL);
 
     params->mod = mod;
+    tsfmt = mod->tsfmt != 0 ? mod->tsfmt : tsfmt_default;
 
     if (verbose > 2) {
         printf("mod %s, %s:\n", BDATASAFE(mod->mid), BDATASAFE(mod->name));
     }
 
     fprintf(params->fhout,
-        "#define %s_LLOG(logger, msg, ...) MNL4C_WRITE_MAYBE_PRINTFLIKE_FLEVEL(logger, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LLOG(logger, context, msg, ...) MNL4C_WRITE_MAYBE_PRINTFLIKE_CONTEXT_FLEVEL(logger, context, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG(logger, level, msg, ...) MNL4C_WRITE_MAYBE_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LOG(logger, level, context, msg, ...) MNL4C_WRITE_MAYBE_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_LT(logger, level, msg, ...) MNL4C_WRITE_ONCE_PRINTFLIKE_LT(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_LT2(logger, level, msg, ...) MNL4C_WRITE_ONCE_PRINTFLIKE_LT2(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LOG_LT(logger, level, context, msg, ...) MNL4C_WRITE_ONCE_PRINTFLIKE_LT_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LOG_LT2(logger, level, context, msg, ...) MNL4C_WRITE_ONCE_PRINTFLIKE_LT2_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_START(logger, level, msg, ...) MNL4C_WRITE_START_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_CONTEXT_START(logger, level, context, msg, ...) MNL4C_WRITE_START_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_START_LT(logger, level, msg, ...) MNL4C_WRITE_START_PRINTFLIKE_LT(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_START_LT2(logger, level, msg, ...) MNL4C_WRITE_START_PRINTFLIKE_LT2(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_CONTEXT_START_LT(logger, level, context, msg, ...) MNL4C_WRITE_START_PRINTFLIKE_LT_CONTEXT(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_CONTEXT_START_LT2(logger, level, context, msg, ...) MNL4C_WRITE_START_PRINTFLIKE_LT2_CONTEXT(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_NEXT(logger, level, msg, fmt, ...) MNL4C_WRITE_NEXT_PRINTFLIKE(logger, level, %s, msg, fmt, ##__VA_ARGS__)\n"
-        "#define %s_LOG_CONTEXT_NEXT(logger, level, context, msg, fmt, ...) MNL4C_WRITE_NEXT_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, fmt, ##__VA_ARGS__)\n"
-        "#define %s_LOG_STOP(logger, level, msg, ...) MNL4C_WRITE_STOP_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_LOG_CONTEXT_STOP(logger, level, context, msg, ...) MNL4C_WRITE_STOP_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
-        "#define %s_DO_AT(logger, level, msg, __a1) MNL4C_DO_AT(logger, level, %s, msg, __a1)\n"
-        "#define %s_LERROR(logger, msg, ...) %s_LOG_LT(logger, LOG_ERR, msg, ##__VA_ARGS__)\n"
-        "#define %s_LERROR2(logger, msg, ...) %s_LOG_LT2(logger, LOG_ERR, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LERROR(logger, context, msg, ...) %s_CONTEXT_LOG_LT(logger, LOG_ERR, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LERROR2(logger, context, msg, ...) %s_CONTEXT_LOG_LT2(logger, LOG_ERR, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LWARNING(logger, msg, ...) %s_LOG_LT(logger, LOG_WARNING, msg, ##__VA_ARGS__)\n"
-        "#define %s_LWARNING2(logger, msg, ...) %s_LOG_LT2(logger, LOG_WARNING, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LWARNING(logger, context, msg, ...) %s_CONTEXT_LOG_LT(logger, LOG_WARNING, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LWARNING2(logger, context, msg, ...) %s_CONTEXT_LOG_LT2(logger, LOG_WARNING, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LINFO(logger, msg, ...) %s_LOG_LT(logger, LOG_INFO, msg, ##__VA_ARGS__)\n"
-        "#define %s_LINFO2(logger, msg, ...) %s_LOG_LT2(logger, LOG_INFO, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LINFO(logger, context, msg, ...) %s_CONTEXT_LOG_LT(logger, LOG_INFO, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LINFO2(logger, context, msg, ...) %s_CONTEXT_LOG_LT2(logger, LOG_INFO, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LDEBUG(logger, msg, ...) %s_LOG(logger, LOG_DEBUG, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LDEBUG(logger, context, msg, ...) %s_CONTEXT_LOG(logger, LOG_DEBUG, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LREG(logger, level, msg) mnl4c_register_msg(logger, level, %s_ ## msg ## _ID, \"%s_\" #msg)\n"
-        "#define %s_NAME %s\n"
-        "#define %s_PREFIX _MNL4C_TSPIDMOD_FMT\n"
-        "#define %s_ARGS _MNL4C_TSPIDMOD_ARGS(%s)\n",
+        "#ifndef %s_MIN_LEVEL\n"
+        "#   define %s_MIN_LEVEL MNL4C_MIN_LEVEL\n"
+        "#endif\n"
+        "#define %s_LOGDEF_BASE %s_logdef_base\n",
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        params->lib);
+
+    /*
+     * slim call sites, see MNL4C_SITE, unless MNL4C_INLINE_SITES is
+     * defined where the header is included
+     */
+    fprintf(params->fhout,
+        "#ifdef MNL4C_INLINE_SITES\n"
+        "#define %s_LLOG(logger, msg, ...) MNL4C_IF_COMPILED_FLEVEL(%s, msg, MNL4C_WRITE_MAYBE_PRINTFLIKE_FLEVEL(logger, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LLOG(logger, context, msg, ...) MNL4C_IF_COMPILED_FLEVEL(%s, msg, MNL4C_WRITE_MAYBE_PRINTFLIKE_CONTEXT_FLEVEL(logger, context, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_LOG(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_MAYBE_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LOG(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_MAYBE_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_LOG_LT(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_ONCE_PRINTFLIKE_LT(logger, level, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_LOG_LT2(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_ONCE_PRINTFLIKE_LT2(logger, level, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LOG_LT(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_ONCE_PRINTFLIKE_LT_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LOG_LT2(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_ONCE_PRINTFLIKE_LT2_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__))\n"
+        "#else\n"
+        "#define %s_LLOG(logger, msg, ...) MNL4C_IF_COMPILED_FLEVEL(%s, msg, MNL4C_SITE(logger, -1, MNL4C_SITE_THROTTLE, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LLOG(logger, context, msg, ...) MNL4C_IF_COMPILED_FLEVEL(%s, msg, MNL4C_SITE_CONTEXT(logger, -1, MNL4C_SITE_THROTTLE, context, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_LOG(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE(logger, level, MNL4C_SITE_THROTTLE, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LOG(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE_CONTEXT(logger, level, MNL4C_SITE_THROTTLE, context, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_LOG_LT(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE(logger, level, MNL4C_SITE_LT, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_LOG_LT2(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE(logger, level, MNL4C_SITE_LT2, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LOG_LT(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE_CONTEXT(logger, level, MNL4C_SITE_LT, context, %s, msg, ##__VA_ARGS__))\n"
+        "#define %s_CONTEXT_LOG_LT2(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE_CONTEXT(logger, level, MNL4C_SITE_LT2, context, %s, msg, ##__VA_ARGS__))\n"
+        "#endif\n",
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        BDATA(mod->mid));
 
+    fprintf(params->fhout,
+        "#define %s_LOG_START(logger, level, msg, ...) MNL4C_IF_COMPILED_START(%s, msg, level) MNL4C_WRITE_START_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__)\n"
+        "#define %s_LOG_CONTEXT_START(logger, level, context, msg, ...) MNL4C_IF_COMPILED_START(%s, msg, level) MNL4C_WRITE_START_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
+        "#define %s_LOG_START_LT(logger, level, msg, ...) MNL4C_IF_COMPILED_START(%s, msg, level) MNL4C_WRITE_START_PRINTFLIKE_LT(logger, level, %s, msg, ##__VA_ARGS__)\n"
+        "#define %s_LOG_START_LT2(logger, level, msg, ...) MNL4C_IF_COMPILED_START(%s, msg, level) MNL4C_WRITE_START_PRINTFLIKE_LT2(logger, level, %s, msg, ##__VA_ARGS__)\n"
+        "#define %s_LOG_CONTEXT_START_LT(logger, level, context, msg, ...) MNL4C_IF_COMPILED_START(%s, msg, level) MNL4C_WRITE_START_PRINTFLIKE_LT_CONTEXT(logger, level, %s, msg, ##__VA_ARGS__)\n"
+        "#define %s_LOG_CONTEXT_START_LT2(logger, level, context, msg, ...) MNL4C_IF_COMPILED_START(%s, msg, level) MNL4C_WRITE_START_PRINTFLIKE_LT2_CONTEXT(logger, level, %s, msg, ##__VA_ARGS__)\n"
+        "#define %s_LOG_NEXT(logger, level, msg, fmt, ...) MNL4C_WRITE_NEXT_PRINTFLIKE(logger, level, %s, msg, fmt, ##__VA_ARGS__)\n"
+        "#define %s_LOG_CONTEXT_NEXT(logger, level, context, msg, fmt, ...) MNL4C_WRITE_NEXT_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, fmt, ##__VA_ARGS__)\n"
+        "#define %s_LOG_STOP(logger, level, msg, ...) MNL4C_WRITE_STOP_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__); MNL4C_IF_COMPILED_STOP\n"
+        "#define %s_LOG_CONTEXT_STOP(logger, level, context, msg, ...) MNL4C_WRITE_STOP_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__); MNL4C_IF_COMPILED_STOP\n"
+        "#define %s_DO_AT(logger, level, msg, __a1) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_DO_AT(logger, level, %s, msg, __a1))\n"
+        "#define %s_LOG_SIGSAFE(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_WRITE_SIGSAFE(logger, level, %s, msg, ##__VA_ARGS__))\n",
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
@@ -555,71 +1151,355 @@ mycb1(void *key, UNUSED void *value, void *udata)
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        BDATA(mod->mid),
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid));
+
+    /*
+     * #timestamp-format: <MOD>_TS_LOG logs with the module's timestamps,
+     * an epoch only site does not call localtime()/strftime().
+     * <MOD>_TS_LOG_MAYBE is the same for the throttled, buffered family
+     * of <MOD>_LOG; there is no such inline family with datetime
+     * timestamps, those sites are slim even with MNL4C_INLINE_SITES.
+     */
+    if (tsfmt != 0) {
+        static const char *inline_families[] = {
+            NULL,
+            "MNL4C_WRITE_ONCE_PRINTFLIKE",
+            "MNL4C_WRITE_ONCE_PRINTFLIKE_LT",
+            "MNL4C_WRITE_ONCE_PRINTFLIKE_LT2",
+        };
+        static const char *site_flags[] = {
+            NULL,
+            "0",
+            "MNL4C_SITE_LT",
+            "MNL4C_SITE_LT2",
+        };
+        static const char *maybe_site_flags[] = {
+            NULL,
+            "MNL4C_SITE_THROTTLE",
+            "MNL4C_SITE_THROTTLE | MNL4C_SITE_LT",
+            "MNL4C_SITE_THROTTLE | MNL4C_SITE_LT2",
+        };
+
+        fprintf(params->fhout,
+            "#ifdef MNL4C_INLINE_SITES\n"
+            "#define %s_TS_LOG(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, %s(logger, level, %s, msg, ##__VA_ARGS__))\n"
+            "#define %s_CONTEXT_TS_LOG(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, %s_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__))\n"
+            "#else\n"
+            "#define %s_TS_LOG(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE(logger, level, %s, %s, msg, ##__VA_ARGS__))\n"
+            "#define %s_CONTEXT_TS_LOG(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE_CONTEXT(logger, level, %s, context, %s, msg, ##__VA_ARGS__))\n"
+            "#endif\n",
+
+            BDATA(mod->mid),
+            BDATA(mod->mid),
+            inline_families[tsfmt],
+            BDATA(mod->mid),
+
+            BDATA(mod->mid),
+            BDATA(mod->mid),
+            inline_families[tsfmt],
+            BDATA(mod->mid),
+
+            BDATA(mod->mid),
+            BDATA(mod->mid),
+            site_flags[tsfmt],
+            BDATA(mod->mid),
+
+            BDATA(mod->mid),
+            BDATA(mod->mid),
+            site_flags[tsfmt],
+            BDATA(mod->mid));
+
+        if (tsfmt == L4CGEN_TS_EPOCH) {
+            /* the plain family already has epoch timestamps */
+            fprintf(params->fhout,
+                "#define %s_TS_LOG_MAYBE(logger, level, msg, ...) %s_LOG(logger, level, msg, ##__VA_ARGS__)\n"
+                "#define %s_CONTEXT_TS_LOG_MAYBE(logger, level, context, msg, ...) %s_CONTEXT_LOG(logger, level, context, msg, ##__VA_ARGS__)\n",
+
+                BDATA(mod->mid),
+                BDATA(mod->mid),
+
+                BDATA(mod->mid),
+                BDATA(mod->mid));
+        } else {
+            fprintf(params->fhout,
+                "#define %s_TS_LOG_MAYBE(logger, level, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE(logger, level, %s, %s, msg, ##__VA_ARGS__))\n"
+                "#define %s_CONTEXT_TS_LOG_MAYBE(logger, level, context, msg, ...) MNL4C_IF_COMPILED(%s, msg, level, MNL4C_SITE_CONTEXT(logger, level, %s, context, %s, msg, ##__VA_ARGS__))\n",
+
+                BDATA(mod->mid),
+                BDATA(mod->mid),
+                maybe_site_flags[tsfmt],
+                BDATA(mod->mid),
+
+                BDATA(mod->mid),
+                BDATA(mod->mid),
+                maybe_site_flags[tsfmt],
+                BDATA(mod->mid));
+        }
+        lt = "TS_LOG";
+        context_lt = "CONTEXT_TS_LOG";
+        dbg = "TS_LOG_MAYBE";
+        context_dbg = "CONTEXT_TS_LOG_MAYBE";
+    } else {
+        lt = "LOG_LT";
+        context_lt = "CONTEXT_LOG_LT";
+        dbg = "LOG";
+        context_dbg = "CONTEXT_LOG";
+    }
+
+    fprintf(params->fhout,
+        "#define %s_LERROR(logger, msg, ...) %s_%s(logger, LOG_ERR, msg, ##__VA_ARGS__)\n"
+        "#define %s_LERROR2(logger, msg, ...) %s_LOG_LT2(logger, LOG_ERR, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LERROR(logger, context, msg, ...) %s_%s(logger, LOG_ERR, context, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LERROR2(logger, context, msg, ...) %s_CONTEXT_LOG_LT2(logger, LOG_ERR, context, msg, ##__VA_ARGS__)\n"
+        "#define %s_LWARNING(logger, msg, ...) %s_%s(logger, LOG_WARNING, msg, ##__VA_ARGS__)\n"
+        "#define %s_LWARNING2(logger, msg, ...) %s_LOG_LT2(logger, LOG_WARNING, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LWARNING(logger, context, msg, ...) %s_%s(logger, LOG_WARNING, context, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LWARNING2(logger, context, msg, ...) %s_CONTEXT_LOG_LT2(logger, LOG_WARNING, context, msg, ##__VA_ARGS__)\n"
+        "#define %s_LINFO(logger, msg, ...) %s_%s(logger, LOG_INFO, msg, ##__VA_ARGS__)\n"
+        "#define %s_LINFO2(logger, msg, ...) %s_LOG_LT2(logger, LOG_INFO, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LINFO(logger, context, msg, ...) %s_%s(logger, LOG_INFO, context, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LINFO2(logger, context, msg, ...) %s_CONTEXT_LOG_LT2(logger, LOG_INFO, context, msg, ##__VA_ARGS__)\n"
+        "#define %s_LDEBUG(logger, msg, ...) %s_%s(logger, LOG_DEBUG, msg, ##__VA_ARGS__)\n"
+        "#define %s_CONTEXT_LDEBUG(logger, context, msg, ...) %s_%s(logger, LOG_DEBUG, context, msg, ##__VA_ARGS__)\n",
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        lt,
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        context_lt,
 
         BDATA(mod->mid),
         BDATA(mod->mid),
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        lt,
 
         BDATA(mod->mid),
         BDATA(mod->mid),
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        context_lt,
 
         BDATA(mod->mid),
         BDATA(mod->mid),
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        lt,
 
         BDATA(mod->mid),
         BDATA(mod->mid),
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        context_lt,
 
         BDATA(mod->mid),
         BDATA(mod->mid),
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        dbg,
 
         BDATA(mod->mid),
         BDATA(mod->mid),
+        context_dbg);
 
+    fprintf(params->fhout,
+        "#define %s_LREG(logger, level, msg) mnl4c_register_msg(logger, level, %s_ ## msg ## _ID, \"%s_\" #msg)\n"
+        "#define %s_NAME %s\n"
+        "#define %s_PREFIX _MNL4C_TSPIDMOD_FMT\n"
+        "#define %s_ARGS _MNL4C_TSPIDMOD_ARGS(%s)\n",
+
+        BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
 
+        BDATA(mod->mid),
         BDATA(mod->name),
         BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid));
+
+    /* see mnl4c_builder_start() */
+    fprintf(params->fhout,
+        "#define %s_LOG_BEGIN(logger, level, msg, ...) (MNL4C_COMPILED(%s, msg, level) ? mnl4c_builder_start(logger, level, %s_ ## msg ## _ID, %s_NAME, %s_ ## msg ## _FMT, ##__VA_ARGS__) : NULL)\n",
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid));
+
+    /* see mnl4c_write_payload() */
+    fprintf(params->fhout,
+        "#define %s_LOG_PAYLOAD(logger, level, msg, buf, sz, enc, ...) (MNL4C_COMPILED(%s, msg, level) ? mnl4c_write_payload(logger, level, %s_ ## msg ## _ID, %s_NAME, buf, sz, enc, %s_ ## msg ## _FMT, ##__VA_ARGS__) : 0)\n",
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        BDATA(mod->mid));
+    if (params->fxout != NULL) {
+        fprintf(params->fxout, "namespace %s {\n", BDATA(mod->mid));
+    }
     (void)array_traverse(&mod->messages, mycb2, udata);
+    if (params->fxout != NULL) {
+        fprintf(params->fxout, "} /* namespace %s */\n", BDATA(mod->mid));
+    }
     return 0;
 }
 
 
 static void
-render_body(FILE *fhout, FILE *fcout, const char *lib)
+render_body(FILE *fhout, FILE *fcout, FILE *fxout, const char *lib)
 {
     struct {
         FILE *fhout;
         FILE *fcout;
+        FILE *fxout;
         const char *lib;
         l4cgen_module_t *mod;
         int idx;
-    } params = { fhout, fcout, lib, NULL, 0 };
+    } params = { fhout, fcout, fxout, lib, NULL, 0 };
+    l4cgen_module_t **pmod;
+    mnarray_iter_t it;
+
+    for (pmod = array_first(&modorder, &it);
+         pmod != NULL;
+         pmod = array_next(&modorder, &it)) {
+        (void)mycb1(*pmod, NULL, &params);
+    }
+}
 
-    (void)hash_traverse(&modules, mycb1, &params);
+
+/*
+ * <NAME>_<MOD>_LOG and the <NAME>_<MOD>_L<LEVEL> shorthands, wrapping the
+ * module's CONTEXT families.
+ */
+static void
+render_context_module(FILE *fhout,
+                      l4cgen_context_t *ctx,
+                      l4cgen_module_t *mod)
+{
+    static const char *levels[][2] = {
+        {"LERROR", "LOG_ERR"},
+        {"LWARNING", "LOG_WARNING"},
+        {"LINFO", "LOG_INFO"},
+        {"LDEBUG", "LOG_DEBUG"},
+    };
+    const char *sep, *args;
+    unsigned i;
+
+    if (ctx->args != NULL) {
+        sep = ", ";
+        args = BCDATA(ctx->args);
+    } else {
+        sep = "";
+        args = "";
+    }
+    fprintf(fhout,
+        "#define %s_%s_LOG(logger, level, msg, ...) %s_%s(logger, level, %s, msg%s%s, ##__VA_ARGS__)\n",
+        BDATA(ctx->name),
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        (mod->tsfmt != 0 || tsfmt_default != 0) ?
+            "CONTEXT_TS_LOG_MAYBE" : "CONTEXT_LOG",
+        BDATA(ctx->fmt),
+        sep,
+        args);
+    for (i = 0; i < countof(levels); ++i) {
+        fprintf(fhout,
+            "#define %s_%s_%s(logger, msg, ...) %s_CONTEXT_%s(logger, %s, msg%s%s, ##__VA_ARGS__)\n",
+            BDATA(ctx->name),
+            BDATA(mod->mid),
+            levels[i][0],
+            BDATA(mod->mid),
+            levels[i][0],
+            BDATA(ctx->fmt),
+            sep,
+            args);
+    }
+}
+
+
+static void
+render_contexts(FILE *fhout)
+{
+    l4cgen_context_t *ctx;
+    mnarray_iter_t it;
+
+    for (ctx = array_first(&contexts, &it);
+         ctx != NULL;
+         ctx = array_next(&contexts, &it)) {
+        if (ctx->fmt == NULL) {
+            errx(1, "#context %s has no #context-format", BDATA(ctx->name));
+        }
+        if (ARRAY_ELNUM(&ctx->scope) == 0) {
+            l4cgen_module_t **pmod;
+            mnarray_iter_t it2;
+
+            for (pmod = array_first(&modorder, &it2);
+                 pmod != NULL;
+                 pmod = array_next(&modorder, &it2)) {
+                render_context_module(fhout, ctx, *pmod);
+            }
+        } else {
+            mnbytes_t **mid;
+            mnarray_iter_t it2;
+
+            for (mid = array_first(&ctx->scope, &it2);
+                 mid != NULL;
+                 mid = array_next(&ctx->scope, &it2)) {
+                l4cgen_module_t probe_mod;
+                mnhash_item_t *hit;
+
+                probe_mod.mid = *mid;
+                if ((hit = hash_get_item(&modules, &probe_mod)) == NULL) {
+                    errx(1, "#context %s: unknown module %s",
+                         BDATA(ctx->name), BDATA(*mid));
+                }
+                render_context_module(fhout, ctx, hit->key);
+            }
+        }
+    }
 }
 
 
 static void
 render_tail(FILE *fhout, FILE *fcout, const char *lib)
 {
-    fprintf(fcout, "}\n");
+    /*
+     * The constructor takes the library's ids before anything can log,
+     * and hands the object's jump label sites over for patching.
+     * <lib>_init_logdef() calls it again in case it runs from another
+     * constructor that came first.
+     */
+    fprintf(fcout,
+        "static void __attribute__((constructor))\n"
+        "%s_logdef_add(void)\n"
+        "{\n"
+        "    mnl4c_msgdefs_add(__start_mnl4c_msgdefs,\n"
+        "                      __stop_mnl4c_msgdefs,\n"
+        "                      &%s_logdef_base);\n"
+        "    mnl4c_jump_add(__start_mnl4c_jump, __stop_mnl4c_jump);\n"
+        "}\n"
+        "void\n"
+        "%s_init_logdef(mnl4c_logger_t logger)\n"
+        "{\n"
+        "    %s_logdef_add();\n"
+        "    (void)mnl4c_msgdefs_register(logger, &%s_logdef_base);\n"
+        "}\n",
+        lib, lib, lib, lib, lib);
     fprintf(fhout, "void %s_init_logdef(mnl4c_logger_t);\n", lib);
     fprintf(fhout,
         "#ifdef __cplusplus\n"
@@ -629,11 +1509,21 @@ render_tail(FILE *fhout, FILE *fcout, const char *lib)
 }
 
 
+static void
+render_xtail(FILE *fxout, const char *lib)
+{
+    fprintf(fxout,
+        "} /* namespace %s_logdef */\n"
+        "#endif\n",
+        lib);
+}
+
+
 int
 main(int argc, char *argv[static argc])
 {
     int i, ch, optidx;
-    FILE *fhout, *fcout;
+    FILE *fhout, *fcout, *fxout;
 
 #ifdef HAVE_MALLOC_H
 #   ifndef NDEBUG
@@ -649,7 +1539,7 @@ main(int argc, char *argv[static argc])
 #   endif
 #endif
 
-    while ((ch = getopt_long(argc, argv, "C:hH:L:vV", optinfo, &optidx)) != -1) {
+    while ((ch = getopt_long(argc, argv, "C:hH:L:vVX:", optinfo, &optidx)) != -1) {
         switch (ch) {
         case 'C':
             cout = strdup(optarg);
@@ -677,6 +1567,10 @@ main(int argc, char *argv[static argc])
             exit(0);
             break;
 
+        case 'X':
+            xout = strdup(optarg);
+            break;
+
         default:
             usage(argv[0]);
             exit(1);
@@ -716,21 +1610,45 @@ main(int argc, char *argv[static argc])
     if ((fcout = fopen(cout, "w")) == NULL) {
         errx(1, "Cannot open %s\n", cout);
     }
+    fxout = NULL;
+    if (xout != NULL && (fxout = fopen(xout, "w")) == NULL) {
+        errx(1, "Cannot open %s\n", xout);
+    }
 
     hash_init(&modules, 127,
         l4cgen_module_hash,
         l4cgen_module_cmp,
         l4cgen_module_fini_item);
+    if (array_init(&modorder, sizeof(l4cgen_module_t *), 0,
+            NULL,
+            NULL) != 0) {
+        FAIL("array_init");
+    }
+    if (array_init(&contexts, sizeof(l4cgen_context_t), 0,
+            l4cgen_context_init,
+            l4cgen_context_fini) != 0) {
+        FAIL("array_init");
+    }
 
     render_head(fhout, fcout, hout, lib);
+    if (fxout != NULL) {
+        render_xhead(fxout, xout, hout, lib);
+    }
     for (i = 0; i < argc; ++i) {
         if (verbose > 2) {
             printf("argv[%i]=%s\n", i, argv[i]);
         }
         process_logdef(argv[i]);
     }
-    render_body(fhout, fcout, lib);
+    render_body(fhout, fcout, fxout, lib);
+    render_contexts(fhout);
     render_tail(fhout, fcout, lib);
+    if (fxout != NULL) {
+        render_xtail(fxout, lib);
+        fclose(fxout);
+    }
+    (void)array_fini(&contexts);
+    (void)array_fini(&modorder);
     hash_fini(&modules);
     fclose(fhout);
     fclose(fcout);
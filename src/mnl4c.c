@@ -1,13 +1,29 @@
+#include <errno.h>
+#include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <fnmatch.h>
 #include <libgen.h> //basename
 #include <limits.h> //PATH_MAX
+#include <sched.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
 
 #include <mncommon/array.h>
 #include <mncommon/bytestream.h>
@@ -24,8 +40,102 @@
 
 #define MNL4C_DEFAULT_BUFSZ 4096
 
+#if defined(__x86_64__) || defined(__i386__)
+#   define MNL4C_CYCLES() __rdtsc()
+#else
+#   define MNL4C_CYCLES() mono_ns()
+#endif
+
+/*
+ * MNL4C_OPEN_DIRECT: shadows are written with pwrite(2) from a staging
+ * buffer of whole blocks, the partial tail block is written padded and
+ * the file truncated back to its real size.
+ */
+#define MNL4C_DIRECT_BLKSZ 4096
+#define MNL4C_DIRECT_BUFSZ (64 * 1024)
+#ifdef O_DIRECT
+#define MNL4C_FWRITER_DIRECT_OPEN_FLAGS (O_RDWR | O_CREAT | O_DIRECT)
+#else
+#define MNL4C_FWRITER_DIRECT_OPEN_FLAGS (O_RDWR | O_CREAT)
+#endif
+
 static mnarray_t ctxes;
 
+/* bumped by the recorder signal handler */
+static volatile sig_atomic_t rec_sigcount = 0;
+
+
+#define MNL4C_RECORDER_MAGIC 0x3163346c6e6d6572ull
+typedef struct _mnl4c_recorder_hdr {
+    uint64_t magic;
+    /* size of data[] */
+    uint64_t sz;
+    /* monotonic offsets, data[] is indexed modulo sz */
+    uint64_t head;
+    uint64_t tail;
+    char data[];
+} mnl4c_recorder_hdr_t;
+
+typedef struct _mnl4c_recorder_entry {
+    double ts;
+    /* -1 for padding up to the end of data[] */
+    int32_t id;
+    int16_t level;
+    uint16_t len;
+} mnl4c_recorder_entry_t;
+
+#define REC_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+/*
+ * Shared-memory ring used by prefork workers logging into one file.
+ * Producers reserve space by CAS on whead and commit each chunk on its
+ * own, the drainer consumes committed chunks in order from tail.  The
+ * rotation state lives here as well, so that only the drainer rotates.
+ * A chunk left reserved by a producer that died is turned into padding
+ * by the drainer, see shmring_abandoned().
+ */
+typedef struct _mnl4c_shmring_hdr {
+    /* size of data[] */
+    uint64_t sz;
+    /* monotonic offsets, data[] is indexed modulo sz */
+    uint64_t whead;
+    uint64_t tail;
+    /* consumed chunks are zeroed up to here, producers reserve from it */
+    uint64_t ztail;
+    uint64_t ndropped;
+    /* rotation generation and the state of the current shadow */
+    uint64_t gen;
+    uint64_t cursz;
+    double starttm;
+    /* pid of the process currently draining, 0 if none */
+    pid_t drainer;
+    uint32_t spare;
+    char data[];
+} mnl4c_shmring_hdr_t;
+
+/*
+ * A chunk is 0 until the producer that reserved space for it marks it
+ * SHMRING_RESERVED along with its pid, then SHMRING_COMMITTED.  Padding
+ * is skipped by the drainer.
+ */
+#define SHMRING_COMMITTED 1
+#define SHMRING_PAD 2
+#define SHMRING_RESERVED 3
+#define SHMRING_STATE_MASK 3
+#define SHMRING_PID_SHIFT 2
+typedef struct _mnl4c_shmring_chunk {
+    uint32_t len;
+    uint32_t state;
+} mnl4c_shmring_chunk_t;
+
+/*
+ * A producer facing a full ring drops its chunk once the drainer has
+ * made no progress for SHMRING_MAXWAIT seconds.
+ */
+#define SHMRING_MAXSPIN 1024
+#define SHMRING_MAXWAIT 1.0
+#define SHMRING_IOVMAX 64
+
 double
 mnl4c_now_posix(void){
     struct timeval tv;
@@ -36,20 +146,20 @@ mnl4c_now_posix(void){
 
 
 static void
-mnl4c_write_stdout(mnl4c_ctx_t *ctx)
+mnl4c_write_stdout(UNUSED mnl4c_ctx_t *ctx, mnbytestream_t *bs)
 {
-    (void)bytestream_cat(&ctx->bs, 1, "");
-    fprintf(stdout, "%s", SDATA(&ctx->bs, 0));
-    bytestream_rewind(&ctx->bs);
+    (void)bytestream_cat(bs, 1, "");
+    fprintf(stdout, "%s", SDATA(bs, 0));
+    bytestream_rewind(bs);
 }
 
 
 static void
-mnl4c_write_stderr(mnl4c_ctx_t *ctx)
+mnl4c_write_stderr(UNUSED mnl4c_ctx_t *ctx, mnbytestream_t *bs)
 {
-    (void)bytestream_cat(&ctx->bs, 1, "");
-    fprintf(stderr, "%s", SDATA(&ctx->bs, 0));
-    bytestream_rewind(&ctx->bs);
+    (void)bytestream_cat(bs, 1, "");
+    fprintf(stderr, "%s", SDATA(bs, 0));
+    bytestream_rewind(bs);
 }
 
 
@@ -64,9 +174,26 @@ writer_init(mnl4c_writer_t *writer)
     writer->data.file.maxtm = 0.0;
     writer->data.file.starttm = 0.0;
     writer->data.file.curtm = 0.0;
+    writer->data.file.wcurtm = 0.0;
     writer->data.file.maxfiles = 0;
     writer->data.file.fd = -1;
     writer->data.file.flags = 0;
+    writer->data.file.nrollovers = 0;
+    writer->data.file.shm = NULL;
+    writer->data.file.shmsz = 0;
+    writer->data.file.shmgen = 0;
+    writer->data.file.shmstuck = UINT64_MAX;
+    writer->data.file.shmstuck_tm = 0.0;
+    writer->data.file.dbuf = NULL;
+    writer->data.file.dbufsz = 0;
+    writer->data.file.dlen = 0;
+    writer->data.file.doff = 0;
+    writer->data.file.durability = MNL4C_DURABILITY_NONE;
+    writer->data.file.wgen = 0;
+    writer->data.file.synced = 0;
+    writer->data.file.lostfrom = 0;
+    writer->data.file.lostto = 0;
+    writer->data.file.nsync_errors = 0;
 }
 
 
@@ -234,16 +361,153 @@ writer_file_new_shadow(mnl4c_writer_t *writer)
 }
 
 
+static int
+direct_resume(mnl4c_writer_t *writer)
+{
+    struct stat sb;
+
+    if (fstat(writer->data.file.fd, &sb) != 0) {
+        return -1;
+    }
+    writer->data.file.doff =
+        sb.st_size & ~((off_t)MNL4C_DIRECT_BLKSZ - 1);
+    writer->data.file.dlen = sb.st_size - writer->data.file.doff;
+    /* pick up the partial tail block left by whoever wrote last */
+    if (writer->data.file.dlen > 0) {
+        if (pread(writer->data.file.fd,
+                  writer->data.file.dbuf,
+                  MNL4C_DIRECT_BLKSZ,
+                  writer->data.file.doff) <
+            (ssize_t)writer->data.file.dlen) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Stage buf, writing out the staging buffer whenever it fills up.  Under
+ * ctx->flush_mtx, like every use of the staging buffer.
+ */
+static int
+direct_append(mnl4c_writer_t *writer, const char *buf, size_t sz)
+{
+    while (sz > 0) {
+        size_t n;
+
+        n = writer->data.file.dbufsz - writer->data.file.dlen;
+        if (n > sz) {
+            n = sz;
+        }
+        memcpy(writer->data.file.dbuf + writer->data.file.dlen, buf, n);
+        writer->data.file.dlen += n;
+        buf += n;
+        sz -= n;
+
+        if (writer->data.file.dlen == writer->data.file.dbufsz) {
+            ssize_t nwritten;
+
+            nwritten = pwrite(writer->data.file.fd,
+                              writer->data.file.dbuf,
+                              writer->data.file.dbufsz,
+                              writer->data.file.doff);
+            writer->data.file.dlen = 0;
+            if (nwritten != (ssize_t)writer->data.file.dbufsz) {
+                return -1;
+            }
+            writer->data.file.doff += writer->data.file.dbufsz;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Write out the whole blocks staged, the partial tail block stays in the
+ * staging buffer until it fills up.
+ */
+static int
+direct_flush(mnl4c_writer_t *writer)
+{
+    size_t nfull;
+
+    nfull = writer->data.file.dlen & ~((size_t)MNL4C_DIRECT_BLKSZ - 1);
+    if (nfull == 0) {
+        return 0;
+    }
+    if (pwrite(writer->data.file.fd,
+               writer->data.file.dbuf,
+               nfull,
+               writer->data.file.doff) != (ssize_t)nfull) {
+        return -1;
+    }
+    memmove(writer->data.file.dbuf,
+            writer->data.file.dbuf + nfull,
+            writer->data.file.dlen - nfull);
+    writer->data.file.doff += nfull;
+    writer->data.file.dlen -= nfull;
+    return 0;
+}
+
+
+/*
+ * Write out the partial tail block too, padded, and truncate the file
+ * back to its real size.  For rotation and close, and for every flush of
+ * a durable logger.  The tail block stays staged.
+ */
+static int
+direct_finish(mnl4c_writer_t *writer)
+{
+    if (direct_flush(writer) != 0) {
+        return -1;
+    }
+    if (writer->data.file.dlen == 0) {
+        return 0;
+    }
+    memset(writer->data.file.dbuf + writer->data.file.dlen,
+           '\0',
+           MNL4C_DIRECT_BLKSZ - writer->data.file.dlen);
+    if (pwrite(writer->data.file.fd,
+               writer->data.file.dbuf,
+               MNL4C_DIRECT_BLKSZ,
+               writer->data.file.doff) != (ssize_t)MNL4C_DIRECT_BLKSZ) {
+        return -1;
+    }
+    if (ftruncate(writer->data.file.fd,
+                  writer->data.file.doff + writer->data.file.dlen) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+
 static int _writer_file_open(mnl4c_writer_t *writer)
 {
     int oflags;
 
-    oflags = MNL4C_FWRITER_DEFAULT_OPEN_FLAGS;
+    if (writer->data.file.flags & MNL4C_OPEN_DIRECT) {
+        oflags = MNL4C_FWRITER_DIRECT_OPEN_FLAGS;
+    } else {
+        oflags = MNL4C_FWRITER_DEFAULT_OPEN_FLAGS;
+    }
     if ((writer->data.file.fd =
                 open(BCDATA(writer->data.file.path),
                      oflags,
                      MNL4C_FWRITER_DEFAULT_OPEN_MODE)) < 0) {
+#ifdef O_DIRECT
+        /* file systems like tmpfs don't do O_DIRECT */
+        if (errno == EINVAL && (oflags & O_DIRECT)) {
+            writer->data.file.fd = open(BCDATA(writer->data.file.path),
+                                        oflags & ~O_DIRECT,
+                                        MNL4C_FWRITER_DEFAULT_OPEN_MODE);
+        }
+        if (writer->data.file.fd < 0) {
+            TRRET(_WRITER_FILE_OPEN + 1);
+        }
+#else
         TRRET(_WRITER_FILE_OPEN + 1);
+#endif
     }
     if (writer->data.file.flags & MNL4C_OPEN_FLOCK) {
         if (flock(writer->data.file.fd, LOCK_EX|LOCK_NB) == -1) {
@@ -252,9 +516,36 @@ static int _writer_file_open(mnl4c_writer_t *writer)
             TRRET(_WRITER_FILE_OPEN + 2);
         }
     }
+    if (writer->data.file.flags & MNL4C_OPEN_DIRECT) {
+        if (direct_resume(writer) != 0) {
+            close(writer->data.file.fd);
+            writer->data.file.fd = -1;
+            TRRET(_WRITER_FILE_OPEN + 3);
+        }
+    }
     return 0;
 }
 
+/*
+ * Make the new shadow and the symlink to it durable.
+ */
+static void
+writer_file_sync_dir(mnl4c_writer_t *writer)
+{
+    char buf[PATH_MAX];
+    int fd;
+
+    if (strlen(BCDATA(writer->data.file.path)) >= sizeof(buf)) {
+        return;
+    }
+    strcpy(buf, BCDATA(writer->data.file.path));
+    if ((fd = open(dirname(buf), O_RDONLY)) >= 0) {
+        (void)fsync(fd);
+        (void)close(fd);
+    }
+}
+
+
 static int
 writer_file_check_rollover(mnl4c_writer_t *writer)
 {
@@ -269,12 +560,37 @@ writer_file_check_rollover(mnl4c_writer_t *writer)
 
     res = 0;
     if (((writer->data.file.maxtm > 0.0) &&
-         (writer->data.file.curtm - writer->data.file.starttm) >
+         (writer->data.file.wcurtm - writer->data.file.starttm) >
         writer->data.file.maxtm) ||
         ((writer->data.file.maxsz > 0) &&
          (writer->data.file.cursz > writer->data.file.maxsz))) {
 
         if (writer->data.file.fd >= 0) {
+            if (writer->data.file.dbuf != NULL &&
+                direct_finish(writer) != 0) {
+                TRACE("failed to write the tail block");
+            }
+            /*
+             * Whatever went to the old file is made durable before it is
+             * let go of, a sync in progress works on its own descriptor.
+             * If that fails, the generations since the last good sync
+             * can no longer be synced by anyone, a sync of the new file
+             * must not cover them.
+             */
+            if (writer->data.file.durability != MNL4C_DURABILITY_NONE) {
+                if (fdatasync(writer->data.file.fd) == 0) {
+                    writer->data.file.synced = writer->data.file.wgen;
+                } else {
+                    TRACE("failed to sync before rollover");
+                    ++writer->data.file.nsync_errors;
+                    if (writer->data.file.lostto <=
+                        writer->data.file.synced) {
+                        writer->data.file.lostfrom =
+                            writer->data.file.synced;
+                    }
+                    writer->data.file.lostto = writer->data.file.wgen;
+                }
+            }
             close(writer->data.file.fd);
             writer->data.file.fd = -1;
             if (unlink(BCDATA(writer->data.file.path)) != 0) {
@@ -284,6 +600,10 @@ writer_file_check_rollover(mnl4c_writer_t *writer)
             if (writer_file_new_shadow(writer) != 0) {
                 TRRET(WRITER_FILE_OPEN + 3);
             }
+            if (writer->data.file.durability != MNL4C_DURABILITY_NONE) {
+                writer_file_sync_dir(writer);
+            }
+            ++writer->data.file.nrollovers;
         }
     }
 
@@ -371,7 +691,7 @@ writer_file_open(mnl4c_writer_t *writer)
 
 
 static void
-mnl4c_write_file(mnl4c_ctx_t *ctx)
+mnl4c_write_file(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
 {
     ssize_t nwritten;
 
@@ -383,15 +703,16 @@ mnl4c_write_file(mnl4c_ctx_t *ctx)
     //assert(ctx->writer.data.file.fd >= 0);
     if (MNUNLIKELY(
         (nwritten = write(ctx->writer.data.file.fd,
-                          SDATA(&ctx->bs, 0),
-                          SEOD(&ctx->bs))) <= 0)) {
+                          SDATA(bs, 0),
+                          SEOD(bs))) <= 0)) {
         TRACE("write failed");
+        ++ctx->stats.nwrite_errors;
 
     } else {
         ctx->writer.data.file.cursz += nwritten;
     }
 
-    bytestream_rewind(&ctx->bs);
+    bytestream_rewind(bs);
 
     if (writer_file_check_rollover(&ctx->writer) != 0) {
         TRACE("failed to roll over");
@@ -400,177 +721,4555 @@ mnl4c_write_file(mnl4c_ctx_t *ctx)
 
 
 static void
-cache_init(mnl4c_cache_t *cache)
+mnl4c_write_direct(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
 {
-    cache->pid = getpid();
-}
+    mnl4c_writer_t *writer;
+
+    writer = &ctx->writer;
+    /* a durable logger can only sync what is in the file */
+    if (MNUNLIKELY(direct_append(writer,
+                                 SDATA(bs, 0),
+                                 SEOD(bs)) != 0 ||
+                   (writer->data.file.durability == MNL4C_DURABILITY_NONE ?
+                        direct_flush(writer) :
+                        direct_finish(writer)) != 0)) {
+        TRACE("write failed");
+        ++ctx->stats.nwrite_errors;
+    }
+    writer->data.file.cursz = writer->data.file.doff + writer->data.file.dlen;
 
+    bytestream_rewind(bs);
 
-static void
-writer_fini(mnl4c_writer_t *writer)
-{
-    BYTES_DECREF(&writer->data.file.path);
-    BYTES_DECREF(&writer->data.file.shadow_path);
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
+    }
 }
 
 
-static int
-minfo_init(void *o)
+static mnl4c_shmring_chunk_t *
+shmring_chunk(mnl4c_shmring_hdr_t *hdr, uint64_t p)
 {
-    mnl4c_minfo_t *minfo = o;
-    minfo->name = NULL;
-    minfo->throttle_threshold = -1.0l;
-    minfo->nthrottled = 0;
-    return 0;
+    return (mnl4c_shmring_chunk_t *)(hdr->data + (p % hdr->sz));
 }
 
 
-static int
-minfo_fini(void *o)
+/*
+ * Whether the chunk at p was left behind by a producer that died, in
+ * which case it is turned into padding.  The producer is taken for dead
+ * when its pid is gone, or when the chunk is still not even marked
+ * reserved SHMRING_MAXWAIT after the drainer first found it; a producer
+ * that gets there later finds the chunk taken and drops its record.  A
+ * chunk of unknown length ends where the next marked one starts, nothing
+ * was written past its header; the unmarked headers in between are taken
+ * the same way.  The caller is the elected drainer.
+ */
+static bool
+shmring_abandoned(mnl4c_writer_t *writer,
+                  mnl4c_shmring_hdr_t *hdr,
+                  uint64_t p,
+                  uint32_t state,
+                  uint64_t whead)
 {
-    mnl4c_minfo_t *minfo = o;
-    BYTES_DECREF(&minfo->name);
-    return 0;
+    mnl4c_shmring_chunk_t *chunk;
+    uint32_t len;
+
+    chunk = shmring_chunk(hdr, p);
+    if ((state & SHMRING_STATE_MASK) == SHMRING_RESERVED) {
+        if (kill((pid_t)(state >> SHMRING_PID_SHIFT), 0) == 0 ||
+            errno != ESRCH) {
+            return false;
+        }
+        len = __atomic_load_n(&chunk->len, __ATOMIC_ACQUIRE);
+
+    } else {
+        double now;
+
+        now = mnl4c_now_posix();
+        if (writer->data.file.shmstuck != p) {
+            writer->data.file.shmstuck = p;
+            writer->data.file.shmstuck_tm = now;
+            return false;
+        }
+        if (now - writer->data.file.shmstuck_tm < SHMRING_MAXWAIT ||
+            !__atomic_compare_exchange_n(&chunk->state,
+                                         &state,
+                                         SHMRING_PAD,
+                                         false,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_RELAXED)) {
+            return false;
+        }
+        len = 0;
+    }
+
+    if (len == 0) {
+        uint64_t q, lim;
+
+        lim = p + (hdr->sz - p % hdr->sz);
+        if (lim > whead) {
+            lim = whead;
+        }
+        for (q = p + sizeof(mnl4c_shmring_chunk_t);
+             q < lim;
+             q += sizeof(mnl4c_shmring_chunk_t)) {
+            uint32_t zero;
+
+            /*
+             * Each header we pass over is taken, a live producer that
+             * has reserved it but not marked it yet drops its record
+             * instead of writing inside our padding later.
+             */
+            zero = 0;
+            if (!__atomic_compare_exchange_n(&shmring_chunk(hdr, q)->state,
+                                             &zero,
+                                             SHMRING_PAD,
+                                             false,
+                                             __ATOMIC_ACQ_REL,
+                                             __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+        len = q - p - sizeof(mnl4c_shmring_chunk_t);
+    }
+    __atomic_store_n(&chunk->len, len, __ATOMIC_RELAXED);
+    __atomic_store_n(&chunk->state, SHMRING_PAD, __ATOMIC_RELEASE);
+    writer->data.file.shmstuck = UINT64_MAX;
+    TRACE("dropped an abandoned chunk at %ld", (long)p);
+    return true;
 }
 
 
-static mnl4c_ctx_t *
-mnl4c_ctx_new(ssize_t bsbufsz)
+/*
+ * Zero the consumed chunks up to tail, so that stale bytes are never
+ * taken for a chunk header on the next lap.  Only then producers may
+ * reserve the space again: a drainer dying halfway leaves the rest to
+ * the next one.  The caller is the elected drainer.
+ */
+static void
+shmring_zero(mnl4c_shmring_hdr_t *hdr)
 {
-    mnl4c_ctx_t *res;
+    uint64_t zt, t, off;
 
-    if ((res = malloc(sizeof(mnl4c_ctx_t))) == NULL) {
-        FAIL("malloc");
+    zt = __atomic_load_n(&hdr->ztail, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+    if (zt == t) {
+        return;
     }
-    res->nref = 0;
-    res->bsbufsz = bsbufsz;
-    bytestream_init(&res->bs, bsbufsz);
-    writer_init(&res->writer);
-    cache_init(&res->cache);
-    array_init(&res->minfos,
-               sizeof(mnl4c_minfo_t),
-               0,
-               minfo_init,
-               minfo_fini);
-    res->ty = 0;
-    if (MNUNLIKELY(pthread_mutex_init(&res->mtx, NULL) != 0)) {
-        FFAIL("pthread_mutex_init");
+    off = zt % hdr->sz;
+    if (off + (t - zt) > hdr->sz) {
+        memset(hdr->data + off, '\0', hdr->sz - off);
+        memset(hdr->data, '\0', (t - zt) - (hdr->sz - off));
+    } else {
+        memset(hdr->data + off, '\0', t - zt);
     }
-    return res;
+    __atomic_store_n(&hdr->ztail, t, __ATOMIC_RELEASE);
 }
 
 
+/*
+ * Write out committed chunks, the caller is the elected drainer.
+ */
 static void
-mnl4c_ctx_destroy(mnl4c_ctx_t **pctx)
+shmring_drain_chunks(mnl4c_ctx_t *ctx)
 {
-    if (*pctx != NULL) {
-        (void)pthread_mutex_destroy(&(*pctx)->mtx);
-        bytestream_fini(&(*pctx)->bs);
-        writer_fini(&(*pctx)->writer);
-        array_fini(&(*pctx)->minfos);
-        free(*pctx);
-        *pctx = NULL;
+    mnl4c_writer_t *writer;
+    mnl4c_shmring_hdr_t *hdr;
+    uint64_t t;
+    uint64_t nrollovers;
+
+    writer = &ctx->writer;
+    hdr = writer->data.file.shm;
+
+    /* another drainer has rotated since we last wrote */
+    if (writer->data.file.shmgen !=
+        __atomic_load_n(&hdr->gen, __ATOMIC_ACQUIRE)) {
+        if (writer->data.file.fd >= 0) {
+            (void)close(writer->data.file.fd);
+            writer->data.file.fd = -1;
+        }
+        if (_writer_file_open(writer) != 0) {
+            TRACE("failed to reopen %s", BDATA(writer->data.file.path));
+            return;
+        }
+        writer->data.file.shmgen = hdr->gen;
     }
-}
+    writer->data.file.cursz = hdr->cursz;
+    writer->data.file.starttm = hdr->starttm;
+    nrollovers = writer->data.file.nrollovers;
+
+    shmring_zero(hdr);
+    t = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+    while (true) {
+        struct iovec iov[SHMRING_IOVMAX];
+        int niov;
+        uint64_t end;
+        uint64_t whead;
+        ssize_t nwritten;
+
+        niov = 0;
+        end = t;
+        /* on a full ring the chunk at whead is the one at t */
+        whead = __atomic_load_n(&hdr->whead, __ATOMIC_ACQUIRE);
+        while (niov < SHMRING_IOVMAX && end < whead) {
+            mnl4c_shmring_chunk_t *chunk;
+            uint32_t state;
+
+            chunk = shmring_chunk(hdr, end);
+            state = __atomic_load_n(&chunk->state, __ATOMIC_ACQUIRE);
+            if (state == SHMRING_COMMITTED) {
+                iov[niov].iov_base = chunk + 1;
+                iov[niov].iov_len = chunk->len;
+                ++niov;
+            } else if (state != SHMRING_PAD &&
+                       !shmring_abandoned(writer, hdr, end, state, whead)) {
+                break;
+            }
+            end += REC_ALIGN(sizeof(mnl4c_shmring_chunk_t) + chunk->len);
+        }
 
+        if (end == t) {
+            break;
+        }
 
-bool
-mnl4c_ctx_allowed(mnl4c_ctx_t *ctx, int level, int id)
-{
-    mnl4c_minfo_t *minfo;
+        if (niov > 0 && writer->data.file.fd >= 0) {
+            if (MNUNLIKELY(
+                (nwritten = writev(writer->data.file.fd, iov, niov)) <= 0)) {
+                TRACE("writev failed");
+                ++ctx->stats.nwrite_errors;
+            } else {
+                writer->data.file.cursz += nwritten;
+            }
+        }
 
-    assert(id >= 0 && id < MNL4C_MAX_MINFOS);
-    if ((minfo = array_get(&ctx->minfos, id)) == NULL) {
-        FAIL("array_get");
+        __atomic_store_n(&hdr->tail, end, __ATOMIC_RELEASE);
+        shmring_zero(hdr);
+        t = end;
+
+        writer->data.file.wcurtm = mnl4c_now_posix();
+        if (writer_file_check_rollover(writer) != 0) {
+            TRACE("failed to roll over");
+        }
     }
-    assert(minfo->id == id);
-    assert(level >= 0 && (size_t)level < countof(level_names));
-    return minfo->elevel >= level;
+
+    if (writer->data.file.nrollovers != nrollovers) {
+        writer->data.file.shmgen =
+            __atomic_add_fetch(&hdr->gen, 1, __ATOMIC_RELEASE);
+    }
+    hdr->cursz = writer->data.file.cursz;
+    hdr->starttm = writer->data.file.starttm;
 }
 
 
-int
-mnl4c_set_bufsz(mnl4c_logger_t ld, ssize_t sz)
+/*
+ * Become the drainer unless some other live process is draining.
+ * Returns 0 if drained.
+ */
+static int
+shmring_drain(mnl4c_ctx_t *ctx)
 {
-    mnl4c_ctx_t **pctx;
+    mnl4c_shmring_hdr_t *hdr;
+    pid_t self;
+    pid_t drainer;
+
+    hdr = ctx->writer.data.file.shm;
+    self = getpid();
+    drainer = 0;
+    if (!__atomic_compare_exchange_n(&hdr->drainer,
+                                     &drainer,
+                                     self,
+                                     false,
+                                     __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+        /* a drainer that died holding the role */
+        if (drainer == self ||
+            kill(drainer, 0) == 0 ||
+            errno != ESRCH ||
+            !__atomic_compare_exchange_n(&hdr->drainer,
+                                         &drainer,
+                                         self,
+                                         false,
+                                         __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED)) {
+            return -1;
+        }
+    }
 
-    if ((pctx = array_get(&ctxes, ld)) == NULL) {
-        return -1;
+    while (true) {
+        uint32_t state;
+
+        shmring_drain_chunks(ctx);
+        __atomic_store_n(&hdr->drainer, 0, __ATOMIC_RELEASE);
+
+        /* pick up chunks committed after the last look */
+        state = __atomic_load_n(
+            &shmring_chunk(hdr, __atomic_load_n(&hdr->tail,
+                                                __ATOMIC_ACQUIRE))->state,
+            __ATOMIC_ACQUIRE);
+        drainer = 0;
+        if ((state != SHMRING_COMMITTED && state != SHMRING_PAD) ||
+            !__atomic_compare_exchange_n(&hdr->drainer,
+                                         &drainer,
+                                         self,
+                                         false,
+                                         __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED)) {
+            break;
+        }
     }
-    bytestream_fini(&(*pctx)->bs);
-    bytestream_init(&(*pctx)->bs, sz);
-    (*pctx)->bsbufsz = sz;
     return 0;
 }
 
 
-void
-mnl4c_register_msg(mnl4c_logger_t ld, int level, int id, const char *name)
+/*
+ * Drain until everything already in the ring is written out.  A chunk
+ * that its producer died before marking holds up the ones behind it
+ * until SHMRING_MAXWAIT has passed, and a closing logger may be the
+ * last process to drain, so it waits that long at most, plus a margin.
+ */
+static void
+shmring_drain_all(mnl4c_ctx_t *ctx)
 {
-    mnl4c_ctx_t **pctx;
-    mnl4c_minfo_t *minfo;
-
-    if ((pctx = array_get(&ctxes, ld)) == NULL) {
-        FAIL("array_get");
-    }
-    assert(id >= 0 && id < MNL4C_MAX_MINFOS);
-    if ((minfo = array_get_safe(&(*pctx)->minfos, id)) == NULL) {
-        FAIL("array_get_safe");
+    mnl4c_shmring_hdr_t *hdr;
+    uint64_t whead;
+    double deadline;
+
+    hdr = ctx->writer.data.file.shm;
+    whead = __atomic_load_n(&hdr->whead, __ATOMIC_ACQUIRE);
+    deadline = mnl4c_now_posix() + 2.0 * SHMRING_MAXWAIT;
+    while (true) {
+        struct timespec ts = {0, 10000000};
+
+        (void)shmring_drain(ctx);
+        if (__atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) >= whead ||
+            mnl4c_now_posix() > deadline) {
+            break;
+        }
+        (void)nanosleep(&ts, NULL);
     }
-    (void)minfo_init(minfo);
-    minfo->id = id;
-    minfo->flevel = level;
-    minfo->elevel = level;
-    minfo->name = bytes_new_from_str(name);
-    BYTES_INCREF(minfo->name);
 }
 
 
-int
-mnl4c_set_level(mnl4c_logger_t ld, int level, const mnbytes_t *prefix)
+static int
+shmring_push(mnl4c_ctx_t *ctx, const char *buf, size_t len)
 {
-    mnl4c_ctx_t **pctx;
-    mnl4c_minfo_t *minfo;
-    mnarray_iter_t it;
-    int res;
-
-    if ((pctx = array_get(&ctxes, ld)) == NULL) {
-        FAIL("array_get");
-    }
-
-    res = 0;
-    if (prefix == NULL) {
-        for (minfo = array_first(&(*pctx)->minfos, &it);
-             minfo != NULL;
-             minfo = array_next(&(*pctx)->minfos, &it)) {
-            minfo->elevel = level;
-            ++res;
+    mnl4c_shmring_hdr_t *hdr;
+    mnl4c_shmring_chunk_t *chunk;
+    uint64_t w;
+    uint64_t lastt;
+    uint64_t off;
+    size_t need;
+    size_t total;
+    double deadline;
+    uint32_t state;
+    uint32_t expected;
+    int i;
+
+    hdr = ctx->writer.data.file.shm;
+    need = REC_ALIGN(sizeof(mnl4c_shmring_chunk_t) + len);
+    lastt = 0;
+    deadline = 0.0;
+
+    for (i = 0; ; ++i) {
+        uint64_t t;
+
+        w = __atomic_load_n(&hdr->whead, __ATOMIC_RELAXED);
+        t = __atomic_load_n(&hdr->ztail, __ATOMIC_ACQUIRE);
+        off = w % hdr->sz;
+        total = need;
+        /* chunks never wrap, pad up to the end of data[] */
+        if (hdr->sz - off < need) {
+            total += hdr->sz - off;
         }
-    } else {
-        for (minfo = array_first(&(*pctx)->minfos, &it);
-             minfo != NULL;
-             minfo = array_next(&(*pctx)->minfos, &it)) {
-            if (bytes_startswith(minfo->name, prefix)) {
-                minfo->elevel = level;
-                ++res;
+        if (w + total - t > hdr->sz) {
+            if (t != lastt) {
+                lastt = t;
+                deadline = 0.0;
+                i = 0;
+            } else if (i % SHMRING_MAXSPIN == SHMRING_MAXSPIN - 1) {
+                double now;
+
+                now = mnl4c_now_posix();
+                if (deadline == 0.0) {
+                    deadline = now + SHMRING_MAXWAIT;
+                } else if (now > deadline) {
+                    (void)__atomic_add_fetch(&hdr->ndropped,
+                                             1,
+                                             __ATOMIC_RELAXED);
+                    return -1;
+                }
             }
+            if (shmring_drain(ctx) != 0) {
+                (void)sched_yield();
+            }
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&hdr->whead,
+                                        &w,
+                                        w + total,
+                                        false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            break;
         }
     }
-    return res;
+
+    /*
+     * Mark the chunks ours first, the drainer may have taken them for
+     * abandoned already, see shmring_abandoned().  It pads up to the end
+     * of data[] just like we would.
+     */
+    state = ((uint32_t)ctx->cache.pid << SHMRING_PID_SHIFT) |
+        SHMRING_RESERVED;
+    if (total != need) {
+        uint32_t expected;
+
+        chunk = (mnl4c_shmring_chunk_t *)(hdr->data + off);
+        expected = 0;
+        if (__atomic_compare_exchange_n(&chunk->state,
+                                        &expected,
+                                        state,
+                                        false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            __atomic_store_n(&chunk->len,
+                             hdr->sz - off - sizeof(mnl4c_shmring_chunk_t),
+                             __ATOMIC_RELAXED);
+            __atomic_store_n(&chunk->state, SHMRING_PAD, __ATOMIC_RELEASE);
+        }
+        off = 0;
+    }
+    chunk = (mnl4c_shmring_chunk_t *)(hdr->data + off);
+    expected = 0;
+    if (!__atomic_compare_exchange_n(&chunk->state,
+                                     &expected,
+                                     state,
+                                     false,
+                                     __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED)) {
+        (void)__atomic_add_fetch(&hdr->ndropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    /* a dead producer's len tells whether anything follows */
+    __atomic_store_n(&chunk->len, len, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(chunk + 1, buf, len);
+    __atomic_store_n(&chunk->state, SHMRING_COMMITTED, __ATOMIC_RELEASE);
+    return 0;
 }
 
 
-int
-mnl4c_set_throttling(mnl4c_logger_t ld, double threshold, const mnbytes_t *prefix)
+static void
+mnl4c_write_shmring(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
 {
-    mnl4c_ctx_t **pctx;
-    mnl4c_minfo_t *minfo;
-    mnarray_iter_t it;
-    int res;
+    mnl4c_shmring_hdr_t *hdr;
+    const char *buf;
+    size_t sz;
+    size_t maxchunk;
 
-    if ((pctx = array_get(&ctxes, ld)) == NULL) {
-        FAIL("array_get");
-    }
+    hdr = ctx->writer.data.file.shm;
+    buf = SDATA(bs, 0);
+    sz = SEOD(bs);
+    maxchunk = hdr->sz / 4;
+
+    /*
+     * Large buffers go in several chunks, cut at record boundaries
+     * whenever possible so that records of different processes don't
+     * interleave.
+     */
+    while (sz > 0) {
+        size_t len;
+
+        len = sz;
+        if (len > maxchunk) {
+            const char *nl;
+
+            len = maxchunk;
+            for (nl = buf + len - 1; nl > buf && *nl != '\n'; --nl) {
+                ;
+            }
+            if (nl > buf) {
+                len = nl - buf + 1;
+            }
+        }
+        if (MNUNLIKELY(shmring_push(ctx, buf, len) != 0)) {
+            TRACE("shmring full, dropped %zd bytes", len);
+        }
+        buf += len;
+        sz -= len;
+    }
+
+    bytestream_rewind(bs);
+    (void)shmring_drain(ctx);
+}
+
+
+static uint64_t
+mono_ns(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void
+stats_hist(uint64_t *hist, uint64_t v)
+{
+    int i;
+
+    i = v == 0 ? 0 : 64 - __builtin_clzll(v);
+    if (i >= MNL4C_STATS_NBUCKETS) {
+        i = MNL4C_STATS_NBUCKETS - 1;
+    }
+    ++hist[i];
+}
+
+
+/*
+ * Hand the buffer over to the writer, under ctx->mtx which is held
+ * throughout.  For the paths that must not let other records in while
+ * they write: shutdown, the flight recorder dump, writer changes.
+ */
+static void
+ctx_flush(mnl4c_ctx_t *ctx)
+{
+    uint64_t before;
+
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    ctx->stats.nbytes += SEOD(&ctx->bs);
+    ctx->writer.data.file.wcurtm = ctx->writer.data.file.curtm;
+    before = mono_ns();
+    /* counted first, a rollover in the write belongs to it */
+    ++ctx->writer.data.file.wgen;
+    ctx->writer.write(ctx, &ctx->bs);
+    stats_hist(ctx->stats.flush_ns, mono_ns() - before);
+    ++ctx->stats.nflushes;
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+}
+
+
+/*
+ * Swap the buffer with the spare one and write it out with ctx->mtx
+ * released, so that other threads keep filling the new buffer meanwhile.
+ * flush_mtx is taken before ctx->mtx is let go, which keeps the writes
+ * in the order of the swaps; a thread finding a write in flight waits
+ * for it, as it has nowhere else to put the full buffer.  The writer
+ * works with its own copy of curtm, producers keep updating the one in
+ * ctx->writer.  Called under ctx->mtx, which is released before the
+ * write and taken again after it.
+ */
+static void
+ctx_flush_unlocked(mnl4c_ctx_t *ctx, int prof_id, uint64_t prof_start)
+{
+    mnbytestream_t tmp;
+    mnl4c_minfo_t *minfo;
+    uint64_t before, elapsed;
+
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    /* the spare one was rewound by the previous write */
+    tmp = ctx->wbs;
+    ctx->wbs = ctx->bs;
+    ctx->bs = tmp;
+    ctx->stats.nbytes += SEOD(&ctx->wbs);
+    ++ctx->stats.nflushes;
+    ctx->writer.data.file.wcurtm = ctx->writer.data.file.curtm;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    before = mono_ns();
+    ++ctx->writer.data.file.wgen;
+    ctx->writer.write(ctx, &ctx->wbs);
+    elapsed = mono_ns() - before;
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+
+    mnl4c_ctx_lock(ctx);
+    stats_hist(ctx->stats.flush_ns, elapsed);
+    /* minfos may have moved meanwhile */
+    if (prof_id >= 0 &&
+        (minfo = array_get(&ctx->minfos, prof_id)) != NULL) {
+        minfo->write_cycles += MNL4C_CYCLES() - prof_start;
+    }
+}
+
+
+/*
+ * Wait until everything handed to the file so far is on stable storage.
+ * Called under ctx->mtx, which is released for the duration of
+ * fdatasync().  One caller syncs at a time, the others wait for it and
+ * are covered by it if it started late enough; a caller that is not
+ * covered leads the next sync.  The sync runs on a dup of the descriptor,
+ * so that a rollover in the meantime does not pull it away.
+ */
+static void
+ctx_sync(mnl4c_ctx_t *ctx)
+{
+    mnl4c_writer_t *writer;
+    uint64_t target;
+
+    writer = &ctx->writer;
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    target = writer->data.file.wgen;
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    while (true) {
+        uint64_t upto;
+        int fd, res;
+
+        (void)pthread_mutex_lock(&ctx->flush_mtx);
+        if (target > writer->data.file.lostfrom &&
+            target <= writer->data.file.lostto) {
+            /* counted at rollover */
+            (void)pthread_mutex_unlock(&ctx->flush_mtx);
+            return;
+        }
+        if (writer->data.file.synced >= target) {
+            (void)pthread_mutex_unlock(&ctx->flush_mtx);
+            break;
+        }
+        if (ctx->sync_busy) {
+            (void)pthread_mutex_unlock(&ctx->flush_mtx);
+            ++ctx->stats.nsync_waits;
+            (void)pthread_cond_wait(&ctx->sync_cond, &ctx->mtx);
+            continue;
+        }
+
+        upto = writer->data.file.wgen;
+        if (writer->data.file.fd < 0 ||
+            (fd = dup(writer->data.file.fd)) < 0) {
+            ++ctx->stats.nwrite_errors;
+            (void)pthread_mutex_unlock(&ctx->flush_mtx);
+            return;
+        }
+        (void)pthread_mutex_unlock(&ctx->flush_mtx);
+        ctx->sync_busy = true;
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        res = fdatasync(fd);
+        (void)close(fd);
+        mnl4c_ctx_lock(ctx);
+        ctx->sync_busy = false;
+        (void)pthread_cond_broadcast(&ctx->sync_cond);
+        ++ctx->stats.nsyncs;
+        (void)pthread_mutex_lock(&ctx->flush_mtx);
+        if (res != 0) {
+            ++ctx->stats.nwrite_errors;
+            (void)pthread_mutex_unlock(&ctx->flush_mtx);
+            return;
+        }
+        if (upto > writer->data.file.synced) {
+            writer->data.file.synced = upto;
+        }
+        (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    }
+}
+
+
+/*
+ * Write out the sinks that records asked for in ctx_fanout(), each with
+ * ctx->mtx released and under its own lock only.  Called and returns
+ * under ctx->mtx.
+ */
+static void
+ctx_flush_sinks(mnl4c_ctx_t *ctx)
+{
+    while (true) {
+        mnl4c_sink_t *sink;
+        mnarray_iter_t it;
+        mnl4c_ctx_t *sctx;
+
+        /* start over every time, sinks may have changed meanwhile */
+        for (sink = array_first(&ctx->sinks, &it);
+             sink != NULL;
+             sink = array_next(&ctx->sinks, &it)) {
+            if (sink->pending) {
+                break;
+            }
+        }
+        if (sink == NULL) {
+            break;
+        }
+        sink->pending = false;
+        sctx = mnl4c_get_ctx(sink->ld);
+        (void)pthread_mutex_unlock(&ctx->mtx);
+
+        if (sctx != NULL) {
+            mnl4c_ctx_lock(sctx);
+            /* or it was written out meanwhile */
+            if (SEOD(&sctx->bs) > 0) {
+                assert(sctx->writer.write != NULL);
+                sctx->wpending |= MNL4C_WPENDING_FLUSH;
+            }
+            mnl4c_ctx_unlock(sctx);
+        }
+
+        mnl4c_ctx_lock(ctx);
+    }
+}
+
+
+/*
+ * Sanitization, see mnl4c_set_sanitize().  Control bytes, DEL and the
+ * backslash are escaped, bytes from 0x80 up are left alone so that UTF-8
+ * passes through.
+ */
+#define SANITIZE_MARKER " [truncated]"
+#define SANITIZE_DIRTY(c)                                                      \
+    ((unsigned char)(c) < 0x20 || (c) == 0x7f || (c) == '\\')                  \
+
+
+/*
+ * Offset of the first byte that needs escaping, or sz.
+ */
+static size_t
+sanitize_scan(const char *s, size_t sz)
+{
+    size_t i;
+
+    i = 0;
+#ifdef __SSE2__
+    {
+        const __m128i ctl = _mm_set1_epi8(0x1f);
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i bsl = _mm_set1_epi8('\\');
+
+        for (; i + 16 <= sz; i += 16) {
+            __m128i x, m;
+            unsigned mask;
+
+            x = _mm_loadu_si128((const __m128i *)(s + i));
+            /* unsigned x <= 0x1f */
+            m = _mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x);
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(x, del));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(x, bsl));
+            if ((mask = (unsigned)_mm_movemask_epi8(m)) != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+    for (; i < sz; ++i) {
+        if (SANITIZE_DIRTY(s[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+
+static char *
+sanitize_escape(char *dst, unsigned char c)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    /* right to left */
+    switch (c) {
+    case '\n':
+        *--dst = 'n';
+        break;
+    case '\r':
+        *--dst = 'r';
+        break;
+    case '\t':
+        *--dst = 't';
+        break;
+    case '\\':
+        *--dst = '\\';
+        break;
+    default:
+        *--dst = hex[c & 0xf];
+        *--dst = hex[c >> 4];
+        *--dst = 'x';
+    }
+    *--dst = '\\';
+    return dst;
+}
+
+
+/*
+ * Escape and cap the body of the record at [start, SEOD(&ctx->bs)) in
+ * place.  The body follows the prefix's tab and precedes the final
+ * newline.  The cap applies to the escaped body and never splits an
+ * escape.  Escaping shifts the bytes that follow the first dirty one,
+ * once, right to left.
+ */
+static void
+ctx_sanitize(mnl4c_ctx_t *ctx, off_t start)
+{
+    char *data, *p;
+    off_t eod, body;
+    size_t sz, i, j, extra, nmarker;
+    bool nl;
+
+    data = SDATA(&ctx->bs, 0);
+    eod = SEOD(&ctx->bs);
+    nl = eod > start && data[eod - 1] == '\n';
+    if ((p = memchr(data + start, '\t', eod - nl - start)) == NULL) {
+        return;
+    }
+    body = p + 1 - data;
+    sz = eod - nl - body;
+
+    /* the bytes ahead of i are clean */
+    i = sz;
+    if (ctx->sanitize_escape) {
+        i = sanitize_scan(data + body, sz);
+    }
+    nmarker = 0;
+    if (ctx->sanitize_maxlen > 0 && i > ctx->sanitize_maxlen) {
+        i = sz = ctx->sanitize_maxlen;
+        nmarker = sizeof(SANITIZE_MARKER) - 1;
+    }
+
+    extra = 0;
+    for (j = i; j < sz; ++j) {
+        unsigned char c = data[body + j];
+        size_t n;
+
+        n = 0;
+        if (SANITIZE_DIRTY(c)) {
+            n = (c == '\n' || c == '\r' || c == '\t' || c == '\\') ? 1 : 3;
+        }
+        if (ctx->sanitize_maxlen > 0 &&
+            j + extra + n + 1 > ctx->sanitize_maxlen) {
+            sz = j;
+            nmarker = sizeof(SANITIZE_MARKER) - 1;
+            break;
+        }
+        extra += n;
+    }
+
+    if (extra == 0 && nmarker == 0) {
+        return;
+    }
+
+    eod = body + sz + extra + nmarker + nl;
+    if ((size_t)eod > SSIZE(&ctx->bs)) {
+        if (bytestream_grow(&ctx->bs, eod - SEOD(&ctx->bs)) != 0) {
+            return;
+        }
+        data = SDATA(&ctx->bs, 0);
+    }
+
+    if (extra > 0) {
+        char *src, *dst;
+
+        src = data + body + sz;
+        dst = src + extra;
+        while (src > data + body + i) {
+            unsigned char c = *--src;
+
+            if (SANITIZE_DIRTY(c)) {
+                dst = sanitize_escape(dst, c);
+            } else {
+                *--dst = c;
+            }
+        }
+    }
+    p = data + body + sz + extra;
+    memcpy(p, SANITIZE_MARKER, nmarker);
+    p += nmarker;
+    if (nl) {
+        *p = '\n';
+    }
+    SEOD(&ctx->bs) = eod;
+}
+
+
+static void
+rec_init(mnl4c_recorder_t *rec)
+{
+    __atomic_store_n(&rec->rlevel, -1, __ATOMIC_RELAXED);
+    rec->trigger = LOG_ERR;
+    rec->hdr = NULL;
+    rec->mapsz = 0;
+    rec->fd = -1;
+    rec->sigcount = 0;
+}
+
+
+static void
+rec_fini(mnl4c_recorder_t *rec)
+{
+    if (rec->hdr != NULL) {
+        if (rec->fd >= 0) {
+            (void)munmap(rec->hdr, rec->mapsz);
+            (void)close(rec->fd);
+        } else {
+            free(rec->hdr);
+        }
+    }
+    rec_init(rec);
+}
+
+
+/*
+ * Whether the entry at p is one that rec_push() could have written, the
+ * ring may come from a file left by an earlier process.
+ */
+static bool
+rec_valid(mnl4c_recorder_hdr_t *hdr, uint64_t p)
+{
+    uint64_t off;
+    mnl4c_recorder_entry_t *e;
+
+    off = p % hdr->sz;
+    if (hdr->sz - off < sizeof(mnl4c_recorder_entry_t)) {
+        return true;
+    }
+    e = (mnl4c_recorder_entry_t *)(hdr->data + off);
+    if (e->id < 0) {
+        return e->id == -1;
+    }
+    return e->level >= 0 &&
+           (size_t)e->level < countof(level_names) &&
+           e->len < MNL4C_RECORDER_MAXMSG &&
+           REC_ALIGN(sizeof(mnl4c_recorder_entry_t) + e->len) <=
+                hdr->sz - off;
+}
+
+
+/*
+ * Return the monotonic offset of the entry following the one at p, which
+ * is valid.
+ */
+static uint64_t
+rec_next(mnl4c_recorder_hdr_t *hdr, uint64_t p)
+{
+    uint64_t off;
+    mnl4c_recorder_entry_t *e;
+
+    off = p % hdr->sz;
+    if (hdr->sz - off < sizeof(mnl4c_recorder_entry_t)) {
+        return p + (hdr->sz - off);
+    }
+    e = (mnl4c_recorder_entry_t *)(hdr->data + off);
+    if (e->id < 0) {
+        return p + (hdr->sz - off);
+    }
+    return p + REC_ALIGN(sizeof(mnl4c_recorder_entry_t) + e->len);
+}
+
+
+static void
+rec_reserve(mnl4c_recorder_hdr_t *hdr, size_t sz)
+{
+    while (hdr->head + sz - hdr->tail > hdr->sz) {
+        if (!rec_valid(hdr, hdr->tail)) {
+            /* drop the rest */
+            hdr->tail = hdr->head;
+            break;
+        }
+        hdr->tail = rec_next(hdr, hdr->tail);
+    }
+}
+
+
+static void
+rec_push(mnl4c_recorder_hdr_t *hdr,
+         double ts,
+         int level,
+         int id,
+         const char *msg,
+         size_t len)
+{
+    size_t need;
+    uint64_t off;
+    mnl4c_recorder_entry_t *e;
+
+    need = REC_ALIGN(sizeof(mnl4c_recorder_entry_t) + len);
+    if (need > hdr->sz) {
+        return;
+    }
+
+    off = hdr->head % hdr->sz;
+    if (hdr->sz - off < need) {
+        /* entries are never split, pad to the end */
+        rec_reserve(hdr, hdr->sz - off);
+        if (hdr->sz - off >= sizeof(mnl4c_recorder_entry_t)) {
+            e = (mnl4c_recorder_entry_t *)(hdr->data + off);
+            e->id = -1;
+        }
+        hdr->head += hdr->sz - off;
+        off = 0;
+    }
+
+    rec_reserve(hdr, need);
+    e = (mnl4c_recorder_entry_t *)(hdr->data + off);
+    e->ts = ts;
+    e->id = id;
+    e->level = level;
+    e->len = len;
+    memcpy(e + 1, msg, len);
+    hdr->head += need;
+}
+
+
+/*
+ * Replay the ring into ctx->bs ahead of the record at [start,
+ * SEOD(&ctx->bs)), if any, which is moved after the dump.  The ring is
+ * reset at the first entry that does not check out.  Return where the
+ * record starts now.  Called under ctx->mtx.
+ */
+static off_t
+rec_dump(mnl4c_ctx_t *ctx, off_t start)
+{
+    mnl4c_recorder_hdr_t *hdr;
+    uint64_t p;
+    char *rbuf;
+    size_t rsz;
+
+    hdr = ctx->rec.hdr;
+    if (hdr->head == hdr->tail) {
+        return start;
+    }
+
+    rbuf = NULL;
+    rsz = SEOD(&ctx->bs) - start;
+    if (rsz > 0) {
+        if ((rbuf = malloc(rsz)) == NULL) {
+            FAIL("malloc");
+        }
+        memcpy(rbuf, SDATA(&ctx->bs, start), rsz);
+        SEOD(&ctx->bs) = start;
+    }
+
+    (void)bytestream_nprintf(&ctx->bs,
+                             ctx->bsbufsz,
+                             "%.06lf [%d] flight recorder begin\n",
+                             mnl4c_now_posix(),
+                             ctx->cache.pid);
+    p = hdr->tail;
+    if (hdr->head < hdr->tail || hdr->head - hdr->tail > hdr->sz) {
+        p = hdr->head;
+    }
+    while (p < hdr->head) {
+        uint64_t off;
+        mnl4c_recorder_entry_t *e;
+        mnl4c_minfo_t *minfo;
+        off_t estart;
+
+        if (!rec_valid(hdr, p) || rec_next(hdr, p) > hdr->head) {
+            TRACE("bad flight recorder entry at %ld", (long)p);
+            break;
+        }
+        off = p % hdr->sz;
+        e = (mnl4c_recorder_entry_t *)(hdr->data + off);
+        p = rec_next(hdr, p);
+        if (hdr->sz - off < sizeof(mnl4c_recorder_entry_t) || e->id < 0) {
+            continue;
+        }
+        minfo = array_get(&ctx->minfos, e->id);
+        estart = SEOD(&ctx->bs);
+        if (bytestream_nprintf(&ctx->bs,
+                               ctx->bsbufsz,
+                               "%.06lf [%d] %s %s:\t%.*s\n",
+                               e->ts,
+                               ctx->cache.pid,
+                               (minfo != NULL && minfo->name != NULL) ?
+                                    BCDATA(minfo->name) : "-",
+                               level_names[e->level],
+                               (int)e->len,
+                               (char *)(e + 1)) < 0) {
+            break;
+        }
+        if (ctx->sanitize_escape || ctx->sanitize_maxlen > 0) {
+            ctx_sanitize(ctx, estart);
+        }
+        if (SEOD(&ctx->bs) >= ctx->bsbufsz) {
+            ctx_flush(ctx);
+        }
+    }
+    (void)bytestream_nprintf(&ctx->bs,
+                             ctx->bsbufsz,
+                             "%.06lf [%d] flight recorder end\n",
+                             mnl4c_now_posix(),
+                             ctx->cache.pid);
+    hdr->tail = hdr->head;
+
+    start = SEOD(&ctx->bs);
+    if (rbuf != NULL) {
+        (void)bytestream_cat(&ctx->bs, rsz, rbuf);
+        free(rbuf);
+    }
+    return start;
+}
+
+
+/*
+ * Async-signal-safe support: no malloc, no stdio, no locale, no locks.
+ */
+typedef struct _sigsafe_buf {
+    char *buf;
+    size_t sz;
+    size_t n;
+} sigsafe_buf_t;
+
+
+static void
+sigsafe_putc(sigsafe_buf_t *b, char c)
+{
+    if (b->n < b->sz) {
+        b->buf[b->n++] = c;
+    }
+}
+
+
+static void
+sigsafe_puts(sigsafe_buf_t *b, const char *s, size_t len, int width, bool left)
+{
+    size_t i;
+
+    if (!left) {
+        for (; width > (int)len; --width) {
+            sigsafe_putc(b, ' ');
+        }
+    }
+    for (i = 0; i < len; ++i) {
+        sigsafe_putc(b, s[i]);
+    }
+    if (left) {
+        for (; width > (int)len; --width) {
+            sigsafe_putc(b, ' ');
+        }
+    }
+}
+
+
+/*
+ * Render v right to left into the end of tmp, return the start.
+ */
+static char *
+sigsafe_utoa(char *end, uintmax_t v, unsigned base, bool upper)
+{
+    const char *digits;
+
+    digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[v % base];
+        v /= base;
+    } while (v != 0);
+    return end;
+}
+
+
+static void
+sigsafe_putnum(sigsafe_buf_t *b,
+               const char *digits,
+               size_t ndigits,
+               const char *sign,
+               int width,
+               bool left,
+               bool zero)
+{
+    size_t nsign;
+
+    nsign = strlen(sign);
+    if (zero && !left) {
+        sigsafe_puts(b, sign, nsign, 0, false);
+        for (; width > (int)(nsign + ndigits); --width) {
+            sigsafe_putc(b, '0');
+        }
+        sigsafe_puts(b, digits, ndigits, 0, false);
+    } else {
+        char tmp[80];
+
+        if (nsign + ndigits > sizeof(tmp)) {
+            ndigits = sizeof(tmp) - nsign;
+        }
+        memcpy(tmp, sign, nsign);
+        memcpy(tmp + nsign, digits, ndigits);
+        sigsafe_puts(b, tmp, nsign + ndigits, width, left);
+    }
+}
+
+
+static void
+sigsafe_putdouble(sigsafe_buf_t *b,
+                  long double d,
+                  int prec,
+                  const char *sign,
+                  int width,
+                  bool left,
+                  bool zero)
+{
+    char tmp[64], *end, *p;
+    uintmax_t ip, fp, scale;
+    int i;
+
+    if (isnan(d)) {
+        sigsafe_puts(b, "nan", 3, width, left);
+        return;
+    }
+    if (d < 0) {
+        d = -d;
+        sign = "-";
+    }
+    if (isinf(d) || d >= 1e19) {
+        sigsafe_putnum(b, "inf", 3, sign, width, left, false);
+        return;
+    }
+    if (prec > 9) {
+        prec = 9;
+    }
+    for (scale = 1, i = 0; i < prec; ++i) {
+        scale *= 10;
+    }
+    ip = (uintmax_t)d;
+    fp = (uintmax_t)((d - (long double)ip) * scale + 0.5);
+    if (fp >= scale) {
+        ++ip;
+        fp -= scale;
+    }
+
+    end = tmp + sizeof(tmp);
+    p = end;
+    if (prec > 0) {
+        for (i = 0; i < prec; ++i) {
+            *--p = '0' + (fp % 10);
+            fp /= 10;
+        }
+        *--p = '.';
+    }
+    p = sigsafe_utoa(p, ip, 10, false);
+    sigsafe_putnum(b, p, end - p, sign, width, left, zero);
+}
+
+
+static void
+sigsafe_vformat(sigsafe_buf_t *b, const char *fmt, va_list ap)
+{
+    const char *f;
+
+    for (f = fmt; *f != '\0'; ++f) {
+        bool left, zero;
+        const char *sign;
+        int width, prec, lmod;
+        char tmp[64], *end, *p;
+        uintmax_t u;
+        intmax_t v;
+
+        if (*f != '%') {
+            sigsafe_putc(b, *f);
+            continue;
+        }
+
+        left = false;
+        zero = false;
+        sign = "";
+        width = 0;
+        prec = -1;
+        lmod = 0;
+
+        for (++f; ; ++f) {
+            if (*f == '-') {
+                left = true;
+            } else if (*f == '0') {
+                zero = true;
+            } else if (*f == '+') {
+                sign = "+";
+            } else if (*f == ' ') {
+                if (*sign == '\0') {
+                    sign = " ";
+                }
+            } else if (*f != '#') {
+                break;
+            }
+        }
+        if (*f == '*') {
+            width = va_arg(ap, int);
+            ++f;
+        } else {
+            for (; *f >= '0' && *f <= '9'; ++f) {
+                width = width * 10 + (*f - '0');
+            }
+        }
+        if (*f == '.') {
+            ++f;
+            prec = 0;
+            if (*f == '*') {
+                prec = va_arg(ap, int);
+                ++f;
+            } else {
+                for (; *f >= '0' && *f <= '9'; ++f) {
+                    prec = prec * 10 + (*f - '0');
+                }
+            }
+        }
+        /* h, hh: promoted to int */
+        for (; *f == 'h' || *f == 'l' || *f == 'L' ||
+               *f == 'z' || *f == 'j' || *f == 't'; ++f) {
+            lmod = (*f == 'h') ? lmod : (lmod == 'l' ? 'q' : *f);
+        }
+
+        end = tmp + sizeof(tmp);
+        switch (*f) {
+        case 'd':
+        case 'i':
+            v = (lmod == 'q') ? va_arg(ap, long long) :
+                (lmod == 'l') ? va_arg(ap, long) :
+                (lmod == 'z') ? va_arg(ap, ssize_t) :
+                (lmod == 'j') ? va_arg(ap, intmax_t) :
+                (lmod == 't') ? va_arg(ap, ptrdiff_t) :
+                va_arg(ap, int);
+            if (v < 0) {
+                sign = "-";
+                u = -(uintmax_t)v;
+            } else {
+                u = v;
+            }
+            p = sigsafe_utoa(end, u, 10, false);
+            sigsafe_putnum(b, p, end - p, sign, width, left, zero);
+            break;
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            u = (lmod == 'q') ? va_arg(ap, unsigned long long) :
+                (lmod == 'l') ? va_arg(ap, unsigned long) :
+                (lmod == 'z') ? va_arg(ap, size_t) :
+                (lmod == 'j') ? va_arg(ap, uintmax_t) :
+                (lmod == 't') ? (uintmax_t)va_arg(ap, ptrdiff_t) :
+                va_arg(ap, unsigned);
+            p = sigsafe_utoa(end,
+                             u,
+                             (*f == 'u') ? 10 : (*f == 'o') ? 8 : 16,
+                             *f == 'X');
+            sigsafe_putnum(b, p, end - p, "", width, left, zero);
+            break;
+
+        case 'p':
+            p = sigsafe_utoa(end, (uintptr_t)va_arg(ap, void *), 16, false);
+            sigsafe_putnum(b, p, end - p, "0x", width, left, zero);
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            /* always rendered as fixed point */
+            sigsafe_putdouble(b,
+                              (lmod == 'L') ?
+                                va_arg(ap, long double) :
+                                va_arg(ap, double),
+                              prec < 0 ? 6 : prec,
+                              sign,
+                              width,
+                              left,
+                              zero);
+            break;
+
+        case 's':
+            {
+                const char *s;
+                size_t len;
+
+                if ((s = va_arg(ap, const char *)) == NULL) {
+                    s = "(null)";
+                }
+                for (len = 0;
+                     s[len] != '\0' && (prec < 0 || (int)len < prec);
+                     ++len) {
+                }
+                sigsafe_puts(b, s, len, width, left);
+            }
+            break;
+
+        case 'c':
+            tmp[0] = (char)va_arg(ap, int);
+            sigsafe_puts(b, tmp, 1, width, left);
+            break;
+
+        case '%':
+            sigsafe_putc(b, '%');
+            break;
+
+        default:
+            /* unsupported conversion, cannot consume further arguments */
+            sigsafe_puts(b, "<?>", 3, 0, false);
+            return;
+        }
+
+        if (*f == '\0') {
+            break;
+        }
+    }
+}
+
+
+static void
+sigsafe_format(sigsafe_buf_t *b, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    sigsafe_vformat(b, fmt, ap);
+    va_end(ap);
+}
+
+
+/*
+ * Numeric conversion kernels for the record prefix and the generated
+ * serializers, see mnl4c.h.  Digits are produced two at a time from a
+ * pair table, right to left into space reserved in the stream.
+ */
+static const char conv_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* conv_pow10[0] is 0 so that 0 counts as one digit */
+static const uint64_t conv_pow10[] = {
+    0ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+    10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+    100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+
+static inline unsigned
+conv_ndigits(uint64_t v)
+{
+    unsigned t;
+
+    /* floor(log10(2) * bit length), off by at most one */
+    t = ((64 - __builtin_clzll(v | 1)) * 1233) >> 12;
+    return t + (v >= conv_pow10[t]);
+}
+
+
+static inline void
+conv_digits(char *end, uint64_t v)
+{
+    while (v >= 100) {
+        unsigned r;
+
+        r = (unsigned)(v % 100);
+        v /= 100;
+        end -= 2;
+        memcpy(end, conv_pairs + r * 2, 2);
+    }
+    if (v >= 10) {
+        memcpy(end - 2, conv_pairs + v * 2, 2);
+    } else {
+        end[-1] = '0' + (char)v;
+    }
+}
+
+
+static inline size_t
+conv_u64(char *buf, uint64_t v)
+{
+    unsigned n;
+
+    n = conv_ndigits(v);
+    conv_digits(buf + n, v);
+    return n;
+}
+
+
+static inline size_t
+conv_i64(char *buf, int64_t v)
+{
+    if (v < 0) {
+        *buf = '-';
+        return conv_u64(buf + 1, -(uint64_t)v) + 1;
+    }
+    return conv_u64(buf, (uint64_t)v);
+}
+
+
+static inline char *
+bs_reserve(mnbytestream_t *bs, size_t sz)
+{
+    if ((size_t)SEOD(bs) + sz > SSIZE(bs)) {
+        if (bytestream_grow(bs, sz) != 0) {
+            return NULL;
+        }
+    }
+    return SDATA(bs, SEOD(bs));
+}
+
+
+ssize_t
+mnl4c_bs_ull(mnbytestream_t *bs, unsigned long long v)
+{
+    char *p;
+    size_t n;
+
+    if ((p = bs_reserve(bs, 20)) == NULL) {
+        return -1;
+    }
+    n = conv_u64(p, v);
+    SADVANCEEOD(bs, n);
+    return n;
+}
+
+
+ssize_t
+mnl4c_bs_ll(mnbytestream_t *bs, long long v)
+{
+    char *p;
+    size_t n;
+
+    if ((p = bs_reserve(bs, 21)) == NULL) {
+        return -1;
+    }
+    n = conv_i64(p, v);
+    SADVANCEEOD(bs, n);
+    return n;
+}
+
+
+ssize_t
+mnl4c_bs_hex(mnbytestream_t *bs, unsigned long long v, bool upper)
+{
+    const char *digits;
+    char *p;
+    size_t n, i;
+
+    digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    n = (67 - __builtin_clzll(v | 1)) / 4;
+    if ((p = bs_reserve(bs, n)) == NULL) {
+        return -1;
+    }
+    for (i = n; i > 0; --i) {
+        p[i - 1] = digits[v & 0xf];
+        v >>= 4;
+    }
+    SADVANCEEOD(bs, n);
+    return n;
+}
+
+
+/*
+ * Digits of %.<prec>f for |v|, no sign, rounded exactly like printf: the
+ * product's rounding error (fma) breaks near-ties.  Only for |v| < 1e15
+ * and prec 0 to 9, buf holds MNL4C_FIXED_MAXLEN bytes.  Shared with the
+ * C++ formatter.
+ */
+size_t
+mnl4c_fixed(char *buf, double v, int prec)
+{
+    double a, frac, scaled, fl, d, err;
+    uint64_t ip, fp, scale;
+    size_t nip;
+    bool up;
+
+    assert(fabs(v) < 1e15 && prec >= 0 && prec <= 9);
+    a = fabs(v);
+    scale = prec > 0 ? conv_pow10[prec] : 1;
+    ip = (uint64_t)a;
+    frac = a - (double)ip;
+    scaled = frac * (double)scale;
+    err = fma(frac, (double)scale, -scaled);
+    fl = floor(scaled);
+    fp = (uint64_t)fl;
+    d = scaled - fl;
+    if (d != 0.5) {
+        up = d > 0.5;
+    } else if (err != 0.0) {
+        up = err > 0.0;
+    } else {
+        /* exact tie, to even */
+        up = (prec > 0 ? fp : ip) & 1;
+    }
+    if (up) {
+        ++fp;
+    }
+    if (fp >= scale) {
+        fp -= scale;
+        ++ip;
+    }
+
+    nip = conv_ndigits(ip);
+    conv_digits(buf + nip, ip);
+    if (prec > 0) {
+        buf[nip] = '.';
+        memset(buf + nip + 1, '0', prec - conv_ndigits(fp));
+        conv_digits(buf + nip + 1 + prec, fp);
+        return nip + 1 + prec;
+    }
+    return nip;
+}
+
+
+/*
+ * %.<prec>f, large, non-finite or over-precise values are left to
+ * snprintf.
+ */
+ssize_t
+mnl4c_bs_fixed(mnbytestream_t *bs, double v, int prec)
+{
+    char *p;
+    size_t sz;
+    bool neg;
+
+    if (!(fabs(v) < 1e15) || prec < 0 || prec > 9) {
+        char buf[400];
+        int n;
+
+        n = snprintf(buf, sizeof(buf), "%.*f", prec, v);
+        if (n < 0 || (size_t)n >= sizeof(buf)) {
+            return -1;
+        }
+        return bytestream_cat(bs, n, buf);
+    }
+
+    if ((p = bs_reserve(bs, MNL4C_FIXED_MAXLEN + 1)) == NULL) {
+        return -1;
+    }
+    neg = signbit(v);
+    if (neg) {
+        *p++ = '-';
+    }
+    sz = neg + mnl4c_fixed(p, v, prec);
+    SADVANCEEOD(bs, sz);
+    return sz;
+}
+
+
+/*
+ * "<tm> [<pid>] <name> <level>[<nthrottled>]:\t", the [<nthrottled>]
+ * part is left out when nthrottled is negative.
+ */
+ssize_t
+mnl4c_bs_prefix(mnbytestream_t *bs,
+                double tm,
+                pid_t pid,
+                const char *name,
+                const char *level,
+                int nthrottled)
+{
+    off_t start;
+    size_t nname, nlevel;
+    char *p;
+
+    start = SEOD(bs);
+    if (mnl4c_bs_fixed(bs, tm, 6) < 0) {
+        return -1;
+    }
+    nname = strlen(name);
+    nlevel = strlen(level);
+    if ((p = bs_reserve(bs, nname + nlevel + 2 * 21 + 9)) == NULL) {
+        SEOD(bs) = start;
+        return -1;
+    }
+    *p++ = ' ';
+    *p++ = '[';
+    p += conv_i64(p, pid);
+    *p++ = ']';
+    *p++ = ' ';
+    memcpy(p, name, nname);
+    p += nname;
+    *p++ = ' ';
+    memcpy(p, level, nlevel);
+    p += nlevel;
+    if (nthrottled >= 0) {
+        *p++ = '[';
+        p += conv_i64(p, nthrottled);
+        *p++ = ']';
+    }
+    *p++ = ':';
+    *p++ = '\t';
+    SEOD(bs) = p - SDATA(bs, 0);
+    return SEOD(bs) - start;
+}
+
+
+/*
+ * Lowercase hex, two characters per byte.
+ */
+ssize_t
+mnl4c_bs_hexdump(mnbytestream_t *bs, const void *buf, size_t sz)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s;
+    char *p;
+    size_t i;
+
+    if (sz == 0) {
+        return 0;
+    }
+    if ((p = bs_reserve(bs, 2 * sz)) == NULL) {
+        return -1;
+    }
+    s = buf;
+    i = 0;
+#ifdef __SSE2__
+    {
+        const __m128i lomask = _mm_set1_epi8(0x0f);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i zero = _mm_set1_epi8('0');
+        const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+
+        for (; i + 16 <= sz; i += 16) {
+            __m128i x, hi, lo;
+
+            x = _mm_loadu_si128((const __m128i *)(s + i));
+            hi = _mm_and_si128(_mm_srli_epi16(x, 4), lomask);
+            lo = _mm_and_si128(x, lomask);
+            /* nibble + '0', plus the gap up to 'a' for 10..15 */
+            hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+                              _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+            lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+                              _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+            _mm_storeu_si128((__m128i *)(p + 2 * i),
+                             _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128((__m128i *)(p + 2 * i + 16),
+                             _mm_unpackhi_epi8(hi, lo));
+        }
+    }
+#endif
+    for (; i < sz; ++i) {
+        p[2 * i] = hex[s[i] >> 4];
+        p[2 * i + 1] = hex[s[i] & 0x0f];
+    }
+    SADVANCEEOD(bs, 2 * sz);
+    return 2 * sz;
+}
+
+
+/*
+ * RFC 4648 base64 with padding.
+ */
+ssize_t
+mnl4c_bs_base64(mnbytestream_t *bs, const void *buf, size_t sz)
+{
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char *s;
+    size_t n, i;
+    char *p;
+
+    if (sz == 0) {
+        return 0;
+    }
+    n = (sz + 2) / 3 * 4;
+    if ((p = bs_reserve(bs, n)) == NULL) {
+        return -1;
+    }
+    s = buf;
+    for (i = 0; i + 3 <= sz; i += 3) {
+        uint32_t v;
+
+        v = ((uint32_t)s[i] << 16) | ((uint32_t)s[i + 1] << 8) | s[i + 2];
+        *p++ = b64[v >> 18];
+        *p++ = b64[(v >> 12) & 0x3f];
+        *p++ = b64[(v >> 6) & 0x3f];
+        *p++ = b64[v & 0x3f];
+    }
+    if (i < sz) {
+        uint32_t v;
+
+        v = (uint32_t)s[i] << 16;
+        if (i + 1 < sz) {
+            v |= (uint32_t)s[i + 1] << 8;
+        }
+        *p++ = b64[v >> 18];
+        *p++ = b64[(v >> 12) & 0x3f];
+        *p++ = i + 1 < sz ? b64[(v >> 6) & 0x3f] : '=';
+        *p++ = '=';
+    }
+    SADVANCEEOD(bs, n);
+    return n;
+}
+
+
+static void
+sigsafe_writeall(int fd, const char *buf, size_t sz)
+{
+    while (sz > 0) {
+        ssize_t nwritten;
+
+        if ((nwritten = write(fd, buf, sz)) <= 0) {
+            if (nwritten < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        buf += nwritten;
+        sz -= nwritten;
+    }
+}
+
+
+/*
+ * The descriptor the lockless paths write to, -1 if there is none.
+ * MNL4C_OPEN_DIRECT loggers have none: their staging buffer and offsets
+ * belong to whoever holds flush_mtx, which a signal handler or a
+ * watchdog thread cannot take, and plain writes through another
+ * descriptor would be overwritten by the next staged block.
+ */
+static int
+ctx_fd(mnl4c_ctx_t *ctx)
+{
+    switch (ctx->ty & MNL4C_OPEN_TY) {
+    case MNL4C_OPEN_STDOUT:
+        return STDOUT_FILENO;
+
+    case MNL4C_OPEN_STDERR:
+        return STDERR_FILENO;
+
+    case MNL4C_OPEN_FILE:
+        if (ctx->writer.data.file.dbuf != NULL) {
+            return -1;
+        }
+        return ctx->writer.data.file.fd;
+
+    default:
+        return -1;
+    }
+}
+
+
+/*
+ * Async-signal-safe.
+ */
+static void
+ctx_writeall(mnl4c_ctx_t *ctx, const char *buf, size_t sz)
+{
+    int fd;
+
+    if ((fd = ctx_fd(ctx)) < 0) {
+        return;
+    }
+    sigsafe_writeall(fd, buf, sz);
+}
+
+
+static void
+cache_init(mnl4c_cache_t *cache)
+{
+    cache->pid = getpid();
+}
+
+
+static void
+writer_fini(mnl4c_writer_t *writer)
+{
+    BYTES_DECREF(&writer->data.file.path);
+    BYTES_DECREF(&writer->data.file.shadow_path);
+    if (writer->data.file.shm != NULL) {
+        (void)munmap(writer->data.file.shm, writer->data.file.shmsz);
+        writer->data.file.shm = NULL;
+        writer->data.file.shmsz = 0;
+    }
+    if (writer->data.file.dbuf != NULL) {
+        if (writer->data.file.fd >= 0) {
+            (void)direct_finish(writer);
+        }
+        free(writer->data.file.dbuf);
+        writer->data.file.dbuf = NULL;
+    }
+}
+
+
+static int
+minfo_init(void *o)
+{
+    mnl4c_minfo_t *minfo = o;
+    /* an id nothing was registered for rejects everything */
+    minfo->id = -1;
+    minfo->flevel = -1;
+    minfo->elevel = -1;
+    minfo->name = NULL;
+    minfo->throttle_threshold = -1.0l;
+    minfo->nthrottled = 0;
+    minfo->ncalls = 0;
+    minfo->nrejected = 0;
+    minfo->nthrottled_total = 0;
+    minfo->fmt_cycles = 0;
+    minfo->write_cycles = 0;
+    minfo->pfx_level = -1;
+    minfo->pfx_pid = 0;
+    minfo->pfx_len = 0;
+    return 0;
+}
+
+
+static int
+minfo_fini(void *o)
+{
+    mnl4c_minfo_t *minfo = o;
+    BYTES_DECREF(&minfo->name);
+    return 0;
+}
+
+
+/*
+ * Copy the minfos levels to the table mnl4c_ctx_enabled() reads, and
+ * publish a larger one if ids were added.  Under ctx->mtx.
+ */
+static void
+ctx_levels_update(mnl4c_ctx_t *ctx)
+{
+    mnl4c_levels_t *levels;
+    mnl4c_minfo_t *minfo;
+    mnarray_iter_t it;
+    size_t n;
+
+    levels = ctx->levels;
+    n = ARRAY_ELNUM(&ctx->minfos);
+    if (levels == NULL || levels->n < n) {
+        mnl4c_levels_t *nlevels;
+        size_t i;
+
+        if ((nlevels = malloc(sizeof(mnl4c_levels_t) +
+                              sizeof(mnl4c_level_t) * n)) == NULL) {
+            FAIL("malloc");
+        }
+        if ((nlevels->nfiltered = malloc(sizeof(uint64_t) * n)) == NULL) {
+            FAIL("malloc");
+        }
+        nlevels->prev = levels;
+        nlevels->n = n;
+        nlevels->l = (mnl4c_level_t *)(nlevels + 1);
+        for (i = 0; i < n; ++i) {
+            nlevels->nfiltered[i] = 0;
+        }
+        levels = nlevels;
+    } else {
+        /* in place, unlocked readers see either level */
+        assert(levels->n == n);
+    }
+    for (minfo = array_first(&ctx->minfos, &it);
+         minfo != NULL;
+         minfo = array_next(&ctx->minfos, &it)) {
+        mnl4c_level_t *l = &levels->l[it.iter];
+
+        __atomic_store_n(&l->flevel, minfo->flevel, __ATOMIC_RELAXED);
+        __atomic_store_n(&l->elevel, minfo->elevel, __ATOMIC_RELAXED);
+    }
+    if (levels != ctx->levels) {
+        __atomic_store_n(&ctx->levels, levels, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*
+ * Charge the calls the unlocked check turned away to their minfos, as
+ * rejected ones.  Under ctx->mtx.
+ */
+static void
+ctx_levels_collect(mnl4c_ctx_t *ctx)
+{
+    mnl4c_levels_t *levels;
+
+    for (levels = ctx->levels; levels != NULL; levels = levels->prev) {
+        size_t i;
+
+        for (i = 0; i < levels->n; ++i) {
+            mnl4c_minfo_t *minfo;
+            uint64_t n;
+
+            if (__atomic_load_n(&levels->nfiltered[i],
+                                __ATOMIC_RELAXED) == 0) {
+                continue;
+            }
+            n = __atomic_exchange_n(&levels->nfiltered[i],
+                                    0,
+                                    __ATOMIC_RELAXED);
+            if ((minfo = array_get(&ctx->minfos, i)) != NULL) {
+                minfo->ncalls += n;
+                minfo->nrejected += n;
+            }
+        }
+    }
+}
+
+
+static void
+ctx_levels_fini(mnl4c_ctx_t *ctx)
+{
+    while (ctx->levels != NULL) {
+        mnl4c_levels_t *levels = ctx->levels;
+
+        ctx->levels = levels->prev;
+        free(levels->nfiltered);
+        free(levels);
+    }
+}
+
+
+/*
+ * Flusher: a single library thread that writes out buffers that have been
+ * pending for flush_latency, see mnl4c_set_flush_latency().  It only
+ * knows the loggers registered in flusher_ctxes, and only ever trylocks
+ * them, a busy logger is left to its own producers.  The writes and syncs
+ * it asks for run with flusher_mtx released, flusher_busy is the logger
+ * it is working on meanwhile, see flusher_remove().
+ */
+static pthread_mutex_t flusher_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flusher_idle_cond = PTHREAD_COND_INITIALIZER;
+static mnl4c_ctx_t *flusher_busy = NULL;
+static pthread_t flusher_thread;
+static bool flusher_running = false;
+static bool flusher_stop = false;
+/* a forked child that lost the flusher, see atfork_child() */
+static bool flusher_restart = false;
+/* mnl4c_ctx_t *, NULL for a free slot */
+static mnarray_t flusher_ctxes;
+static bool flusher_ctxes_ready = false;
+
+
+static void *
+flusher_run(UNUSED void *udata)
+{
+    (void)pthread_mutex_lock(&flusher_mtx);
+    while (!flusher_stop) {
+        mnl4c_ctx_t **pctx;
+        mnarray_iter_t it;
+        double period, now;
+
+        period = 0.0;
+        now = mnl4c_now_posix();
+        for (pctx = array_first(&flusher_ctxes, &it);
+             pctx != NULL;
+             pctx = array_next(&flusher_ctxes, &it)) {
+            mnl4c_ctx_t *ctx;
+
+            if ((ctx = *pctx) == NULL) {
+                continue;
+            }
+            /* pending for at least half the latency at every wake-up */
+            if (ctx->flush_latency > 0.0 &&
+                (period == 0.0 || ctx->flush_latency / 2.0 < period)) {
+                period = ctx->flush_latency / 2.0;
+            }
+            if (ctx->writer.data.file.durability ==
+                    MNL4C_DURABILITY_PERIODIC &&
+                (period == 0.0 || ctx->sync_interval / 2.0 < period)) {
+                period = ctx->sync_interval / 2.0;
+            }
+            if (pthread_mutex_trylock(&ctx->mtx) != 0) {
+                continue;
+            }
+            if (SEOD(&ctx->bs) > 0 &&
+                ctx->flush_latency > 0.0 &&
+                now - ctx->pending_tm >= ctx->flush_latency / 2.0) {
+                ++ctx->stats.ntimed_flushes;
+                ctx->wpending |= MNL4C_WPENDING_FLUSH;
+            }
+            if (ctx->writer.data.file.durability ==
+                    MNL4C_DURABILITY_PERIODIC &&
+                now >= ctx->sync_next) {
+                ctx->sync_next = now + ctx->sync_interval;
+                if (SEOD(&ctx->bs) > 0 &&
+                    !(ctx->wpending & MNL4C_WPENDING_FLUSH)) {
+                    ++ctx->stats.ntimed_flushes;
+                    ctx->wpending |= MNL4C_WPENDING_FLUSH;
+                }
+                ctx->wpending |= MNL4C_WPENDING_SYNC;
+            }
+            if (ctx->wpending == 0) {
+                (void)pthread_mutex_unlock(&ctx->mtx);
+                continue;
+            }
+            /* the others are not held up by this one's write and sync */
+            flusher_busy = ctx;
+            (void)pthread_mutex_unlock(&flusher_mtx);
+            mnl4c_ctx_unlock(ctx);
+            (void)pthread_mutex_lock(&flusher_mtx);
+            flusher_busy = NULL;
+            (void)pthread_cond_broadcast(&flusher_idle_cond);
+        }
+
+        if (period > 0.0) {
+            struct timespec ts;
+
+            now += period;
+            ts.tv_sec = (time_t)now;
+            ts.tv_nsec = (long)((now - (double)ts.tv_sec) * 1000000000.0);
+            (void)pthread_cond_timedwait(&flusher_cond, &flusher_mtx, &ts);
+        } else {
+            (void)pthread_cond_wait(&flusher_cond, &flusher_mtx);
+        }
+    }
+    (void)pthread_mutex_unlock(&flusher_mtx);
+    return NULL;
+}
+
+
+/*
+ * Under flusher_mtx.
+ */
+static int
+flusher_start(void)
+{
+    if (!flusher_ctxes_ready) {
+        array_init(&flusher_ctxes, sizeof(mnl4c_ctx_t *), 0, NULL, NULL);
+        flusher_ctxes_ready = true;
+    }
+    if (!flusher_running) {
+        flusher_stop = false;
+        if (pthread_create(&flusher_thread, NULL, flusher_run, NULL) != 0) {
+            return -1;
+        }
+        flusher_running = true;
+    }
+    __atomic_store_n(&flusher_restart, false, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+static void
+flusher_shutdown(void)
+{
+    (void)pthread_mutex_lock(&flusher_mtx);
+    if (!flusher_running) {
+        (void)pthread_mutex_unlock(&flusher_mtx);
+        return;
+    }
+    flusher_stop = true;
+    (void)pthread_cond_signal(&flusher_cond);
+    (void)pthread_mutex_unlock(&flusher_mtx);
+    (void)pthread_join(flusher_thread, NULL);
+    flusher_running = false;
+}
+
+
+static bool
+flusher_needed(mnl4c_ctx_t *ctx)
+{
+    return ctx->flush_latency > 0.0 ||
+        ctx->writer.data.file.durability == MNL4C_DURABILITY_PERIODIC;
+}
+
+
+/*
+ * Under flusher_mtx, and not under ctx->mtx: waits until the flusher is
+ * done with ctx, which may then be destroyed.
+ */
+static void
+flusher_remove(mnl4c_ctx_t *ctx)
+{
+    mnl4c_ctx_t **pctx;
+    mnarray_iter_t it;
+
+    for (pctx = array_first(&flusher_ctxes, &it);
+         pctx != NULL;
+         pctx = array_next(&flusher_ctxes, &it)) {
+        if (*pctx == ctx) {
+            *pctx = NULL;
+        }
+    }
+    while (flusher_busy == ctx) {
+        (void)pthread_cond_wait(&flusher_idle_cond, &flusher_mtx);
+    }
+}
+
+
+/*
+ * Under flusher_mtx.
+ */
+static int
+flusher_add(mnl4c_ctx_t *ctx)
+{
+    mnl4c_ctx_t **pctx;
+    mnarray_iter_t it;
+
+    for (pctx = array_first(&flusher_ctxes, &it);
+         pctx != NULL;
+         pctx = array_next(&flusher_ctxes, &it)) {
+        if (*pctx == ctx) {
+            return 0;
+        }
+    }
+    for (pctx = array_first(&flusher_ctxes, &it);
+         pctx != NULL;
+         pctx = array_next(&flusher_ctxes, &it)) {
+        if (*pctx == NULL) {
+            break;
+        }
+    }
+    if (pctx == NULL && (pctx = array_incr(&flusher_ctxes)) == NULL) {
+        return -1;
+    }
+    *pctx = ctx;
+    return 0;
+}
+
+
+/*
+ * Register or unregister ctx after one of the settings the flusher serves
+ * has changed.  Under flusher_mtx.
+ */
+static int
+flusher_update(mnl4c_ctx_t *ctx)
+{
+    if (flusher_needed(ctx)) {
+        if (flusher_start() != 0 || flusher_add(ctx) != 0) {
+            return -1;
+        }
+    } else if (flusher_ctxes_ready) {
+        flusher_remove(ctx);
+    }
+    /* the period may have changed */
+    (void)pthread_cond_signal(&flusher_cond);
+    return 0;
+}
+
+
+/*
+ * Start the flusher in a forked child, on behalf of its first record,
+ * see atfork_child().  Not under ctx->mtx, which comes after
+ * flusher_mtx.
+ */
+static void
+flusher_resume(void)
+{
+    (void)pthread_mutex_lock(&flusher_mtx);
+    if (__atomic_load_n(&flusher_restart, __ATOMIC_RELAXED) &&
+        flusher_start() != 0) {
+        TRACE("failed to start the flusher");
+    }
+    (void)pthread_mutex_unlock(&flusher_mtx);
+}
+
+
+/*
+ * The end of a lock hold that left work behind, see mnl4c_ctx_commit().
+ * The record is complete by now, its minfo and the stats included, so
+ * nothing is held on to across the write.
+ */
+void
+mnl4c_ctx_unlock_slow(mnl4c_ctx_t *ctx)
+{
+    unsigned pending;
+    int prof_id;
+
+    pending = ctx->wpending;
+    prof_id = ctx->wprof_id;
+    ctx->wpending = 0;
+    ctx->wprof_id = -1;
+    if (pending & MNL4C_WPENDING_FLUSH) {
+        ctx_flush_unlocked(ctx, prof_id, ctx->wprof_start);
+    }
+    if (pending & MNL4C_WPENDING_SYNC) {
+        ctx_sync(ctx);
+    }
+    if (pending & MNL4C_WPENDING_SINKS) {
+        ctx_flush_sinks(ctx);
+    }
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    if (pending & MNL4C_WPENDING_FLUSHER) {
+        flusher_resume();
+    }
+}
+
+
+static mnl4c_ctx_t *
+mnl4c_ctx_new(ssize_t bsbufsz)
+{
+    mnl4c_ctx_t *res;
+
+    if ((res = malloc(sizeof(mnl4c_ctx_t))) == NULL) {
+        FAIL("malloc");
+    }
+    res->nref = 0;
+    res->bsbufsz = bsbufsz;
+    bytestream_init(&res->bs, bsbufsz);
+    bytestream_init(&res->wbs, bsbufsz);
+    writer_init(&res->writer);
+    cache_init(&res->cache);
+    rec_init(&res->rec);
+    memset(&res->stats, '\0', sizeof(res->stats));
+    res->stats_interval = 0.0;
+    res->stats_next = 0.0;
+    res->profiling = false;
+    res->prof_id = -1;
+    res->prof_start = 0;
+    res->sanitize_escape = false;
+    res->sanitize_maxlen = 0;
+    res->flush_latency = 0.0;
+    res->pending_tm = 0.0;
+    res->sync_level = -1;
+    res->sync_interval = 0.0;
+    res->sync_next = 0.0;
+    res->sync_busy = false;
+    if (MNUNLIKELY(pthread_cond_init(&res->sync_cond, NULL) != 0)) {
+        FFAIL("pthread_cond_init");
+    }
+    res->wpending = 0;
+    res->wprof_id = -1;
+    res->wprof_start = 0;
+    res->levels = NULL;
+    array_init(&res->minfos,
+               sizeof(mnl4c_minfo_t),
+               0,
+               minfo_init,
+               minfo_fini);
+    array_init(&res->sinks,
+               sizeof(mnl4c_sink_t),
+               0,
+               NULL,
+               NULL);
+    res->nowners = 0;
+    res->ty = 0;
+    if (MNUNLIKELY(pthread_mutex_init(&res->mtx, NULL) != 0)) {
+        FFAIL("pthread_mutex_init");
+    }
+    if (MNUNLIKELY(pthread_mutex_init(&res->flush_mtx, NULL) != 0)) {
+        FFAIL("pthread_mutex_init");
+    }
+    return res;
+}
+
+
+static void
+mnl4c_ctx_destroy(mnl4c_ctx_t **pctx)
+{
+    if (*pctx != NULL) {
+        if (flusher_needed(*pctx)) {
+            (void)pthread_mutex_lock(&flusher_mtx);
+            flusher_remove(*pctx);
+            (void)pthread_mutex_unlock(&flusher_mtx);
+        }
+        (void)pthread_cond_destroy(&(*pctx)->sync_cond);
+        (void)pthread_mutex_destroy(&(*pctx)->flush_mtx);
+        (void)pthread_mutex_destroy(&(*pctx)->mtx);
+        bytestream_fini(&(*pctx)->bs);
+        bytestream_fini(&(*pctx)->wbs);
+        writer_fini(&(*pctx)->writer);
+        rec_fini(&(*pctx)->rec);
+        array_fini(&(*pctx)->minfos);
+        ctx_levels_fini(*pctx);
+        array_fini(&(*pctx)->sinks);
+        free(*pctx);
+        *pctx = NULL;
+    }
+}
+
+
+bool
+mnl4c_ctx_allowed(mnl4c_ctx_t *ctx, int level, int id)
+{
+    mnl4c_minfo_t *minfo;
+
+    assert(id >= 0);
+    if ((minfo = array_get(&ctx->minfos, id)) == NULL) {
+        FAIL("array_get");
+    }
+    assert(minfo->id == id);
+    assert(level >= 0 && (size_t)level < countof(level_names));
+    ++minfo->ncalls;
+    if (minfo->elevel >= level) {
+        if (MNUNLIKELY(ctx->profiling)) {
+            ctx->prof_id = id;
+            ctx->prof_start = MNL4C_CYCLES();
+        }
+        return true;
+    }
+    ++minfo->nrejected;
+    return false;
+}
+
+
+/*
+ * mnl4c_ctx_allowed() for MNL4C_WRITE_SIGSAFE, which runs without the
+ * lock: no counters, no profiling, and an unknown id or level is just
+ * not allowed.  Async-signal-safe.
+ */
+bool
+mnl4c_ctx_allowed_sigsafe(mnl4c_ctx_t *ctx, int level, int id)
+{
+    mnl4c_levels_t *levels;
+
+    if (id < 0 || level < 0 || (size_t)level >= countof(level_names)) {
+        return false;
+    }
+    /* minfos may be reallocated under the lock meanwhile */
+    levels = __atomic_load_n(&ctx->levels, __ATOMIC_ACQUIRE);
+    if (levels == NULL || (size_t)id >= levels->n) {
+        return false;
+    }
+    return __atomic_load_n(&levels->l[id].elevel, __ATOMIC_RELAXED) >= level;
+}
+
+
+static bool
+prefix_render(mnl4c_minfo_t *minfo, pid_t pid, const char *name, int level)
+{
+    char *p;
+    size_t nname, nlevel;
+
+    nname = strlen(name);
+    nlevel = strlen(level_names[level]);
+    if (nname + nlevel + 21 + 5 > sizeof(minfo->pfx)) {
+        return false;
+    }
+    p = minfo->pfx;
+    *p++ = ' ';
+    *p++ = '[';
+    p += conv_i64(p, pid);
+    *p++ = ']';
+    *p++ = ' ';
+    memcpy(p, name, nname);
+    p += nname;
+    *p++ = ' ';
+    memcpy(p, level_names[level], nlevel);
+    p += nlevel;
+    minfo->pfx_len = p - minfo->pfx;
+    minfo->pfx_level = level;
+    minfo->pfx_pid = pid;
+    return true;
+}
+
+
+/*
+ * Same output as mnl4c_bs_prefix() for the current time, pid and the
+ * message id.  Everything but the time and nthrottled is rendered once
+ * per message and level, and again after fork, then copied.  Called
+ * under ctx->mtx.
+ */
+ssize_t
+mnl4c_ctx_prefix(mnl4c_ctx_t *ctx,
+                 int id,
+                 const char *name,
+                 int level,
+                 int nthrottled)
+{
+    mnl4c_minfo_t *minfo;
+    off_t start;
+    char *p;
+
+    if ((minfo = array_get(&ctx->minfos, id)) == NULL) {
+        FAIL("array_get");
+    }
+    if (MNUNLIKELY(minfo->pfx_level != level ||
+                   minfo->pfx_pid != ctx->cache.pid)) {
+        if (!prefix_render(minfo, ctx->cache.pid, name, level)) {
+            return mnl4c_bs_prefix(&ctx->bs,
+                                   ctx->writer.data.file.curtm,
+                                   ctx->cache.pid,
+                                   name,
+                                   level_names[level],
+                                   nthrottled);
+        }
+    }
+
+    start = SEOD(&ctx->bs);
+    if (mnl4c_bs_fixed(&ctx->bs, ctx->writer.data.file.curtm, 6) < 0) {
+        return -1;
+    }
+    if ((p = bs_reserve(&ctx->bs, minfo->pfx_len + 21 + 4)) == NULL) {
+        SEOD(&ctx->bs) = start;
+        return -1;
+    }
+    memcpy(p, minfo->pfx, minfo->pfx_len);
+    p += minfo->pfx_len;
+    if (nthrottled >= 0) {
+        *p++ = '[';
+        p += conv_i64(p, nthrottled);
+        *p++ = ']';
+    }
+    *p++ = ':';
+    *p++ = '\t';
+    SEOD(&ctx->bs) = p - SDATA(&ctx->bs, 0);
+    return SEOD(&ctx->bs) - start;
+}
+
+
+void
+mnl4c_ctx_lock_slow(mnl4c_ctx_t *ctx)
+{
+    uint64_t before;
+
+    before = mono_ns();
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ++ctx->stats.nlock_waits;
+    ctx->stats.lock_wait_ns += mono_ns() - before;
+}
+
+
+static void
+ctx_get_stats(mnl4c_ctx_t *ctx, mnl4c_stats_t *stats)
+{
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    *stats = ctx->stats;
+    if ((ctx->ty & MNL4C_OPEN_TY) == MNL4C_OPEN_FILE) {
+        stats->nrollovers = ctx->writer.data.file.nrollovers;
+        stats->nwrite_errors += ctx->writer.data.file.nsync_errors;
+    }
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    if (ctx->writer.data.file.shm != NULL) {
+        stats->ndropped += __atomic_load_n(
+            &ctx->writer.data.file.shm->ndropped, __ATOMIC_RELAXED);
+    }
+}
+
+
+static void
+hist_format(char *buf, size_t sz, const uint64_t *hist)
+{
+    int i;
+    size_t n;
+
+    n = 0;
+    buf[0] = '\0';
+    for (i = 0; i < MNL4C_STATS_NBUCKETS && n < sz; ++i) {
+        if (hist[i] == 0) {
+            continue;
+        }
+        n += snprintf(buf + n,
+                      sz - n,
+                      "%s%d:%ju",
+                      n > 0 ? "," : "",
+                      i,
+                      (uintmax_t)hist[i]);
+    }
+}
+
+
+/*
+ * Render the stats as a record into the ctx's own buffer, under
+ * ctx->mtx.
+ */
+static void
+ctx_dump_stats(mnl4c_ctx_t *ctx)
+{
+    mnl4c_stats_t stats;
+    char flush_ns[512];
+    char record_sz[512];
+
+    ctx_get_stats(ctx, &stats);
+    hist_format(flush_ns, sizeof(flush_ns), stats.flush_ns);
+    hist_format(record_sz, sizeof(record_sz), stats.record_sz);
+    (void)bytestream_nprintf(&ctx->bs,
+                             ctx->bsbufsz,
+                             "%.06lf [%d] stats:\t"
+                             "records %ju throttled %ju flushes %ju "
+                             "timed_flushes %ju "
+                             "bytes %ju errors %ju dropped %ju "
+                             "rollovers %ju lock_waits %ju lock_wait_ns %ju "
+                             "syncs %ju sync_waits %ju "
+                             "flush_ns_log2 [%s] record_sz_log2 [%s]\n",
+                             mnl4c_now_posix(),
+                             ctx->cache.pid,
+                             (uintmax_t)stats.nrecords,
+                             (uintmax_t)stats.nthrottled,
+                             (uintmax_t)stats.nflushes,
+                             (uintmax_t)stats.ntimed_flushes,
+                             (uintmax_t)stats.nbytes,
+                             (uintmax_t)stats.nwrite_errors,
+                             (uintmax_t)stats.ndropped,
+                             (uintmax_t)stats.nrollovers,
+                             (uintmax_t)stats.nlock_waits,
+                             (uintmax_t)stats.lock_wait_ns,
+                             (uintmax_t)stats.nsyncs,
+                             (uintmax_t)stats.nsync_waits,
+                             flush_ns,
+                             record_sz);
+}
+
+
+/*
+ * Per-thread diagnostic context, see mnl4c_ndc_push().  buf holds the
+ * thread tag, if any, followed by the pushed entries, all rendered; mark
+ * is where each entry starts.
+ */
+typedef struct _mnl4c_ndc {
+    size_t len;
+    size_t thrlen;
+    int depth;
+    size_t mark[MNL4C_NDC_MAXDEPTH];
+    char buf[MNL4C_NDC_BUFSZ];
+} mnl4c_ndc_t;
+
+static __thread mnl4c_ndc_t ndc;
+static unsigned ndc_nthreads = 0;
+
+
+static int
+ndc_vpush(const char *key, const char *fmt, va_list ap)
+{
+    size_t avail;
+    int n, m;
+
+    if (ndc.depth >= MNL4C_NDC_MAXDEPTH) {
+        return -1;
+    }
+    avail = sizeof(ndc.buf) - ndc.len;
+    m = 0;
+    if (key != NULL) {
+        if ((m = snprintf(ndc.buf + ndc.len, avail, "%s=", key)) < 0 ||
+            (size_t)m >= avail) {
+            return -1;
+        }
+    }
+    /* one spare byte for the separator, every entry ends with a space */
+    if ((n = vsnprintf(ndc.buf + ndc.len + m, avail - m, fmt, ap)) < 0 ||
+        (size_t)(m + n + 1) >= avail) {
+        return -1;
+    }
+    ndc.buf[ndc.len + m + n] = ' ';
+    ++n;
+    ndc.mark[ndc.depth++] = ndc.len;
+    ndc.len += m + n;
+    return ndc.depth;
+}
+
+
+/*
+ * Push an entry rendered from fmt, followed by a space, on the calling
+ * thread's diagnostic context.  The rendered bytes are inserted after the
+ * prefix of every record the thread writes, ahead of any *_CONTEXT_*
+ * context, until the entry is popped.  Returns the new depth, or -1 if
+ * the context is full.
+ */
+int
+mnl4c_ndc_push(const char *fmt, ...)
+{
+    va_list ap;
+    int res;
+
+    va_start(ap, fmt);
+    res = ndc_vpush(NULL, fmt, ap);
+    va_end(ap);
+    return res;
+}
+
+
+/*
+ * Same as mnl4c_ndc_push(), rendered as "key=value ".
+ */
+int
+mnl4c_ndc_push_kv(const char *key, const char *fmt, ...)
+{
+    va_list ap;
+    int res;
+
+    va_start(ap, fmt);
+    res = ndc_vpush(key, fmt, ap);
+    va_end(ap);
+    return res;
+}
+
+
+/*
+ * Returns the remaining depth, or -1 if there was nothing to pop.
+ */
+int
+mnl4c_ndc_pop(void)
+{
+    if (ndc.depth == 0) {
+        return -1;
+    }
+    ndc.len = ndc.mark[--ndc.depth];
+    return ndc.depth;
+}
+
+
+/*
+ * Tag the calling thread's records with "<name>#<n> ", n being a
+ * process-wide thread number assigned on the first call.  The tag comes
+ * before the pushed entries, NULL removes it.
+ */
+int
+mnl4c_ndc_set_thread(const char *name)
+{
+    static __thread unsigned nthread = 0;
+    char thr[MNL4C_NDC_BUFSZ];
+    int n, i;
+
+    n = 0;
+    if (name != NULL) {
+        if (nthread == 0) {
+            nthread = __atomic_add_fetch(&ndc_nthreads, 1, __ATOMIC_RELAXED);
+        }
+        if ((n = snprintf(thr, sizeof(thr), "%s#%u ", name, nthread)) < 0 ||
+            (size_t)n >= sizeof(thr) ||
+            ndc.len - ndc.thrlen + n > sizeof(ndc.buf)) {
+            return -1;
+        }
+    }
+    memmove(ndc.buf + n, ndc.buf + ndc.thrlen, ndc.len - ndc.thrlen);
+    memcpy(ndc.buf, thr, n);
+    for (i = 0; i < ndc.depth; ++i) {
+        ndc.mark[i] = ndc.mark[i] - ndc.thrlen + n;
+    }
+    ndc.len = ndc.len - ndc.thrlen + n;
+    ndc.thrlen = n;
+    return 0;
+}
+
+
+/*
+ * Insert the calling thread's context after the prefix of the record at
+ * start, under ctx->mtx.
+ */
+static void
+ctx_ndc(mnl4c_ctx_t *ctx, off_t start)
+{
+    char *tab;
+    off_t off;
+
+    if ((tab = memchr(SDATA(&ctx->bs, start),
+                      '\t',
+                      SEOD(&ctx->bs) - start)) == NULL) {
+        return;
+    }
+    off = tab + 1 - SDATA(&ctx->bs, 0);
+    if (bs_reserve(&ctx->bs, ndc.len) == NULL) {
+        return;
+    }
+    memmove(SDATA(&ctx->bs, off + ndc.len),
+            SDATA(&ctx->bs, off),
+            SEOD(&ctx->bs) - off);
+    memcpy(SDATA(&ctx->bs, off), ndc.buf, ndc.len);
+    SADVANCEEOD(&ctx->bs, ndc.len);
+}
+
+
+static void
+ctx_fanout(mnl4c_ctx_t *ctx, int level, off_t start)
+{
+    mnl4c_sink_t *sink;
+    mnarray_iter_t it;
+
+    for (sink = array_first(&ctx->sinks, &it);
+         sink != NULL;
+         sink = array_next(&ctx->sinks, &it)) {
+        mnl4c_ctx_t *sctx;
+
+        if (sink->level < level) {
+            continue;
+        }
+        if ((sctx = mnl4c_get_ctx(sink->ld)) == NULL) {
+            continue;
+        }
+
+        /*
+         * The record is rendered once in the owner's buffer, sinks only
+         * receive a copy of the bytes.  Their writes are left to
+         * ctx_flush_sinks(), out of the owner's lock.
+         */
+        (void)pthread_mutex_lock(&sctx->mtx);
+        (void)bytestream_cat(&sctx->bs,
+                             SEOD(&ctx->bs) - start,
+                             SDATA(&ctx->bs, start));
+        if ((sink->flags & MNL4C_SINK_FLUSH_RECORD) ||
+            SEOD(&sctx->bs) >= sctx->bsbufsz) {
+            sink->pending = true;
+            ctx->wpending |= MNL4C_WPENDING_SINKS;
+        }
+        (void)pthread_mutex_unlock(&sctx->mtx);
+    }
+}
+
+
+/*
+ * Called by the logging macros under ctx->mtx after a complete record
+ * has been rendered at [start, SEOD(&ctx->bs)).  The write, if due, is
+ * left to mnl4c_ctx_unlock(), after the caller is done with the record.
+ */
+void
+mnl4c_ctx_commit(mnl4c_ctx_t *ctx, int level, off_t start, bool flush)
+{
+    mnl4c_minfo_t *minfo;
+    uint64_t cycles;
+    int prof_id;
+    bool sync;
+
+    minfo = NULL;
+    cycles = 0;
+    prof_id = ctx->prof_id;
+    if (MNUNLIKELY(ctx->profiling) &&
+        ctx->prof_id >= 0 &&
+        (minfo = array_get(&ctx->minfos, ctx->prof_id)) != NULL) {
+        cycles = MNL4C_CYCLES();
+        minfo->fmt_cycles += cycles - ctx->prof_start;
+    }
+
+    if (ndc.len > 0) {
+        ctx_ndc(ctx, start);
+    }
+
+    if (MNUNLIKELY(ctx->sanitize_escape || ctx->sanitize_maxlen > 0)) {
+        ctx_sanitize(ctx, start);
+    }
+
+    ++ctx->stats.nrecords;
+    stats_hist(ctx->stats.record_sz, SEOD(&ctx->bs) - start);
+
+    if (ARRAY_ELNUM(&ctx->sinks) > 0) {
+        ctx_fanout(ctx, level, start);
+    }
+
+    if (MNUNLIKELY(ctx->rec.hdr != NULL)) {
+        if (level <= ctx->rec.trigger ||
+            ctx->rec.sigcount != (unsigned)rec_sigcount) {
+            ctx->rec.sigcount = (unsigned)rec_sigcount;
+            start = rec_dump(ctx, start);
+            flush = true;
+        }
+    }
+
+    if (MNUNLIKELY(ctx->stats_interval > 0.0) &&
+        ctx->writer.data.file.curtm >= ctx->stats_next) {
+        ctx->stats_next = ctx->writer.data.file.curtm + ctx->stats_interval;
+        ctx_dump_stats(ctx);
+    }
+
+    if (start == 0) {
+        ctx->pending_tm = ctx->writer.data.file.curtm;
+        if (MNUNLIKELY(__atomic_load_n(&flusher_restart, __ATOMIC_RELAXED))) {
+            ctx->wpending |= MNL4C_WPENDING_FLUSHER;
+        }
+    } else if (ctx->flush_latency > 0.0 &&
+               ctx->writer.data.file.curtm - ctx->pending_tm >=
+                   ctx->flush_latency) {
+        flush = true;
+    }
+
+    sync = MNUNLIKELY(ctx->writer.data.file.durability ==
+                      MNL4C_DURABILITY_GROUP) && level <= ctx->sync_level;
+    if (flush || sync || SEOD(&ctx->bs) >= ctx->bsbufsz) {
+        ctx->wpending |= MNL4C_WPENDING_FLUSH;
+        /* the write is charged to the record once it is done */
+        if (minfo != NULL) {
+            ctx->wprof_id = prof_id;
+            ctx->wprof_start = cycles;
+            minfo = NULL;
+        }
+    }
+    if (sync) {
+        ctx->wpending |= MNL4C_WPENDING_SYNC;
+    }
+
+    /* before ctx->mtx is let go, another record may be profiled then */
+    if (minfo != NULL) {
+        minfo->write_cycles += MNL4C_CYCLES() - cycles;
+    }
+    ctx->prof_id = -1;
+}
+
+
+/*
+ * Store a record that was rejected by elevel.  Only the message body is
+ * rendered, the prefix is produced at dump time.  Called under ctx->mtx.
+ */
+static void
+ctx_vrecord(mnl4c_ctx_t *ctx, int level, int id, const char *fmt, va_list ap)
+{
+    char buf[MNL4C_RECORDER_MAXMSG];
+    int n;
+
+    if (ctx->rec.hdr == NULL) {
+        return;
+    }
+
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(buf)) {
+        n = sizeof(buf) - 1;
+    }
+
+    rec_push(ctx->rec.hdr, mnl4c_now_posix(), level, id, buf, n);
+
+    if (MNUNLIKELY(ctx->rec.sigcount != (unsigned)rec_sigcount)) {
+        ctx->rec.sigcount = (unsigned)rec_sigcount;
+        (void)rec_dump(ctx, SEOD(&ctx->bs));
+        ctx_flush(ctx);
+    }
+}
+
+
+void
+mnl4c_ctx_record(mnl4c_ctx_t *ctx, int level, int id, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    ctx_vrecord(ctx, level, id, fmt, ap);
+    va_end(ap);
+}
+
+
+/*
+ * The MNL4C_WRITE_ONCE_PRINTFLIKE_LT and _LT2 prefixes, with the
+ * throttled count as mnl4c_ctx_prefix() has it unless nthrottled is -1.
+ */
+static ssize_t
+ctx_prefix_lt(mnl4c_ctx_t *ctx,
+              const char *name,
+              int level,
+              bool lt2,
+              int nthrottled)
+{
+    struct tm *tm;
+    time_t now;
+    char now_str[32];
+    char nthrottled_str[24];
+
+    now = (time_t)ctx->writer.data.file.curtm;
+    tm = localtime(&now);
+    (void)strftime(now_str, sizeof(now_str), "%Y-%m-%dT%H:%M:%S", tm);
+    nthrottled_str[0] = '\0';
+    if (nthrottled >= 0) {
+        (void)snprintf(nthrottled_str,
+                       sizeof(nthrottled_str),
+                       "[%d]",
+                       nthrottled);
+    }
+    if (lt2) {
+        return bytestream_nprintf(&ctx->bs,
+                                  ctx->bsbufsz,
+                                  "%lf %s [%d] %s %s%s:\t",
+                                  ctx->writer.data.file.curtm,
+                                  now_str,
+                                  ctx->cache.pid,
+                                  name,
+                                  level_names[level],
+                                  nthrottled_str);
+    }
+    return bytestream_nprintf(&ctx->bs,
+                              ctx->bsbufsz,
+                              "%s [%d] %s %s%s:\t",
+                              now_str,
+                              ctx->cache.pid,
+                              name,
+                              level_names[level],
+                              nthrottled_str);
+}
+
+
+/*
+ * The out of line part of a slim call site: the same record as the
+ * inline MNL4C_WRITE_MAYBE_PRINTFLIKE (MNL4C_SITE_THROTTLE) or
+ * MNL4C_WRITE_ONCE_PRINTFLIKE families would render.  MNL4C_SITE_THROTTLE
+ * with MNL4C_SITE_LT or _LT2 is the throttled family with the datetime
+ * timestamps, see #timestamp-format in l4cdefgen.
+ */
+void
+mnl4c_ctx_vemit(mnl4c_ctx_t *ctx,
+                int level,
+                int id,
+                const char *name,
+                unsigned flags,
+                mnl4c_vwrite_t vwrite,
+                const char *fmt,
+                va_list ap)
+{
+    mnl4c_minfo_t *minfo;
+    ssize_t nwritten;
+    off_t start;
+    double curtm;
+    int nthrottled;
+
+    mnl4c_ctx_lock(ctx);
+    if ((minfo = array_get(&ctx->minfos, id)) == NULL) {
+        FAIL("array_get");
+    }
+    if (level < 0) {
+        level = minfo->flevel;
+    }
+    if (!mnl4c_ctx_allowed(ctx, level, id)) {
+        if (MNUNLIKELY(ctx->rec.rlevel >= level)) {
+            ctx_vrecord(ctx, level, id, fmt, ap);
+        }
+        goto end;
+    }
+
+    assert(ctx->writer.write != NULL);
+    curtm = mnl4c_now_posix();
+    nthrottled = -1;
+    if (flags & MNL4C_SITE_THROTTLE) {
+        if (ctx->writer.data.file.curtm + minfo->throttle_threshold > curtm) {
+            ++minfo->nthrottled;
+            ++ctx->stats.nthrottled;
+            ++minfo->nthrottled_total;
+            goto end;
+        }
+        nthrottled = minfo->nthrottled;
+    }
+    ctx->writer.data.file.curtm = curtm;
+
+    start = SEOD(&ctx->bs);
+    if (flags & (MNL4C_SITE_LT | MNL4C_SITE_LT2)) {
+        nwritten = ctx_prefix_lt(ctx,
+                                 name,
+                                 level,
+                                 flags & MNL4C_SITE_LT2,
+                                 nthrottled);
+    } else {
+        nwritten = mnl4c_ctx_prefix(ctx, id, name, level, nthrottled);
+    }
+    if (nwritten >= 0) {
+        if (vwrite != NULL) {
+            nwritten = vwrite(&ctx->bs, ctx->bsbufsz, ap);
+        } else {
+            nwritten = bytestream_vnprintf(&ctx->bs, ctx->bsbufsz, fmt, ap);
+        }
+        if (nwritten < 0) {
+            SEOD(&ctx->bs) = start;
+        }
+    }
+    if (nwritten < 0) {
+        bytestream_rewind(&ctx->bs);
+    } else {
+        SADVANCEPOS(&ctx->bs, -1);
+        (void)bytestream_cat(&ctx->bs, 1, "\n");
+        mnl4c_ctx_commit(ctx,
+                         level,
+                         start,
+                         !(flags & MNL4C_SITE_THROTTLE));
+    }
+    if (flags & MNL4C_SITE_THROTTLE) {
+        minfo->nthrottled = 0;
+    }
+
+end:
+    mnl4c_ctx_unlock(ctx);
+}
+
+
+void
+mnl4c_ctx_emit(mnl4c_ctx_t *ctx,
+               int level,
+               int id,
+               const char *name,
+               unsigned flags,
+               mnl4c_vwrite_t vwrite,
+               const char *fmt,
+               ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    mnl4c_ctx_vemit(ctx, level, id, name, flags, vwrite, fmt, ap);
+    va_end(ap);
+}
+
+
+/*
+ * Record builder
+ */
+struct _mnl4c_builder {
+    mnl4c_logger_t ld;
+    int level;
+    ssize_t bufsz;
+    bool active;
+    /* a fragment was lost, commit drops the record */
+    bool failed;
+    mnbytestream_t bs;
+};
+
+static pthread_key_t builder_key;
+static pthread_once_t builder_once = PTHREAD_ONCE_INIT;
+
+
+static void
+builder_destroy(void *o)
+{
+    mnl4c_builder_t *b = o;
+
+    if (b != NULL) {
+        bytestream_fini(&b->bs);
+        free(b);
+    }
+}
+
+
+static void
+builder_key_init(void)
+{
+    if (pthread_key_create(&builder_key, builder_destroy) != 0) {
+        FAIL("pthread_key_create");
+    }
+}
+
+
+static mnl4c_builder_t *
+builder_get(void)
+{
+    mnl4c_builder_t *b;
+
+    (void)pthread_once(&builder_once, builder_key_init);
+    if ((b = pthread_getspecific(builder_key)) == NULL) {
+        if ((b = malloc(sizeof(mnl4c_builder_t))) == NULL) {
+            FAIL("malloc");
+        }
+        b->ld = MNL4C_LOGGER_INVALID;
+        b->level = 0;
+        b->bufsz = MNL4C_DEFAULT_BUFSZ;
+        b->active = false;
+        b->failed = false;
+        bytestream_init(&b->bs, MNL4C_DEFAULT_BUFSZ);
+        if (pthread_setspecific(builder_key, b) != 0) {
+            FAIL("pthread_setspecific");
+        }
+    }
+    return b;
+}
+
+
+/*
+ * Begin a record in the calling thread's builder: the level check and the
+ * prefix snapshot are taken under the logger's lock, everything after
+ * that, including mnl4c_builder_printf(), runs with no lock held.  The
+ * record reaches the logger in one piece in mnl4c_builder_commit(), or is
+ * dropped by mnl4c_builder_abort().  Each thread has a single builder,
+ * and a start while it is open returns NULL, so a stale handle can never
+ * commit someone else's record.  Returns NULL if the record is rejected;
+ * all the builder calls accept NULL.
+ */
+mnl4c_builder_t *
+mnl4c_builder_start(mnl4c_logger_t ld,
+                    int level,
+                    int id,
+                    const char *name,
+                    const char *fmt,
+                    ...)
+{
+    mnl4c_ctx_t *ctx;
+    mnl4c_builder_t *b;
+    va_list ap;
+    double curtm;
+    pid_t pid;
+    ssize_t bufsz;
+    ssize_t nwritten;
+
+    b = builder_get();
+    if (b->active) {
+        return NULL;
+    }
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        return NULL;
+    }
+    mnl4c_ctx_lock(ctx);
+    if (!mnl4c_ctx_allowed(ctx, level, id)) {
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        return NULL;
+    }
+    /* formatting time is not attributed to the message */
+    ctx->prof_id = -1;
+    curtm = mnl4c_now_posix();
+    ctx->writer.data.file.curtm = curtm;
+    pid = ctx->cache.pid;
+    bufsz = ctx->bsbufsz;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    b->ld = ld;
+    b->level = level;
+    b->bufsz = bufsz;
+    b->failed = false;
+    bytestream_rewind(&b->bs);
+    SEOD(&b->bs) = 0;
+
+    if (mnl4c_bs_prefix(&b->bs, curtm, pid, name, level_names[level], -1) < 0) {
+        return NULL;
+    }
+    va_start(ap, fmt);
+    nwritten = bytestream_vnprintf(&b->bs, bufsz, fmt, ap);
+    va_end(ap);
+    if (nwritten < 0) {
+        return NULL;
+    }
+    b->active = true;
+    return b;
+}
+
+
+int
+mnl4c_builder_printf(mnl4c_builder_t *b, const char *fmt, ...)
+{
+    va_list ap;
+    ssize_t nwritten;
+
+    if (b == NULL || !b->active || b->failed) {
+        return -1;
+    }
+    va_start(ap, fmt);
+    nwritten = bytestream_vnprintf(&b->bs, b->bufsz, fmt, ap);
+    va_end(ap);
+    if (nwritten < 0) {
+        b->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Append the finished record to the logger under a single lock hold.
+ * The logger is looked up again, so a record whose logger was closed in
+ * the meantime is dropped.
+ */
+int
+mnl4c_builder_commit(mnl4c_builder_t *b)
+{
+    mnl4c_ctx_t *ctx;
+    off_t start;
+
+    if (b == NULL || !b->active) {
+        return -1;
+    }
+    b->active = false;
+    if (b->failed) {
+        return -1;
+    }
+    if ((ctx = mnl4c_get_ctx(b->ld)) == NULL) {
+        return -1;
+    }
+    (void)bytestream_cat(&b->bs, 1, "\n");
+    mnl4c_ctx_lock(ctx);
+    start = SEOD(&ctx->bs);
+    if (bytestream_cat(&ctx->bs, SEOD(&b->bs), SDATA(&b->bs, 0)) < 0) {
+        SEOD(&ctx->bs) = start;
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        return -1;
+    }
+    mnl4c_ctx_commit(ctx, b->level, start, true);
+    mnl4c_ctx_unlock(ctx);
+    return 0;
+}
+
+
+void
+mnl4c_builder_abort(mnl4c_builder_t *b)
+{
+    if (b != NULL) {
+        b->active = false;
+    }
+}
+
+
+/*
+ * Write the pending buffer, the payload and the record's newline with a
+ * single writev(2), the payload is never copied.  Only taken by plain
+ * file loggers that have nothing else to do with the record: no sinks,
+ * recorder or sanitization.  Like ctx_flush_unlocked(), the buffer is
+ * swapped with the spare one under flush_mtx and written with ctx->mtx
+ * released; the rest of what mnl4c_ctx_commit() does for a record is
+ * done once ctx->mtx is taken again.  Called and returns under
+ * ctx->mtx.
+ */
+static void
+ctx_write_payload(mnl4c_ctx_t *ctx,
+                  int level,
+                  off_t start,
+                  const void *buf,
+                  size_t sz)
+{
+    mnbytestream_t tmp;
+    struct iovec iov[3];
+    uint64_t before, elapsed;
+    int i;
+
+    ++ctx->stats.nrecords;
+    stats_hist(ctx->stats.record_sz, SEOD(&ctx->bs) - start + sz + 1);
+
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    tmp = ctx->wbs;
+    ctx->wbs = ctx->bs;
+    ctx->bs = tmp;
+    ctx->stats.nbytes += SEOD(&ctx->wbs) + sz + 1;
+    ++ctx->stats.nflushes;
+    ctx->writer.data.file.wcurtm = ctx->writer.data.file.curtm;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    iov[0].iov_base = SDATA(&ctx->wbs, 0);
+    iov[0].iov_len = SEOD(&ctx->wbs);
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = sz;
+    iov[2].iov_base = "\n";
+    iov[2].iov_len = 1;
+
+    before = mono_ns();
+    ++ctx->writer.data.file.wgen;
+    i = 0;
+    while (i < 3) {
+        ssize_t nwritten;
+
+        if (MNUNLIKELY(
+            (nwritten = writev(ctx->writer.data.file.fd,
+                               iov + i,
+                               3 - i)) <= 0)) {
+            if (nwritten < 0 && errno == EINTR) {
+                continue;
+            }
+            TRACE("writev failed");
+            ++ctx->stats.nwrite_errors;
+            break;
+        }
+        ctx->writer.data.file.cursz += nwritten;
+        /* short write, skip what went out */
+        for (; i < 3 && (size_t)nwritten >= iov[i].iov_len; ++i) {
+            nwritten -= iov[i].iov_len;
+        }
+        if (i < 3) {
+            iov[i].iov_base = (char *)iov[i].iov_base + nwritten;
+            iov[i].iov_len -= nwritten;
+        }
+    }
+    bytestream_rewind(&ctx->wbs);
+
+    if (writer_file_check_rollover(&ctx->writer) != 0) {
+        TRACE("failed to roll over");
+    }
+    elapsed = mono_ns() - before;
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+
+    mnl4c_ctx_lock(ctx);
+    stats_hist(ctx->stats.flush_ns, elapsed);
+    if (MNUNLIKELY(ctx->stats_interval > 0.0) &&
+        ctx->writer.data.file.curtm >= ctx->stats_next) {
+        ctx->stats_next = ctx->writer.data.file.curtm + ctx->stats_interval;
+        if (SEOD(&ctx->bs) == 0) {
+            ctx->pending_tm = ctx->writer.data.file.curtm;
+        }
+        ctx_dump_stats(ctx);
+    }
+    if (MNUNLIKELY(ctx->writer.data.file.durability ==
+                   MNL4C_DURABILITY_GROUP) && level <= ctx->sync_level) {
+        ctx->wpending |= MNL4C_WPENDING_SYNC;
+    }
+}
+
+
+/*
+ * Log fmt followed by sz bytes at buf, see <MOD>_LOG_PAYLOAD().  The
+ * payload is not subject to the logger's buffer size.  Raw payloads are
+ * written straight from buf when the logger allows, otherwise they are
+ * appended to the record once; MNL4C_PAYLOAD_HEX and MNL4C_PAYLOAD_BASE64
+ * encode into the record buffer in the same pass.  Nothing refers to buf
+ * after the call returns.
+ */
+int
+mnl4c_write_payload(mnl4c_logger_t ld,
+                    int level,
+                    int id,
+                    const char *name,
+                    const void *buf,
+                    size_t sz,
+                    unsigned enc,
+                    const char *fmt,
+                    ...)
+{
+    mnl4c_ctx_t *ctx;
+    va_list ap;
+    off_t start;
+    ssize_t nwritten;
+    int res;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_WRITE_PAYLOAD + 1);
+    }
+
+    res = 0;
+    mnl4c_ctx_lock(ctx);
+    if (!mnl4c_ctx_allowed(ctx, level, id)) {
+        goto end;
+    }
+    ctx->writer.data.file.curtm = mnl4c_now_posix();
+    start = SEOD(&ctx->bs);
+    if (mnl4c_ctx_prefix(ctx, id, name, level, -1) < 0) {
+        goto err;
+    }
+    va_start(ap, fmt);
+    nwritten = bytestream_vnprintf(&ctx->bs, ctx->bsbufsz, fmt, ap);
+    va_end(ap);
+    if (nwritten < 0) {
+        goto err;
+    }
+
+    switch (enc) {
+    case MNL4C_PAYLOAD_RAW:
+        if (ctx->writer.write == mnl4c_write_file &&
+            ARRAY_ELNUM(&ctx->sinks) == 0 &&
+            ctx->rec.hdr == NULL &&
+            !ctx->sanitize_escape &&
+            ctx->sanitize_maxlen == 0) {
+            ctx->prof_id = -1;
+            if (ndc.len > 0) {
+                ctx_ndc(ctx, start);
+            }
+            ctx_write_payload(ctx, level, start, buf, sz);
+            goto end;
+        }
+        nwritten = bytestream_cat(&ctx->bs, sz, buf);
+        break;
+
+    case MNL4C_PAYLOAD_HEX:
+        nwritten = mnl4c_bs_hexdump(&ctx->bs, buf, sz);
+        break;
+
+    case MNL4C_PAYLOAD_BASE64:
+        nwritten = mnl4c_bs_base64(&ctx->bs, buf, sz);
+        break;
+
+    default:
+        nwritten = -1;
+    }
+    if (nwritten < 0) {
+        goto err;
+    }
+    (void)bytestream_cat(&ctx->bs, 1, "\n");
+    mnl4c_ctx_commit(ctx, level, start, false);
+
+end:
+    mnl4c_ctx_unlock(ctx);
+    return res;
+
+err:
+    SEOD(&ctx->bs) = start;
+    res = MNL4C_WRITE_PAYLOAD + 2;
+    goto end;
+}
+
+
+/*
+ * Jump label sections, see mnl4c_jump_t.  jump_mtx serializes patching.
+ */
+typedef struct _mnl4c_jumps {
+    mnl4c_jump_t *start;
+    mnl4c_jump_t *stop;
+} mnl4c_jumps_t;
+
+static pthread_mutex_t jump_mtx = PTHREAD_MUTEX_INITIALIZER;
+/* mnl4c_jumps_t */
+static mnarray_t jumps;
+static bool jumps_ready = false;
+
+
+/*
+ * Whether any open logger enables or records the site's message at the
+ * site's level, or profiles it, so that its rejects get counted.  Sites
+ * of a library that has no ids yet, or whose level is not known, are
+ * always on.  Under jump_mtx, takes each ctx->mtx.
+ */
+static bool
+jump_enabled(mnl4c_jump_t *j)
+{
+    size_t i;
+    int id;
+
+    if (j->level < -1 || *j->base < 0) {
+        return true;
+    }
+    id = *j->base + j->idx;
+    for (i = 0; i < ARRAY_ELNUM(&ctxes); ++i) {
+        mnl4c_ctx_t *ctx;
+        mnl4c_minfo_t *minfo;
+        bool on;
+
+        if ((ctx = *ARRAY_GET(mnl4c_ctx_t *, &ctxes, i)) == NULL) {
+            continue;
+        }
+        on = false;
+        (void)pthread_mutex_lock(&ctx->mtx);
+        if ((minfo = array_get(&ctx->minfos, id)) != NULL &&
+            minfo->id == id) {
+            int level;
+
+            level = j->level < 0 ? minfo->flevel : j->level;
+            on = minfo->elevel >= level ||
+                 ctx->rec.rlevel >= level ||
+                 ctx->profiling;
+        }
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        if (on) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__)) &&     \
+    defined(__NR_membarrier)
+/*
+ * Serialize every running thread of the process, so that none of them
+ * still executes the instructions a site had before the last store.
+ * Registers for it on first use, and again in a forked child.
+ */
+static int
+jump_sync_core(void)
+{
+    if (syscall(__NR_membarrier,
+                MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE,
+                0) == 0) {
+        return 0;
+    }
+    if (syscall(__NR_membarrier,
+                MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE,
+                0) != 0) {
+        return -1;
+    }
+    return (int)syscall(__NR_membarrier,
+                        MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE,
+                        0);
+}
+
+
+#ifdef __x86_64__
+/*
+ * The site being patched, and where a thread that hits its int3 goes.
+ */
+static uintptr_t jump_poke_code = 0;
+static uintptr_t jump_poke_resume = 0;
+static struct sigaction jump_trap_old;
+
+
+/*
+ * SIGTRAP handler for the int3 jump_patch() puts on a site.  A thread
+ * that hits it is sent to where the site goes once patched.  If the int3
+ * is already gone, replaced with the first byte of the jmp or the nop,
+ * the thread runs the site again.  Anything else is for the previous
+ * handler.  Async-signal-safe.
+ */
+static void
+jump_trap(int sig, siginfo_t *info, void *uctx)
+{
+    ucontext_t *uc = uctx;
+    uintptr_t pc;
+
+    pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP] - 1;
+    if (info->si_code == SI_KERNEL) {
+        unsigned char op;
+
+        if (pc == __atomic_load_n(&jump_poke_code, __ATOMIC_ACQUIRE)) {
+            uc->uc_mcontext.gregs[REG_RIP] =
+                (greg_t)__atomic_load_n(&jump_poke_resume, __ATOMIC_RELAXED);
+            return;
+        }
+        op = __atomic_load_n((unsigned char *)pc, __ATOMIC_RELAXED);
+        if (op == 0xe9 || op == 0x0f) {
+            uc->uc_mcontext.gregs[REG_RIP] = (greg_t)pc;
+            return;
+        }
+    }
+    if (jump_trap_old.sa_flags & SA_SIGINFO) {
+        jump_trap_old.sa_sigaction(sig, info, uctx);
+    } else if (jump_trap_old.sa_handler == SIG_DFL) {
+        /*
+         * take the default action: an int3 runs again, any other trap is
+         * raised again and delivered once this handler returns; the next
+         * jump_patch() installs jump_trap() anew
+         */
+        (void)sigaction(SIGTRAP, &jump_trap_old, NULL);
+        if (info->si_code == SI_KERNEL) {
+            uc->uc_mcontext.gregs[REG_RIP] = (greg_t)pc;
+        } else {
+            (void)raise(sig);
+        }
+    } else if (jump_trap_old.sa_handler != SIG_IGN) {
+        jump_trap_old.sa_handler(sig);
+    }
+}
+
+
+/*
+ * Make sure jump_trap() handles SIGTRAP before a site is patched: it
+ * may have put the previous handler back, or the application may have
+ * installed its own since.  The handler found becomes the one jump_trap()
+ * passes other traps on to.  Under jump_mtx.
+ */
+static int
+jump_trap_install(void)
+{
+    struct sigaction sa, cur;
+
+    if (sigaction(SIGTRAP, NULL, &cur) != 0) {
+        return -1;
+    }
+    if ((cur.sa_flags & SA_SIGINFO) && cur.sa_sigaction == jump_trap) {
+        return 0;
+    }
+    jump_trap_old = cur;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = jump_trap;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    (void)sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGTRAP, &sa, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+
+/*
+ * The protection of the mapping that holds addr, as /proc/self/maps has
+ * it, or -1.
+ */
+static int
+jump_page_prot(uintptr_t addr)
+{
+    FILE *fp;
+    char line[256];
+    bool bol;
+    int prot;
+
+    if ((fp = fopen("/proc/self/maps", "r")) == NULL) {
+        return -1;
+    }
+    prot = -1;
+    bol = true;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long start, end;
+        char perms[5];
+        bool match;
+
+        /* the rest of a line longer than the buffer */
+        match = bol &&
+                sscanf(line, "%lx-%lx %4s", &start, &end, perms) == 3 &&
+                addr >= start && addr < end;
+        bol = strchr(line, '\n') != NULL;
+        if (match) {
+            prot = (perms[0] == 'r' ? PROT_READ : 0) |
+                   (perms[1] == 'w' ? PROT_WRITE : 0) |
+                   (perms[2] == 'x' ? PROT_EXEC : 0);
+            break;
+        }
+    }
+    fclose(fp);
+    return prot;
+}
+
+
+/*
+ * Rewrite a site that other threads may be running, the way the
+ * kernel's text_poke_bp() does it.  On x86-64 the first byte of the site
+ * becomes an int3, then the other four bytes are written, then the first
+ * one, and every step is followed by jump_sync_core(); jump_trap() takes
+ * care of a thread that hits the int3 meanwhile.  On aarch64 a B and a
+ * NOP may be swapped with a single store, jump_sync_core() then makes
+ * every thread see it.  A site is not patched where membarrier's sync
+ * core commands are missing (Linux before 4.16), or where the code page
+ * cannot be made writable; it gets its own protection back after.  Under
+ * jump_mtx.
+ */
+static int
+jump_patch(mnl4c_jump_t *j, bool on)
+{
+    static long pagesz = 0;
+    uintptr_t page;
+    int prot;
+
+    if (pagesz == 0) {
+        pagesz = sysconf(_SC_PAGESIZE);
+    }
+    page = j->code & ~(uintptr_t)(pagesz - 1);
+#ifdef __x86_64__
+    /* within one page, see MNL4C_JUMP_INSN */
+    if ((j->code & 7) > 3) {
+        return -1;
+    }
+    if (jump_trap_install() != 0) {
+        return -1;
+    }
+#endif
+    if (jump_sync_core() != 0) {
+        return -1;
+    }
+    if ((prot = jump_page_prot(j->code)) < 0 ||
+        mprotect((void *)page, pagesz, prot | PROT_WRITE) != 0) {
+        return -1;
+    }
+#ifdef __x86_64__
+    {
+        unsigned char *code, insn[5];
+        int32_t rel;
+        int i;
+
+        code = (unsigned char *)j->code;
+        if (on) {
+            rel = (int32_t)(j->target - (j->code + 5));
+            insn[0] = 0xe9;
+            memcpy(insn + 1, &rel, sizeof(rel));
+        } else {
+            /* nopl 0x0(%rax,%rax,1) */
+            memcpy(insn, "\x0f\x1f\x44\x00\x00", 5);
+        }
+        __atomic_store_n(&jump_poke_resume,
+                         on ? j->target : j->code + 5,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&jump_poke_code, j->code, __ATOMIC_RELEASE);
+        __atomic_store_n(&code[0], 0xcc, __ATOMIC_RELAXED);
+        (void)jump_sync_core();
+        for (i = 1; i < 5; ++i) {
+            __atomic_store_n(&code[i], insn[i], __ATOMIC_RELAXED);
+        }
+        (void)jump_sync_core();
+        __atomic_store_n(&code[0], insn[0], __ATOMIC_RELAXED);
+        (void)jump_sync_core();
+        __atomic_store_n(&jump_poke_code, 0, __ATOMIC_RELEASE);
+    }
+#else
+    {
+        uint32_t insn;
+
+        if (on) {
+            insn = 0x14000000u |
+                   ((uint32_t)((intptr_t)(j->target - j->code) >> 2) &
+                    0x03ffffffu);
+        } else {
+            insn = 0xd503201fu;
+        }
+        __atomic_store_n((uint32_t *)j->code, insn, __ATOMIC_SEQ_CST);
+        __builtin___clear_cache((char *)j->code, (char *)j->code + 4);
+        (void)jump_sync_core();
+    }
+#endif
+    (void)mprotect((void *)page, pagesz, prot);
+    return 0;
+}
+#else
+static int
+jump_patch(UNUSED mnl4c_jump_t *j, UNUSED bool on)
+{
+    return -1;
+}
+#endif
+
+
+static void
+jump_update(void)
+{
+    mnl4c_jumps_t *js;
+    mnarray_iter_t it;
+
+    (void)pthread_mutex_lock(&jump_mtx);
+    if (!jumps_ready) {
+        goto end;
+    }
+    for (js = array_first(&jumps, &it);
+         js != NULL;
+         js = array_next(&jumps, &it)) {
+        mnl4c_jump_t *j;
+
+        for (j = js->start; j < js->stop; ++j) {
+            bool on;
+
+            on = jump_enabled(j);
+            if (on != (bool)j->enabled && jump_patch(j, on) == 0) {
+                j->enabled = on;
+            }
+        }
+    }
+
+end:
+    (void)pthread_mutex_unlock(&jump_mtx);
+}
+
+
+/*
+ * Called by the constructor of the generated source with the bounds of
+ * the mnl4c_jump section of the object it was linked into.
+ */
+void
+mnl4c_jump_add(mnl4c_jump_t *start, mnl4c_jump_t *stop)
+{
+    mnl4c_jumps_t *js;
+    mnarray_iter_t it;
+
+    if (start == NULL || start >= stop) {
+        return;
+    }
+    (void)pthread_mutex_lock(&jump_mtx);
+    if (!jumps_ready) {
+        if (MNUNLIKELY(array_init(&jumps,
+                                  sizeof(mnl4c_jumps_t),
+                                  0,
+                                  NULL,
+                                  NULL) != 0)) {
+            FAIL("array_init");
+        }
+        jumps_ready = true;
+    }
+    for (js = array_first(&jumps, &it);
+         js != NULL;
+         js = array_next(&jumps, &it)) {
+        if (js->start == start) {
+            (void)pthread_mutex_unlock(&jump_mtx);
+            return;
+        }
+    }
+    if (MNUNLIKELY((js = array_incr(&jumps)) == NULL)) {
+        FAIL("array_incr");
+    }
+    js->start = start;
+    js->stop = stop;
+    (void)pthread_mutex_unlock(&jump_mtx);
+    jump_update();
+}
+
+
+/*
+ * Keep records at level or more severe that are rejected by elevel in a
+ * ring of sz bytes, and dump them when a record at trigger or more severe
+ * is written.  If path is not NULL, the ring is mmap'ed from that file and
+ * its previous contents are preserved, so that records stored before a
+ * crash can be dumped later.  sz of zero disables the recorder.
+ */
+int
+mnl4c_set_recorder(mnl4c_logger_t ld,
+                   int level,
+                   int trigger,
+                   size_t sz,
+                   const char *path)
+{
+    mnl4c_ctx_t *ctx;
+    mnl4c_recorder_t rec;
+    int res;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_RECORDER + 1);
+    }
+
+    res = 0;
+    rec_init(&rec);
+    if (sz > 0) {
+        sz = REC_ALIGN(sz);
+        if (sz < 2 * REC_ALIGN(sizeof(mnl4c_recorder_entry_t) +
+                               MNL4C_RECORDER_MAXMSG)) {
+            TRRET(MNL4C_SET_RECORDER + 2);
+        }
+        rec.rlevel = level;
+        rec.trigger = trigger;
+        rec.mapsz = sizeof(mnl4c_recorder_hdr_t) + sz;
+        rec.sigcount = (unsigned)rec_sigcount;
+
+        if (path != NULL) {
+            if ((rec.fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+                TRRET(MNL4C_SET_RECORDER + 3);
+            }
+            if (ftruncate(rec.fd, rec.mapsz) != 0) {
+                (void)close(rec.fd);
+                TRRET(MNL4C_SET_RECORDER + 4);
+            }
+            if ((rec.hdr = mmap(NULL,
+                                rec.mapsz,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED,
+                                rec.fd,
+                                0)) == MAP_FAILED) {
+                (void)close(rec.fd);
+                TRRET(MNL4C_SET_RECORDER + 5);
+            }
+        } else {
+            if ((rec.hdr = malloc(rec.mapsz)) == NULL) {
+                FAIL("malloc");
+            }
+        }
+
+        if (rec.hdr->magic != MNL4C_RECORDER_MAGIC ||
+            rec.hdr->sz != sz ||
+            rec.hdr->head < rec.hdr->tail ||
+            rec.hdr->head - rec.hdr->tail > sz) {
+            rec.hdr->sz = sz;
+            rec.hdr->head = 0;
+            rec.hdr->tail = 0;
+            rec.hdr->magic = MNL4C_RECORDER_MAGIC;
+        }
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    rec_fini(&ctx->rec);
+    ctx->rec.trigger = rec.trigger;
+    ctx->rec.hdr = rec.hdr;
+    ctx->rec.mapsz = rec.mapsz;
+    ctx->rec.fd = rec.fd;
+    ctx->rec.sigcount = rec.sigcount;
+    /* mnl4c_ctx_enabled() reads it without the lock */
+    __atomic_store_n(&ctx->rec.rlevel, rec.rlevel, __ATOMIC_RELAXED);
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    jump_update();
+
+    return res;
+}
+
+
+int
+mnl4c_recorder_dump(mnl4c_logger_t ld)
+{
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        return -1;
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    if (ctx->rec.hdr != NULL) {
+        (void)rec_dump(ctx, SEOD(&ctx->bs));
+        if (SEOD(&ctx->bs) > 0) {
+            ctx_flush(ctx);
+        }
+    }
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    return 0;
+}
+
+
+static void
+rec_sighandler(UNUSED int signo)
+{
+    ++rec_sigcount;
+}
+
+
+/*
+ * Request a dump of all flight recorders on signo.  The dump is performed
+ * by the next record logged through each logger.
+ */
+int
+mnl4c_recorder_dump_on_signal(int signo)
+{
+    struct sigaction sa;
+
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = rec_sighandler;
+    sa.sa_flags = SA_RESTART;
+    (void)sigemptyset(&sa.sa_mask);
+    return sigaction(signo, &sa, NULL);
+}
+
+
+/*
+ * Switch a file logger to the shared-memory ring: all processes forked
+ * after this call write into the ring, and whichever of them finds the
+ * ring unattended drains it into the file, rotating as needed.
+ */
+int
+mnl4c_set_shmring(mnl4c_logger_t ld, size_t sz)
+{
+    mnl4c_ctx_t *ctx;
+    mnl4c_shmring_hdr_t *hdr;
+    size_t mapsz;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_SHMRING + 1);
+    }
+    if (ctx->ty != MNL4C_OPEN_FILE ||
+        (ctx->writer.data.file.flags &
+         (MNL4C_OPEN_FLOCK | MNL4C_OPEN_DIRECT))) {
+        TRRET(MNL4C_SET_SHMRING + 2);
+    }
+    if (sz < MNL4C_SHMRING_MINSZ) {
+        TRRET(MNL4C_SET_SHMRING + 3);
+    }
+    if (ctx->writer.data.file.shm != NULL) {
+        TRRET(MNL4C_SET_SHMRING + 4);
+    }
+
+    sz = REC_ALIGN(sz);
+    mapsz = sizeof(mnl4c_shmring_hdr_t) + sz;
+    if ((hdr = mmap(NULL,
+                    mapsz,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANON,
+                    -1,
+                    0)) == MAP_FAILED) {
+        TRRET(MNL4C_SET_SHMRING + 5);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    if (SEOD(&ctx->bs) > 0) {
+        ctx_flush(ctx);
+    }
+    hdr->sz = sz;
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    hdr->cursz = ctx->writer.data.file.cursz;
+    hdr->starttm = ctx->writer.data.file.starttm;
+    ctx->writer.data.file.shm = hdr;
+    ctx->writer.data.file.shmsz = mapsz;
+    ctx->writer.data.file.shmgen = 0;
+    ctx->writer.write = mnl4c_write_shmring;
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    return 0;
+}
+
+
+/*
+ * Drain the ring on behalf of all producers, meant for a supervising
+ * process that doesn't log much itself.
+ */
+int
+mnl4c_shmring_drain(mnl4c_logger_t ld)
+{
+    int res;
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SHMRING_DRAIN + 1);
+    }
+    if (ctx->writer.data.file.shm == NULL) {
+        TRRET(MNL4C_SHMRING_DRAIN + 2);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    if (SEOD(&ctx->bs) > 0) {
+        ctx_flush(ctx);
+        res = 0;
+    } else {
+        (void)pthread_mutex_lock(&ctx->flush_mtx);
+        res = shmring_drain(ctx) == 0 ? 0 : MNL4C_SHMRING_DRAIN + 3;
+        (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    }
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    return res;
+}
+
+
+/*
+ * Count cycles spent formatting and writing each message.
+ */
+int
+mnl4c_set_profiling(mnl4c_logger_t ld, bool profiling)
+{
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_PROFILING + 1);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    /* mnl4c_ctx_enabled() reads it without the lock */
+    __atomic_store_n(&ctx->profiling, profiling, __ATOMIC_RELAXED);
+    ctx->prof_id = -1;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    jump_update();
+
+    return 0;
+}
+
+
+static int
+_minfo_cost_cmp(mnl4c_minfo_t **a, mnl4c_minfo_t **b)
+{
+    uint64_t ca, cb;
+
+    ca = (*a)->fmt_cycles + (*a)->write_cycles;
+    cb = (*b)->fmt_cycles + (*b)->write_cycles;
+    if (ca != cb) {
+        return ca > cb ? -1 : 1;
+    }
+    if ((*a)->ncalls != (*b)->ncalls) {
+        return (*a)->ncalls > (*b)->ncalls ? -1 : 1;
+    }
+    return (*a)->id - (*b)->id;
+}
+
+
+/*
+ * Write a table of all messages to fd, the most expensive first.
+ */
+int
+mnl4c_profile_report(mnl4c_logger_t ld, int fd)
+{
+    mnl4c_ctx_t *ctx;
+    mnl4c_minfo_t *minfo;
+    mnl4c_minfo_t **sorted;
+    mnarray_iter_t it;
+    size_t i, n;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_PROFILE_REPORT + 1);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx_levels_collect(ctx);
+    if ((sorted = malloc(sizeof(mnl4c_minfo_t *) *
+                         (ARRAY_ELNUM(&ctx->minfos) + 1))) == NULL) {
+        FAIL("malloc");
+    }
+    n = 0;
+    for (minfo = array_first(&ctx->minfos, &it);
+         minfo != NULL;
+         minfo = array_next(&ctx->minfos, &it)) {
+        if (minfo->name != NULL) {
+            sorted[n++] = minfo;
+        }
+    }
+    qsort(sorted,
+          n,
+          sizeof(mnl4c_minfo_t *),
+          (int (*)(const void *, const void *))_minfo_cost_cmp);
+
+    (void)dprintf(fd,
+                  "%14s %10s %10s %10s %10s %14s %14s %10s %s\n",
+                  "cycles",
+                  "calls",
+                  "emitted",
+                  "rejected",
+                  "throttled",
+                  "fmt_cycles",
+                  "write_cycles",
+                  "per_record",
+                  "name");
+    for (i = 0; i < n; ++i) {
+        uint64_t nemitted;
+        uint64_t cycles;
+
+        minfo = sorted[i];
+        nemitted = minfo->ncalls - minfo->nrejected - minfo->nthrottled_total;
+        cycles = minfo->fmt_cycles + minfo->write_cycles;
+        (void)dprintf(fd,
+                      "%14ju %10ju %10ju %10ju %10ju %14ju %14ju %10ju %s\n",
+                      (uintmax_t)cycles,
+                      (uintmax_t)minfo->ncalls,
+                      (uintmax_t)nemitted,
+                      (uintmax_t)minfo->nrejected,
+                      (uintmax_t)minfo->nthrottled_total,
+                      (uintmax_t)minfo->fmt_cycles,
+                      (uintmax_t)minfo->write_cycles,
+                      (uintmax_t)(nemitted > 0 ? cycles / nemitted : 0),
+                      BCDATA(minfo->name));
+    }
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    free(sorted);
+
+    return 0;
+}
+
+
+int
+mnl4c_get_stats(mnl4c_logger_t ld, mnl4c_stats_t *stats)
+{
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_GET_STATS + 1);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx_get_stats(ctx, stats);
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    return 0;
+}
+
+
+/*
+ * Write the stats through the logger itself, and flush.
+ */
+int
+mnl4c_dump_stats(mnl4c_logger_t ld)
+{
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_DUMP_STATS + 1);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx_dump_stats(ctx);
+    ctx_flush(ctx);
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    return 0;
+}
+
+
+/*
+ * Dump the stats along with the first record committed every interval
+ * seconds, 0.0 to disable.
+ */
+int
+mnl4c_set_stats_interval(mnl4c_logger_t ld, double interval)
+{
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_STATS_INTERVAL + 1);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx->stats_interval = interval;
+    ctx->stats_next = mnl4c_now_posix() + interval;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    return 0;
+}
+
+
+/*
+ * Keep every record on one line: escape \n, \r, \t, \\ and other control
+ * bytes in the message body as C escapes (\xHH).  Bodies longer than
+ * maxlen bytes once escaped are cut and marked, 0 for no limit.
+ */
+int
+mnl4c_set_sanitize(mnl4c_logger_t ld, bool escape, size_t maxlen)
+{
+    mnl4c_ctx_t *ctx;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_SANITIZE + 1);
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx->sanitize_escape = escape;
+    ctx->sanitize_maxlen = maxlen;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+
+    return 0;
+}
+
+
+/*
+ * Write out records at most latency seconds after the first of them was
+ * buffered, even if no further record arrives.  Producers check the
+ * bound on every record; for a quiet logger a library thread does it,
+ * waking every latency / 2 and skipping the logger if it is busy.  A
+ * latency of 0 turns it off.
+ */
+int
+mnl4c_set_flush_latency(mnl4c_logger_t ld, double latency)
+{
+    mnl4c_ctx_t *ctx;
+    int res;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_FLUSH_LATENCY + 1);
+    }
+    if (latency < 0.0) {
+        TRRET(MNL4C_SET_FLUSH_LATENCY + 2);
+    }
+
+    res = 0;
+    (void)pthread_mutex_lock(&flusher_mtx);
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx->flush_latency = latency;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    if (flusher_update(ctx) != 0) {
+        (void)pthread_mutex_lock(&ctx->mtx);
+        ctx->flush_latency = 0.0;
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        res = MNL4C_SET_FLUSH_LATENCY + 3;
+    }
+    (void)pthread_mutex_unlock(&flusher_mtx);
+
+    return res;
+}
+
+
+/*
+ * Durability of file loggers.  MNL4C_DURABILITY_PERIODIC writes out and
+ * fdatasync()s the file every interval seconds from the flusher thread.
+ * With MNL4C_DURABILITY_GROUP, a record at level or more severe does not
+ * return until an fdatasync() covering it has completed; concurrent
+ * records share one.  Either way the file is synced before it is rolled
+ * over.  MNL4C_DURABILITY_NONE leaves it to the OS.
+ */
+int
+mnl4c_set_durability(mnl4c_logger_t ld, int mode, int level, double interval)
+{
+    mnl4c_ctx_t *ctx;
+    int res;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_SET_DURABILITY + 1);
+    }
+    if ((ctx->ty & MNL4C_OPEN_TY) != MNL4C_OPEN_FILE ||
+        ctx->writer.data.file.shm != NULL) {
+        TRRET(MNL4C_SET_DURABILITY + 2);
+    }
+    if ((mode != MNL4C_DURABILITY_NONE &&
+         mode != MNL4C_DURABILITY_PERIODIC &&
+         mode != MNL4C_DURABILITY_GROUP) ||
+        (mode == MNL4C_DURABILITY_PERIODIC && interval <= 0.0)) {
+        TRRET(MNL4C_SET_DURABILITY + 3);
+    }
+
+    res = 0;
+    (void)pthread_mutex_lock(&flusher_mtx);
+    (void)pthread_mutex_lock(&ctx->mtx);
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    ctx->writer.data.file.durability = mode;
+    /* the staged tail block is synced from now on */
+    if (mode != MNL4C_DURABILITY_NONE &&
+        ctx->writer.data.file.dbuf != NULL &&
+        ctx->writer.data.file.fd >= 0 &&
+        direct_finish(&ctx->writer) != 0) {
+        ++ctx->stats.nwrite_errors;
+    }
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    ctx->sync_level = level;
+    ctx->sync_interval = interval;
+    ctx->sync_next = mnl4c_now_posix() + interval;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    if (flusher_update(ctx) != 0) {
+        (void)pthread_mutex_lock(&ctx->mtx);
+        (void)pthread_mutex_lock(&ctx->flush_mtx);
+        ctx->writer.data.file.durability = MNL4C_DURABILITY_NONE;
+        (void)pthread_mutex_unlock(&ctx->flush_mtx);
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        res = MNL4C_SET_DURABILITY + 4;
+    }
+    (void)pthread_mutex_unlock(&flusher_mtx);
+
+    return res;
+}
+
+
+int
+mnl4c_set_bufsz(mnl4c_logger_t ld, ssize_t sz)
+{
+    mnl4c_ctx_t **pctx;
+
+    mnl4c_ctx_t *ctx;
+    mnbytestream_t bs;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL || sz <= 0) {
+        return -1;
+    }
+    ctx = *pctx;
+
+    /*
+     * The records pending in the buffer move over to the new one, the
+     * spare is empty once no write is in flight.
+     */
+    mnl4c_ctx_lock(ctx);
+    (void)pthread_mutex_lock(&ctx->flush_mtx);
+    bytestream_init(&bs, sz);
+    if (SEOD(&ctx->bs) > 0) {
+        (void)bytestream_cat(&bs, SEOD(&ctx->bs), SDATA(&ctx->bs, 0));
+    }
+    bytestream_fini(&ctx->bs);
+    ctx->bs = bs;
+    bytestream_fini(&ctx->wbs);
+    bytestream_init(&ctx->wbs, sz);
+    ctx->bsbufsz = sz;
+    (void)pthread_mutex_unlock(&ctx->flush_mtx);
+    if (SEOD(&ctx->bs) >= ctx->bsbufsz) {
+        ctx_flush(ctx);
+    }
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    return 0;
+}
+
+
+void
+mnl4c_register_msg(mnl4c_logger_t ld, int level, int id, const char *name)
+{
+    mnl4c_ctx_t **pctx;
+    mnl4c_minfo_t *minfo;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        FAIL("array_get");
+    }
+    assert(id >= 0);
+    mnl4c_ctx_lock(*pctx);
+    if ((minfo = array_get_safe(&(*pctx)->minfos, id)) == NULL) {
+        FAIL("array_get_safe");
+    }
+    (void)minfo_fini(minfo);
+    (void)minfo_init(minfo);
+    minfo->id = id;
+    minfo->flevel = level;
+    minfo->elevel = level;
+    minfo->name = bytes_new_from_str(name);
+    BYTES_INCREF(minfo->name);
+    ctx_levels_update(*pctx);
+    (void)pthread_mutex_unlock(&(*pctx)->mtx);
+    jump_update();
+}
+
+
+/*
+ * Libraries' message descriptors, see mnl4c_msgdef_t.  msgdefs_nids is
+ * one past the highest id handed out so far, the size of a fully
+ * registered minfos table.
+ */
+typedef struct _mnl4c_msgdefs {
+    mnl4c_msgdef_t *start;
+    mnl4c_msgdef_t *stop;
+    int *base;
+} mnl4c_msgdefs_t;
+
+static pthread_mutex_t msgdefs_mtx = PTHREAD_MUTEX_INITIALIZER;
+/* mnl4c_msgdefs_t */
+static mnarray_t msgdefs;
+static bool msgdefs_ready = false;
+static int msgdefs_nids = 0;
+
+
+/*
+ * Hand the library owning base its id range and intern its message names.
+ * Called by the constructor of the generated source, once per library:
+ * start and stop delimit the section of the object the library was linked
+ * into, which may hold other libraries' descriptors too.
+ */
+void
+mnl4c_msgdefs_add(mnl4c_msgdef_t *start, mnl4c_msgdef_t *stop, int *base)
+{
+    mnl4c_msgdefs_t *md;
+    mnl4c_msgdef_t *d;
+    int n;
+
+    (void)pthread_mutex_lock(&msgdefs_mtx);
+    if (*base >= 0) {
+        goto end;
+    }
+    if (!msgdefs_ready) {
+        if (MNUNLIKELY(array_init(&msgdefs,
+                                  sizeof(mnl4c_msgdefs_t),
+                                  0,
+                                  NULL,
+                                  NULL) != 0)) {
+            FAIL("array_init");
+        }
+        msgdefs_ready = true;
+    }
+
+    n = 0;
+    for (d = start; d < stop; ++d) {
+        if (d->base != base) {
+            continue;
+        }
+        if (d->idx >= n) {
+            n = d->idx + 1;
+        }
+        d->bname = bytes_new_from_str(d->name);
+        BYTES_INCREF(d->bname);
+    }
+    *base = msgdefs_nids;
+    msgdefs_nids += n;
+
+    if (MNUNLIKELY((md = array_incr(&msgdefs)) == NULL)) {
+        FAIL("array_incr");
+    }
+    md->start = start;
+    md->stop = stop;
+    md->base = base;
+
+end:
+    (void)pthread_mutex_unlock(&msgdefs_mtx);
+}
+
+
+/*
+ * Register the messages of the library owning base with the logger, those
+ * of all libraries added so far if base is NULL.  The minfos table is
+ * sized to the ids handed out, and grows as libraries are added.
+ */
+int
+mnl4c_msgdefs_register(mnl4c_logger_t ld, int *base)
+{
+    mnl4c_ctx_t *ctx;
+    mnl4c_msgdefs_t *md;
+    mnarray_iter_t it;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        TRRET(MNL4C_MSGDEFS_REGISTER + 1);
+    }
+
+    (void)pthread_mutex_lock(&msgdefs_mtx);
+    if (!msgdefs_ready) {
+        (void)pthread_mutex_unlock(&msgdefs_mtx);
+        return 0;
+    }
+    mnl4c_ctx_lock(ctx);
+    if (MNUNLIKELY(array_ensure_len(&ctx->minfos,
+                                    msgdefs_nids,
+                                    ARRAY_FLAG_SAVE) != 0)) {
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        (void)pthread_mutex_unlock(&msgdefs_mtx);
+        TRRET(MNL4C_MSGDEFS_REGISTER + 2);
+    }
+    for (md = array_first(&msgdefs, &it);
+         md != NULL;
+         md = array_next(&msgdefs, &it)) {
+        mnl4c_msgdef_t *d;
+
+        if (base != NULL && md->base != base) {
+            continue;
+        }
+        for (d = md->start; d < md->stop; ++d) {
+            mnl4c_minfo_t *minfo;
+
+            if (d->base != md->base) {
+                continue;
+            }
+            minfo = ARRAY_GET(mnl4c_minfo_t,
+                              &ctx->minfos,
+                              *d->base + d->idx);
+            (void)minfo_fini(minfo);
+            (void)minfo_init(minfo);
+            minfo->id = *d->base + d->idx;
+            minfo->flevel = d->level;
+            minfo->elevel = d->level;
+            minfo->name = d->bname;
+            BYTES_INCREF(minfo->name);
+        }
+    }
+    ctx_levels_update(ctx);
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    (void)pthread_mutex_unlock(&msgdefs_mtx);
+    jump_update();
+
+    return 0;
+}
+
+
+int
+mnl4c_set_level(mnl4c_logger_t ld, int level, const mnbytes_t *prefix)
+{
+    mnl4c_ctx_t **pctx;
+    mnl4c_minfo_t *minfo;
+    mnarray_iter_t it;
+    int res;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        FAIL("array_get");
+    }
+
+    res = 0;
+    mnl4c_ctx_lock(*pctx);
+    if (prefix == NULL) {
+        for (minfo = array_first(&(*pctx)->minfos, &it);
+             minfo != NULL;
+             minfo = array_next(&(*pctx)->minfos, &it)) {
+            minfo->elevel = level;
+            ++res;
+        }
+    } else {
+        for (minfo = array_first(&(*pctx)->minfos, &it);
+             minfo != NULL;
+             minfo = array_next(&(*pctx)->minfos, &it)) {
+            if (minfo->name != NULL &&
+                bytes_startswith(minfo->name, prefix)) {
+                minfo->elevel = level;
+                ++res;
+            }
+        }
+    }
+    ctx_levels_update(*pctx);
+    (void)pthread_mutex_unlock(&(*pctx)->mtx);
+    jump_update();
+    return res;
+}
+
+
+int
+mnl4c_set_throttling(mnl4c_logger_t ld, double threshold, const mnbytes_t *prefix)
+{
+    mnl4c_ctx_t **pctx;
+    mnl4c_minfo_t *minfo;
+    mnarray_iter_t it;
+    int res;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        FAIL("array_get");
+    }
 
     res = 0;
     if (prefix == NULL) {
@@ -584,7 +5283,8 @@ mnl4c_set_throttling(mnl4c_logger_t ld, double threshold, const mnbytes_t *prefi
         for (minfo = array_first(&(*pctx)->minfos, &it);
              minfo != NULL;
              minfo = array_next(&(*pctx)->minfos, &it)) {
-            if (bytes_startswith(minfo->name, prefix)) {
+            if (minfo->name != NULL &&
+                bytes_startswith(minfo->name, prefix)) {
                 minfo->throttle_threshold = threshold;
                 ++res;
             }
@@ -594,6 +5294,227 @@ mnl4c_set_throttling(mnl4c_logger_t ld, double threshold, const mnbytes_t *prefi
 }
 
 
+/*
+ * Serializes the sink graph: a logger is either an owner or a sink,
+ * never both, this keeps the lock order owner -> sink acyclic.
+ */
+static pthread_mutex_t sinks_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+int
+mnl4c_add_sink(mnl4c_logger_t ld,
+               mnl4c_logger_t sinkld,
+               int level,
+               unsigned flags)
+{
+    mnl4c_ctx_t *ctx, *sctx;
+    mnl4c_sink_t *sink;
+    mnarray_iter_t it;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        return -1;
+    }
+    if ((sctx = mnl4c_get_ctx(sinkld)) == NULL) {
+        return -1;
+    }
+
+    (void)pthread_mutex_lock(&sinks_mtx);
+    /*
+     * A logger that fans out cannot itself be a sink, and a sink cannot
+     * fan out.
+     */
+    if (ctx == sctx ||
+        ARRAY_ELNUM(&sctx->sinks) > 0 ||
+        ctx->nowners > 0) {
+        (void)pthread_mutex_unlock(&sinks_mtx);
+        TRACE("invalid sink %d for logger %d", sinkld, ld);
+        return -1;
+    }
+
+    (void)pthread_mutex_lock(&ctx->mtx);
+    for (sink = array_first(&ctx->sinks, &it);
+         sink != NULL;
+         sink = array_next(&ctx->sinks, &it)) {
+        if (sink->ld == sinkld) {
+            break;
+        }
+    }
+    if (sink == NULL) {
+        if ((sink = array_incr(&ctx->sinks)) == NULL) {
+            FAIL("array_incr");
+        }
+        sink->ld = mnl4c_incref(sinkld);
+        ++sctx->nowners;
+    }
+    sink->level = level;
+    sink->flags = flags;
+    sink->pending = false;
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    (void)pthread_mutex_unlock(&sinks_mtx);
+
+    return 0;
+}
+
+
+int
+mnl4c_remove_sink(mnl4c_logger_t ld, mnl4c_logger_t sinkld)
+{
+    mnl4c_ctx_t *ctx, *sctx;
+    mnl4c_sink_t *sink;
+    mnarray_iter_t it;
+    int res;
+
+    if ((ctx = mnl4c_get_ctx(ld)) == NULL) {
+        return -1;
+    }
+
+    res = -1;
+    (void)pthread_mutex_lock(&sinks_mtx);
+    (void)pthread_mutex_lock(&ctx->mtx);
+    for (sink = array_first(&ctx->sinks, &it);
+         sink != NULL;
+         sink = array_next(&ctx->sinks, &it)) {
+        if (sink->ld == sinkld) {
+            mnl4c_sink_t *last;
+
+            last = ARRAY_GET(mnl4c_sink_t,
+                             &ctx->sinks,
+                             ARRAY_ELNUM(&ctx->sinks) - 1);
+            *sink = *last;
+            (void)array_decr(&ctx->sinks);
+            res = 0;
+            break;
+        }
+    }
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    if (res == 0 && (sctx = mnl4c_get_ctx(sinkld)) != NULL) {
+        --sctx->nowners;
+    }
+    (void)pthread_mutex_unlock(&sinks_mtx);
+
+    if (res == 0) {
+        (void)mnl4c_close(sinkld);
+    }
+    return res;
+}
+
+
+/*
+ * Write a single record directly to the writer's descriptor, bypassing
+ * ctx->bs and ctx->mtx.  Safe to call from signal handlers.  The record
+ * is not ordered with respect to records still pending in ctx->bs.  It
+ * is dropped on MNL4C_OPEN_DIRECT loggers, see ctx_fd().
+ */
+void
+mnl4c_ctx_write_sigsafe(mnl4c_ctx_t *ctx,
+                        int level,
+                        const char *name,
+                        const char *fmt,
+                        ...)
+{
+    char buf[MNL4C_SIGSAFE_BUFSZ];
+    sigsafe_buf_t b;
+    struct timespec ts;
+    va_list ap;
+    int saved_errno;
+
+    saved_errno = errno;
+    if (ctx_fd(ctx) < 0) {
+        goto end;
+    }
+
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    b.buf = buf;
+    /* reserve room for eol */
+    b.sz = sizeof(buf) - 1;
+    b.n = 0;
+    sigsafe_format(&b,
+                   "%lu.%06lu [%d] %s %s:\t",
+                   (unsigned long)ts.tv_sec,
+                   (unsigned long)(ts.tv_nsec / 1000),
+                   (int)ctx->cache.pid,
+                   name,
+                   level_names[level]);
+    va_start(ap, fmt);
+    sigsafe_vformat(&b, fmt, ap);
+    va_end(ap);
+    buf[b.n++] = '\n';
+    ctx_writeall(ctx, buf, b.n);
+
+end:
+    errno = saved_errno;
+}
+
+
+/*
+ * Write out whatever is pending in every logger's buffer using raw
+ * write(2).  Intended for fatal signal handlers: no locks are taken, so
+ * a record being rendered at the time of the signal may be cut short.
+ * MNL4C_OPEN_DIRECT loggers are skipped, see ctx_fd().
+ */
+void
+mnl4c_crash_flush(void)
+{
+    size_t i;
+    int saved_errno;
+
+    saved_errno = errno;
+    for (i = 0; i < ARRAY_ELNUM(&ctxes); ++i) {
+        mnl4c_ctx_t *ctx;
+
+        if ((ctx = *ARRAY_GET(mnl4c_ctx_t *, &ctxes, i)) == NULL) {
+            continue;
+        }
+        if (SEOD(&ctx->bs) <= 0 || ctx_fd(ctx) < 0) {
+            continue;
+        }
+        ctx_writeall(ctx, SDATA(&ctx->bs, 0), SEOD(&ctx->bs));
+        bytestream_rewind(&ctx->bs);
+    }
+    errno = saved_errno;
+}
+
+
+static int crash_signals[] = {
+    SIGSEGV,
+    SIGBUS,
+    SIGILL,
+    SIGFPE,
+    SIGABRT,
+};
+
+
+static void
+crash_sighandler(int signo)
+{
+    mnl4c_crash_flush();
+    /* SA_RESETHAND restored the default action */
+    (void)raise(signo);
+}
+
+
+/*
+ * Opt-in: flush pending records on fatal signals, then let the signal
+ * take its default action.
+ */
+int
+mnl4c_install_crash_handler(void)
+{
+    struct sigaction sa;
+    size_t i;
+
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = crash_sighandler;
+    sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+    (void)sigemptyset(&sa.sa_mask);
+    for (i = 0; i < countof(crash_signals); ++i) {
+        if (sigaction(crash_signals[i], &sa, NULL) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
 mnl4c_logger_t
 mnl4c_open(unsigned ty, ...)
 {
@@ -612,9 +5533,9 @@ mnl4c_open(unsigned ty, ...)
     maxfiles = 0;
     flags = 0;
 
-    if ((ty & MNL4C_OPEN_FLOCK) &&
+    if ((ty & (MNL4C_OPEN_FLOCK | MNL4C_OPEN_DIRECT)) &&
         ((ty & MNL4C_OPEN_TY) != MNL4C_OPEN_FILE)) {
-        TRACE("non-file flock is not supported");
+        TRACE("non-file flock or direct is not supported");
         return -1;
     }
 
@@ -677,8 +5598,8 @@ mnl4c_open(unsigned ty, ...)
             if ((pctx = array_incr_iter(&ctxes, &it)) == NULL) {
                 FAIL("array_incr_iter");
             }
-            (*pctx)->ty = ty & MNL4C_OPEN_TY;
         }
+        (*pctx)->ty = ty & MNL4C_OPEN_TY;
 
         switch (ty & MNL4C_OPEN_TY) {
         case MNL4C_OPEN_STDOUT:
@@ -704,8 +5625,20 @@ mnl4c_open(unsigned ty, ...)
             (*pctx)->writer.data.file.starttm = mnl4c_now_posix();
             (*pctx)->writer.data.file.curtm =
                 (*pctx)->writer.data.file.starttm;
+            (*pctx)->writer.data.file.wcurtm =
+                (*pctx)->writer.data.file.starttm;
             (*pctx)->writer.data.file.maxfiles = maxfiles;
             (*pctx)->writer.data.file.flags = flags;
+            if (flags & MNL4C_OPEN_DIRECT) {
+                if (posix_memalign(
+                        (void **)&(*pctx)->writer.data.file.dbuf,
+                        MNL4C_DIRECT_BLKSZ,
+                        MNL4C_DIRECT_BUFSZ) != 0) {
+                    FAIL("posix_memalign");
+                }
+                (*pctx)->writer.data.file.dbufsz = MNL4C_DIRECT_BUFSZ;
+                (*pctx)->writer.write = mnl4c_write_direct;
+            }
             if (writer_file_open(&(*pctx)->writer) != 0) {
                 goto err;
             }
@@ -799,9 +5732,36 @@ mnl4c_close(mnl4c_logger_t ld)
     --(*pctx)->nref;
 
     if ((*pctx)->nref <= 0) {
+        mnl4c_sink_t *sink;
+        mnarray_iter_t it;
+
+        /* the flusher may still be at it */
+        (void)pthread_mutex_lock(&(*pctx)->mtx);
         if (SEOD(&(*pctx)->bs) > 0) {
             assert((*pctx)->writer.write != NULL);
-            (*pctx)->writer.write(*pctx);
+            ctx_flush(*pctx);
+        }
+        (void)pthread_mutex_unlock(&(*pctx)->mtx);
+        if ((*pctx)->writer.data.file.shm != NULL) {
+            (void)pthread_mutex_lock(&(*pctx)->flush_mtx);
+            shmring_drain_all(*pctx);
+            (void)pthread_mutex_unlock(&(*pctx)->flush_mtx);
+        }
+        (void)pthread_mutex_lock(&sinks_mtx);
+        for (sink = array_first(&(*pctx)->sinks, &it);
+             sink != NULL;
+             sink = array_next(&(*pctx)->sinks, &it)) {
+            mnl4c_ctx_t *sctx;
+
+            if ((sctx = mnl4c_get_ctx(sink->ld)) != NULL) {
+                --sctx->nowners;
+            }
+        }
+        (void)pthread_mutex_unlock(&sinks_mtx);
+        for (sink = array_first(&(*pctx)->sinks, &it);
+             sink != NULL;
+             sink = array_next(&(*pctx)->sinks, &it)) {
+            (void)mnl4c_close(sink->ld);
         }
         (void)array_clear_item(&ctxes, ld);
     }
@@ -831,19 +5791,97 @@ ctx_fini(void *o)
 }
 
 
+/*
+ * The flusher is held off across fork(), so that it owns no logger's lock
+ * in the child.
+ */
+static void
+atfork_prepare(void)
+{
+    (void)pthread_mutex_lock(&flusher_mtx);
+}
+
+
+static void
+atfork_parent(void)
+{
+    (void)pthread_mutex_unlock(&flusher_mtx);
+}
+
+
+/*
+ * The child has a new pid, the prefixes rendered with the old one are
+ * dropped by mnl4c_ctx_prefix().  It has no flusher thread either.  If
+ * any logger needs one it is started by the child's first record, see
+ * flusher_resume(), or by flusher_update(): no thread may be created
+ * here.
+ */
+static void
+atfork_child(void)
+{
+    size_t i;
+    bool needflusher;
+
+    needflusher = false;
+    for (i = 0; i < ARRAY_ELNUM(&ctxes); ++i) {
+        mnl4c_ctx_t *ctx;
+
+        if ((ctx = *ARRAY_GET(mnl4c_ctx_t *, &ctxes, i)) != NULL) {
+            cache_init(&ctx->cache);
+            /* a sync in progress belongs to a thread of the parent */
+            ctx->sync_busy = false;
+            if (flusher_needed(ctx)) {
+                needflusher = true;
+            }
+        }
+    }
+    flusher_running = false;
+    flusher_restart = needflusher;
+    (void)pthread_mutex_unlock(&flusher_mtx);
+}
+
+
+static void
+atfork_init(void)
+{
+    if (pthread_atfork(atfork_prepare, atfork_parent, atfork_child) != 0) {
+        FAIL("pthread_atfork");
+    }
+}
+
+
 void
 mnl4c_init(void)
 {
+    static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
     array_init(&ctxes,
                sizeof(mnl4c_ctx_t *),
                0,
                ctx_init,
                ctx_fini);
+    (void)pthread_once(&atfork_once, atfork_init);
 }
 
 
 void
 mnl4c_fini(void)
 {
+    size_t i;
+
+    flusher_shutdown();
+    for (i = 0; i < ARRAY_ELNUM(&ctxes); ++i) {
+        mnl4c_ctx_t *ctx;
+
+        if ((ctx = *ARRAY_GET(mnl4c_ctx_t *, &ctxes, i)) != NULL &&
+            SEOD(&ctx->bs) > 0 &&
+            ctx->writer.write != NULL) {
+            ctx_flush(ctx);
+        }
+    }
     array_fini(&ctxes);
+    /* key destructors do not run for the thread that calls exit() */
+    (void)pthread_once(&builder_once, builder_key_init);
+    builder_destroy(pthread_getspecific(builder_key));
+    (void)pthread_setspecific(builder_key, NULL);
 }
@@ -5,6 +5,8 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -25,6 +27,7 @@ typedef int mnl4c_logger_t;
 struct _mnl4c_ctx;
 
 
+#define MNL4C_PREFIX_BUFSZ 64
 typedef struct _mnl4c_minfo {
     int id;
     /*
@@ -35,13 +38,28 @@ typedef struct _mnl4c_minfo {
     mnbytes_t *name;
     double throttle_threshold;
     int nthrottled;
+    /* call site counters, emitted = ncalls - nrejected - nthrottled_total */
+    uint64_t ncalls;
+    uint64_t nrejected;
+    uint64_t nthrottled_total;
+    /* see mnl4c_set_profiling() */
+    uint64_t fmt_cycles;
+    uint64_t write_cycles;
+    /*
+     * see mnl4c_ctx_prefix(): " [<pid>] <name> <level>" rendered for
+     * pfx_level and pfx_pid, pfx_level is -1 if not rendered yet
+     */
+    int pfx_level;
+    pid_t pfx_pid;
+    size_t pfx_len;
+    char pfx[MNL4C_PREFIX_BUFSZ];
 } mnl4c_minfo_t;
 
 
 #define MNL4C_FWRITER_DEFAULT_OPEN_FLAGS (O_WRONLY | O_APPEND | O_CREAT)
 #define MNL4C_FWRITER_DEFAULT_OPEN_MODE 0644
 typedef struct _mnl4c_writer {
-    void (*write)(struct _mnl4c_ctx *);
+    void (*write)(struct _mnl4c_ctx *, mnbytestream_t *);
     union {
         struct {
             mnbytes_t *path;
@@ -51,10 +69,47 @@ typedef struct _mnl4c_writer {
             double maxtm;
             double starttm;
             double curtm;
+            /* curtm as of the last hand-over, the writer's own copy */
+            double wcurtm;
             size_t maxfiles;
             int fd;
             struct stat sb;
             unsigned flags;
+            /* bumped on every rotation done by this process */
+            uint64_t nrollovers;
+            /*
+             * shared-memory ring, see mnl4c_set_shmring(); shmgen is the
+             * last rotation generation this process has opened
+             */
+            struct _mnl4c_shmring_hdr *shm;
+            size_t shmsz;
+            uint64_t shmgen;
+            /* a chunk not yet reserved when first found, and since when */
+            uint64_t shmstuck;
+            double shmstuck_tm;
+            /*
+             * MNL4C_OPEN_DIRECT: block-aligned staging buffer, dlen
+             * bytes of it are pending at file offset doff
+             */
+            char *dbuf;
+            size_t dbufsz;
+            size_t dlen;
+            off_t doff;
+            /*
+             * see mnl4c_set_durability(): wgen counts hand-overs to the
+             * file, synced is the last one known to be on stable storage
+             */
+            int durability;
+            uint64_t wgen;
+            uint64_t synced;
+            /*
+             * (lostfrom, lostto] went to a file whose last sync failed at
+             * rotation, no later sync covers them; counted in
+             * nsync_errors
+             */
+            uint64_t lostfrom;
+            uint64_t lostto;
+            uint64_t nsync_errors;
         } file;
     } data;
 } mnl4c_writer_t;
@@ -65,16 +120,149 @@ typedef struct _mnl4c_cache {
 } mnl4c_cache_t;
 
 
-#define MNL4C_MAX_MINFOS 1024
+/*
+ * A sink is another opened logger that receives a copy of every record
+ * rendered by its owner, subject to the sink's own minimum level.  The
+ * bytes are copied into the sink's buffer, not shared.  Only records
+ * that pass the owner's level reach the sinks, so a sink cannot be more
+ * verbose than its owner.
+ */
+#define MNL4C_SINK_FLUSH_FULL   0x00
+#define MNL4C_SINK_FLUSH_RECORD 0x01
+typedef struct _mnl4c_sink {
+    mnl4c_logger_t ld;
+    /*
+     * LOG_*
+     */
+    int level;
+    unsigned flags;
+    /* to be written out by the owner's mnl4c_ctx_unlock() */
+    bool pending;
+} mnl4c_sink_t;
+
+
+/*
+ * Flight recorder: records rejected by elevel but allowed by the
+ * recording level are kept in a ring, and replayed into the logger when
+ * a record at the trigger level (or more severe) is written.
+ */
+#define MNL4C_RECORDER_MAXMSG 512
+typedef struct _mnl4c_recorder {
+    /*
+     * LOG_*, -1 if disabled
+     */
+    int rlevel;
+    int trigger;
+    /* header followed by the ring data, malloc'ed or mmap'ed */
+    struct _mnl4c_recorder_hdr *hdr;
+    size_t mapsz;
+    int fd;
+    unsigned sigcount;
+} mnl4c_recorder_t;
+
+
+/*
+ * Runtime statistics, updated under ctx->mtx which every record holds
+ * anyway, nwrite_errors by the writer under ctx->flush_mtx.  Histograms
+ * are log2: bucket 0 counts zeroes, bucket i counts values in
+ * [2^(i-1), 2^i), the last one also everything above.
+ */
+#define MNL4C_STATS_NBUCKETS 40
+typedef struct _mnl4c_stats {
+    uint64_t nrecords;
+    uint64_t nthrottled;
+    uint64_t nflushes;
+    /* of which done by the flusher thread, see mnl4c_set_flush_latency() */
+    uint64_t ntimed_flushes;
+    /* handed over to the writer */
+    uint64_t nbytes;
+    uint64_t nwrite_errors;
+    /* chunks dropped on a full shared-memory ring, by any process */
+    uint64_t ndropped;
+    uint64_t nrollovers;
+    /* lock acquisitions that had to wait, and the time spent waiting */
+    uint64_t nlock_waits;
+    uint64_t lock_wait_ns;
+    /* fdatasync() calls, and records that waited for one */
+    uint64_t nsyncs;
+    uint64_t nsync_waits;
+    uint64_t flush_ns[MNL4C_STATS_NBUCKETS];
+    uint64_t record_sz[MNL4C_STATS_NBUCKETS];
+} mnl4c_stats_t;
+
+
+/*
+ * The levels of every message id, read without the lock by
+ * mnl4c_ctx_enabled().  A table is never resized: when ids are added a
+ * larger one is published in its place, and the old one is kept on the
+ * prev chain until the logger is destroyed, since a reader may still be
+ * on it.  nfiltered, allocated apart from l so that counting does not
+ * touch the lines every check reads, counts the calls turned away by the
+ * unlocked check while profiling, see ctx_levels_collect().
+ */
+typedef struct _mnl4c_level {
+    int flevel;
+    int elevel;
+} mnl4c_level_t;
+
+typedef struct _mnl4c_levels {
+    struct _mnl4c_levels *prev;
+    size_t n;
+    mnl4c_level_t *l;
+    uint64_t *nfiltered;
+} mnl4c_levels_t;
+
+
 typedef struct _mnl4c_ctx {
     pthread_mutex_t mtx;
     ssize_t nref;
     mnbytestream_t bs;
     ssize_t bsbufsz;
+    /*
+     * the spare buffer, being written out with mtx released; the writer
+     * state is under flush_mtx, taken after mtx
+     */
+    mnbytestream_t wbs;
+    pthread_mutex_t flush_mtx;
     /* strongref */
     mnl4c_writer_t writer;
     mnl4c_cache_t cache;
+    /* indexed by message id, see mnl4c_msgdefs_register() */
     mnarray_t minfos;
+    /* published copy of the minfos levels, NULL until any is registered */
+    mnl4c_levels_t *levels;
+    /* mnl4c_sink_t */
+    mnarray_t sinks;
+    /* number of loggers this one is a sink of, under sinks_mtx */
+    int nowners;
+    mnl4c_recorder_t rec;
+    mnl4c_stats_t stats;
+    /* see mnl4c_set_stats_interval() */
+    double stats_interval;
+    double stats_next;
+    /* the record being profiled: its minfo id and start timestamp */
+    bool profiling;
+    int prof_id;
+    uint64_t prof_start;
+    /* see mnl4c_set_sanitize() */
+    bool sanitize_escape;
+    size_t sanitize_maxlen;
+    /* see mnl4c_set_flush_latency(), pending_tm is the oldest buffered */
+    double flush_latency;
+    double pending_tm;
+    /* see mnl4c_set_durability() */
+    int sync_level;
+    double sync_interval;
+    double sync_next;
+    bool sync_busy;
+    pthread_cond_t sync_cond;
+    /*
+     * work left by the record under mtx for mnl4c_ctx_unlock(), see
+     * MNL4C_WPENDING_*, and the profiled record to charge it to
+     */
+    unsigned wpending;
+    int wprof_id;
+    uint64_t wprof_start;
     unsigned ty;
 } mnl4c_ctx_t;
 
@@ -85,6 +273,7 @@ double mnl4c_now_posix(void);
 #define MNL4C_OPEN_FILE    0x0003
 #define MNL4C_OPEN_TY      0x00ff
 #define MNL4C_OPEN_FLOCK   0x0100
+#define MNL4C_OPEN_DIRECT  0x0200
 
 
 
@@ -105,13 +294,300 @@ mnl4c_logger_t mnl4c_incref(mnl4c_logger_t);
 mnl4c_ctx_t *mnl4c_get_ctx(mnl4c_logger_t);
 int mnl4c_traverse_minfos(mnl4c_logger_t, array_traverser_t, void *);
 bool mnl4c_ctx_allowed(mnl4c_ctx_t *, int, int);
+bool mnl4c_ctx_allowed_sigsafe(mnl4c_ctx_t *, int, int);
+void mnl4c_ctx_lock_slow(mnl4c_ctx_t *);
+
+static inline void
+mnl4c_ctx_lock(mnl4c_ctx_t *ctx)
+{
+    if (MNUNLIKELY(pthread_mutex_trylock(&ctx->mtx) != 0)) {
+        mnl4c_ctx_lock_slow(ctx);
+    }
+}
+
+ssize_t mnl4c_ctx_prefix(mnl4c_ctx_t *, int, const char *, int, int);
+void mnl4c_ctx_commit(mnl4c_ctx_t *, int, off_t, bool);
+
+/*
+ * A committed record may leave the write of the buffer, a sync, and in a
+ * forked child the start of the flusher, to be done once it is complete:
+ * every lock hold that commits ends with mnl4c_ctx_unlock().
+ */
+#define MNL4C_WPENDING_FLUSH 0x01
+#define MNL4C_WPENDING_SYNC  0x02
+#define MNL4C_WPENDING_SINKS 0x04
+#define MNL4C_WPENDING_FLUSHER 0x08
+void mnl4c_ctx_unlock_slow(mnl4c_ctx_t *);
+
+static inline void
+mnl4c_ctx_unlock(mnl4c_ctx_t *ctx)
+{
+    if (MNUNLIKELY(ctx->wpending != 0)) {
+        mnl4c_ctx_unlock_slow(ctx);
+    } else {
+        (void)pthread_mutex_unlock(&ctx->mtx);
+    }
+}
+
+void mnl4c_ctx_record(mnl4c_ctx_t *, int, int, const char *, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/*
+ * Slim call sites (see MNL4C_SITE): the site only checks whether the
+ * message is enabled or recorded, the rest is done out of line by
+ * mnl4c_ctx_emit().  A level of -1 stands for the message's registered
+ * level.  vwrite is the message's generated serializer, or NULL to
+ * render fmt with bytestream_vnprintf().
+ */
+#define MNL4C_SITE_THROTTLE 0x01
+#define MNL4C_SITE_LT       0x02
+#define MNL4C_SITE_LT2      0x04
+typedef ssize_t (*mnl4c_vwrite_t)(mnbytestream_t *, ssize_t, va_list);
+
+static inline bool
+mnl4c_ctx_enabled(mnl4c_ctx_t *ctx, int level, int id)
+{
+    mnl4c_levels_t *levels;
+    mnl4c_level_t *l;
+
+    /* unlocked, the out of line path checks again under ctx->mtx */
+    levels = __atomic_load_n(&ctx->levels, __ATOMIC_ACQUIRE);
+    if (levels == NULL || id < 0 || (size_t)id >= levels->n) {
+        return false;
+    }
+    l = &levels->l[id];
+    if (level < 0) {
+        level = __atomic_load_n(&l->flevel, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&l->elevel, __ATOMIC_RELAXED) >= level ||
+        __atomic_load_n(&ctx->rec.rlevel, __ATOMIC_RELAXED) >= level) {
+        return true;
+    }
+    if (MNUNLIKELY(__atomic_load_n(&ctx->profiling, __ATOMIC_RELAXED))) {
+        (void)__atomic_add_fetch(&levels->nfiltered[id], 1, __ATOMIC_RELAXED);
+    }
+    return false;
+}
+
+void mnl4c_ctx_emit(mnl4c_ctx_t *,
+                    int,
+                    int,
+                    const char *,
+                    unsigned,
+                    mnl4c_vwrite_t,
+                    const char *,
+                    ...)
+    __attribute__((cold, noinline, format(printf, 7, 8)));
+void mnl4c_ctx_vemit(mnl4c_ctx_t *,
+                     int,
+                     int,
+                     const char *,
+                     unsigned,
+                     mnl4c_vwrite_t,
+                     const char *,
+                     va_list)
+    __attribute__((cold, noinline));
+#define MNL4C_SIGSAFE_BUFSZ 1024
+void mnl4c_ctx_write_sigsafe(mnl4c_ctx_t *, int, const char *, const char *, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/*
+ * Record builder, see mnl4c_builder_start().  <MOD>_LOG_BEGIN() is the
+ * generated front end.
+ */
+typedef struct _mnl4c_builder mnl4c_builder_t;
+mnl4c_builder_t *mnl4c_builder_start(mnl4c_logger_t,
+                                     int,
+                                     int,
+                                     const char *,
+                                     const char *,
+                                     ...)
+    __attribute__((format(printf, 5, 6)));
+int mnl4c_builder_printf(mnl4c_builder_t *, const char *, ...)
+    __attribute__((format(printf, 2, 3)));
+int mnl4c_builder_commit(mnl4c_builder_t *);
+void mnl4c_builder_abort(mnl4c_builder_t *);
+
+#define MNL4C_NDC_MAXDEPTH 16
+#define MNL4C_NDC_BUFSZ 512
+int mnl4c_ndc_push(const char *, ...)
+    __attribute__((format(printf, 1, 2)));
+int mnl4c_ndc_push_kv(const char *, const char *, ...)
+    __attribute__((format(printf, 2, 3)));
+int mnl4c_ndc_pop(void);
+int mnl4c_ndc_set_thread(const char *);
+
+#define MNL4C_PAYLOAD_RAW 0
+#define MNL4C_PAYLOAD_HEX 1
+#define MNL4C_PAYLOAD_BASE64 2
+int mnl4c_write_payload(mnl4c_logger_t,
+                        int,
+                        int,
+                        const char *,
+                        const void *,
+                        size_t,
+                        unsigned,
+                        const char *,
+                        ...)
+    __attribute__((format(printf, 8, 9)));
+
 int mnl4c_close(mnl4c_logger_t);
 void mnl4c_register_msg(mnl4c_logger_t, int, int, const char *);
+
+/*
+ * Message descriptors.  l4cdefgen emits one per message into the
+ * mnl4c_msgdefs section of whatever object the generated source is linked
+ * into, the linker delimits the section with __start_mnl4c_msgdefs and
+ * __stop_mnl4c_msgdefs.  Several libraries linked into one object share
+ * the section, base tells their descriptors apart: each library is handed
+ * its own id range [*base, *base + n) by mnl4c_msgdefs_add(), a message's
+ * id is *base + idx.  The size is kept a power of two equal to the
+ * alignment, so that the compiler cannot pad the descriptors apart.
+ */
+typedef struct _mnl4c_msgdef {
+    int *base;
+    int idx;
+    int level;
+    const char *name;
+    /* interned by mnl4c_msgdefs_add() */
+    mnbytes_t *bname;
+} __attribute__((aligned(32))) mnl4c_msgdef_t;
+
+#define MNL4C_MSGDEF(lib, mod, msg, idx)                                       \
+static mnl4c_msgdef_t _mnl4c_msgdef_ ## mod ## _ ## msg                        \
+    __attribute__((section("mnl4c_msgdefs"), used)) = {                        \
+    &lib ## _logdef_base,                                                      \
+    idx,                                                                       \
+    mod ## _ ## msg ## _LEVEL,                                                 \
+    #mod "_" #msg,                                                             \
+    NULL                                                                       \
+}                                                                              \
+
+
+/* undefined, hence NULL, in an object without descriptors */
+extern mnl4c_msgdef_t __start_mnl4c_msgdefs[] __attribute__((weak));
+extern mnl4c_msgdef_t __stop_mnl4c_msgdefs[] __attribute__((weak));
+
+void mnl4c_msgdefs_add(mnl4c_msgdef_t *, mnl4c_msgdef_t *, int *);
+int mnl4c_msgdefs_register(mnl4c_logger_t, int *);
+
+/*
+ * Jump labels.  Built with MNL4C_JUMP_LABELS on x86-64 or aarch64, a slim
+ * site starts with a jump to its enabled check, and records it in the
+ * mnl4c_jump section.  While no open logger enables the message at the
+ * site's level, or records it, the jump is patched into a nop of the same
+ * size: the site costs nothing but the nop.  Sites are re-patched by
+ * mnl4c_set_level(), mnl4c_set_recorder() and message registration,
+ * while other threads may be running them: on x86-64 this installs a
+ * SIGTRAP handler, see jump_patch().  A site that cannot be patched
+ * stays a jump, and does the plain check.
+ */
+#if defined(MNL4C_JUMP_LABELS) &&                                              \
+    (defined(__x86_64__) || defined(__aarch64__))
+#   define MNL4C_HAVE_JUMP_LABELS
+#endif
+
+typedef struct _mnl4c_jump {
+    /* the jump and its target */
+    uintptr_t code;
+    uintptr_t target;
+    int *base;
+    int idx;
+    /* the site's level, -1 for the message's, -2 if not a constant */
+    int level;
+    /* whether code is the jump */
+    int enabled;
+    int pad;
+} mnl4c_jump_t;
+
+/* undefined, hence NULL, in an object without sites */
+extern mnl4c_jump_t __start_mnl4c_jump[] __attribute__((weak));
+extern mnl4c_jump_t __stop_mnl4c_jump[] __attribute__((weak));
+
+void mnl4c_jump_add(mnl4c_jump_t *, mnl4c_jump_t *);
 int mnl4c_set_level(mnl4c_logger_t, int, const mnbytes_t *);
 int mnl4c_set_throttling(mnl4c_logger_t, double, const mnbytes_t *);
+int mnl4c_add_sink(mnl4c_logger_t, mnl4c_logger_t, int, unsigned);
+int mnl4c_remove_sink(mnl4c_logger_t, mnl4c_logger_t);
+int mnl4c_set_recorder(mnl4c_logger_t, int, int, size_t, const char *);
+int mnl4c_recorder_dump(mnl4c_logger_t);
+int mnl4c_recorder_dump_on_signal(int);
+#define MNL4C_SHMRING_MINSZ 4096
+int mnl4c_set_shmring(mnl4c_logger_t, size_t);
+int mnl4c_shmring_drain(mnl4c_logger_t);
+int mnl4c_set_profiling(mnl4c_logger_t, bool);
+int mnl4c_profile_report(mnl4c_logger_t, int);
+int mnl4c_get_stats(mnl4c_logger_t, mnl4c_stats_t *);
+int mnl4c_dump_stats(mnl4c_logger_t);
+int mnl4c_set_stats_interval(mnl4c_logger_t, double);
+int mnl4c_set_sanitize(mnl4c_logger_t, bool, size_t);
+int mnl4c_set_flush_latency(mnl4c_logger_t, double);
+#define MNL4C_DURABILITY_NONE 0
+#define MNL4C_DURABILITY_PERIODIC 1
+#define MNL4C_DURABILITY_GROUP 2
+int mnl4c_set_durability(mnl4c_logger_t, int, int, double);
+void mnl4c_crash_flush(void);
+int mnl4c_install_crash_handler(void);
 void mnl4c_init(void);
 void mnl4c_fini(void);
 
+/*
+ * Append helpers for the record prefix and the per-message serializers
+ * generated by l4cdefgen (<MOD>_<MSG>_WRITE), each returns the number of
+ * bytes appended, or -1.
+ */
+ssize_t mnl4c_bs_ll(mnbytestream_t *, long long);
+ssize_t mnl4c_bs_ull(mnbytestream_t *, unsigned long long);
+ssize_t mnl4c_bs_hex(mnbytestream_t *, unsigned long long, bool);
+ssize_t mnl4c_bs_fixed(mnbytestream_t *, double, int);
+#define MNL4C_FIXED_MAXLEN 32
+size_t mnl4c_fixed(char *, double, int);
+ssize_t mnl4c_bs_hexdump(mnbytestream_t *, const void *, size_t);
+ssize_t mnl4c_bs_base64(mnbytestream_t *, const void *, size_t);
+ssize_t mnl4c_bs_prefix(mnbytestream_t *,
+                        double,
+                        pid_t,
+                        const char *,
+                        const char *,
+                        int);
+
+#define MNL4C_BS_LIT(bs, s) bytestream_cat((bs), sizeof(s) - 1, (s))
+
+static inline ssize_t
+mnl4c_bs_str(mnbytestream_t *bs, const void *s)
+{
+    const char *p = (const char *)s;
+
+    if (p == NULL) {
+        p = "(null)";
+    }
+    return bytestream_cat(bs, strlen(p), p);
+}
+
+static inline ssize_t
+mnl4c_bs_chr(mnbytestream_t *bs, int c)
+{
+    char ch = (char)c;
+
+    return bytestream_cat(bs, 1, &ch);
+}
+
+/*
+ * Never called: keeps the printf format check on the arguments passed to
+ * a generated serializer.
+ */
+static inline void mnl4c_printflike(const char *, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static inline void
+mnl4c_printflike(UNUSED const char *fmt, ...)
+{
+}
+
+#define MNL4C_PRINTFLIKE_CHECK(fmt, ...)                                       \
+    (0 ? mnl4c_printflike(fmt, ##__VA_ARGS__) : (void)0)                       \
+
+
 UNUSED static const char *level_names[] = {
     "EMERG",
     "ALERT",
@@ -124,6 +600,139 @@ UNUSED static const char *level_names[] = {
 };
 
 
+/*
+ * Compile-time floor: sites logging below it, and messages defined below
+ * it, are compiled out.  l4cdefgen defines <MOD>_MIN_LEVEL to this unless
+ * overridden per module, e.g. -DMNL4C_MIN_LEVEL=LOG_INFO -DFOO_MIN_LEVEL=7.
+ */
+#ifndef MNL4C_MIN_LEVEL
+#   define MNL4C_MIN_LEVEL LOG_DEBUG
+#endif
+
+#define MNL4C_COMPILED(mod, msg, level)                                        \
+    ((level) <= mod ## _MIN_LEVEL &&                                           \
+     mod ## _ ## msg ## _LEVEL <= mod ## _MIN_LEVEL)                           \
+
+
+/*
+ * The statement is always type-checked, with a constant level it is
+ * folded away along with its format string.
+ */
+#define MNL4C_IF_COMPILED(mod, msg, level, stmt)                               \
+    do {                                                                       \
+        if (MNL4C_COMPILED(mod, msg, level)) {                                 \
+            stmt;                                                              \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+#define MNL4C_IF_COMPILED_FLEVEL(mod, msg, stmt)                               \
+    MNL4C_IF_COMPILED(mod, msg, mod ## _ ## msg ## _LEVEL, stmt)               \
+
+
+/*
+ * start/next/stop share a scope, start opens the guard, stop closes it
+ */
+#define MNL4C_IF_COMPILED_START(mod, msg, level)                               \
+    do {                                                                       \
+        if (MNL4C_COMPILED(mod, msg, level)) {                                 \
+
+
+#define MNL4C_IF_COMPILED_STOP                                                 \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+/*
+ * jump label site, see mnl4c_jump_t: falls through to the end of the
+ * enclosing do/while while patched into a nop, _mnl4c_on is declared
+ * local to the site with MNL4C_JUMP_LABEL
+ */
+#define MNL4C_STR_(x) #x
+#define MNL4C_STR(x) MNL4C_STR_(x)
+
+#ifdef MNL4C_HAVE_JUMP_LABELS
+#   ifdef __x86_64__
+/* a rel32 jmp, within one aligned 8-byte word so that it is on one page */
+#       define MNL4C_JUMP_INSN                                                 \
+    ".balign 8, , 4\n"                                                         \
+    "1:\n\t"                                                                   \
+    ".byte 0xe9\n\t"                                                           \
+    ".long %l[_mnl4c_on] - . - 4\n\t"                                          \
+
+#   else
+#       define MNL4C_JUMP_INSN                                                 \
+    "1:\n\t"                                                                   \
+    "b %l[_mnl4c_on]\n\t"                                                      \
+
+#   endif
+#   define MNL4C_JUMP_LABEL __label__ _mnl4c_on;
+#   define MNL4C_JUMP_SITE(mod, msg, level)                                    \
+    __asm__ goto(MNL4C_JUMP_INSN                                               \
+                 ".pushsection mnl4c_jump, \"aw\"\n\t"                         \
+                 ".balign 8\n\t"                                               \
+                 ".quad 1b, %l[_mnl4c_on], "                                   \
+                     MNL4C_STR(mod ## _LOGDEF_BASE) "\n\t"                     \
+                 ".long %c0, %c1, 1, 0\n\t"                                    \
+                 ".popsection"                                                 \
+                 :                                                             \
+                 : "i" (mod ## _ ## msg ## _IDX),                              \
+                   "i" (__builtin_constant_p(level) ? (level) : -2)            \
+                 :                                                             \
+                 : _mnl4c_on);                                                 \
+    break;                                                                     \
+_mnl4c_on:                                                                     \
+
+#else
+#   define MNL4C_JUMP_LABEL
+#   define MNL4C_JUMP_SITE(mod, msg, level)
+#endif
+
+
+/*
+ * slim site, and slim site context: everything past the enabled check is
+ * out of line, see mnl4c_ctx_emit()
+ */
+#define MNL4C_SITE(ld, level, flags, mod, msg, ...)                            \
+    do {                                                                       \
+        MNL4C_JUMP_LABEL                                                       \
+        mnl4c_ctx_t *_mnl4c_ctx;                                               \
+        MNL4C_JUMP_SITE(mod, msg, level)                                       \
+        _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
+        if (_mnl4c_ctx != NULL &&                                              \
+            mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+            mnl4c_ctx_emit(_mnl4c_ctx,                                         \
+                           level,                                              \
+                           mod ## _ ## msg ## _ID,                             \
+                           mod ## _NAME,                                       \
+                           flags,                                              \
+                           mod ## _ ## msg ## _VWRITE,                         \
+                           mod ## _ ## msg ## _FMT,                            \
+                           ##__VA_ARGS__);                                     \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+#define MNL4C_SITE_CONTEXT(ld, level, flags, context, mod, msg, ...)           \
+    do {                                                                       \
+        MNL4C_JUMP_LABEL                                                       \
+        mnl4c_ctx_t *_mnl4c_ctx;                                               \
+        MNL4C_JUMP_SITE(mod, msg, level)                                       \
+        _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
+        if (_mnl4c_ctx != NULL &&                                              \
+            mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+            mnl4c_ctx_emit(_mnl4c_ctx,                                         \
+                           level,                                              \
+                           mod ## _ ## msg ## _ID,                             \
+                           mod ## _NAME,                                       \
+                           flags,                                              \
+                           NULL,                                               \
+                           context mod ## _ ## msg ## _FMT,                    \
+                           ##__VA_ARGS__);                                     \
+        }                                                                      \
+    } while (0)                                                                \
+
+
 /*
  * may be flevel
  */
@@ -133,7 +742,7 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                           \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             _mnl4c_minfo = ARRAY_GET(                                          \
                 mnl4c_minfo_t,                                                 \
                 &_mnl4c_ctx->minfos,                                           \
@@ -142,6 +751,7 @@ UNUSED static const char *level_names[] = {
                                    _mnl4c_minfo->flevel,                       \
                                    mod ## _ ## msg ## _ID)) {                  \
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 double _mnl4c_curtm;                                           \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
                 _mnl4c_curtm = mnl4c_now_posix();                              \
@@ -150,33 +760,45 @@ UNUSED static const char *level_names[] = {
                         _mnl4c_curtm) {                                        \
                     _mnl4c_ctx->writer.data.file.curtm =                       \
                         _mnl4c_curtm;                                          \
-                    _mnl4c_nwritten = bytestream_nprintf(                      \
-                            &_mnl4c_ctx->bs,                                   \
-                            _mnl4c_ctx->bsbufsz,                               \
-                            "%.06lf [%d] %s %s[%d]:\t"                         \
-                            mod ## _ ## msg ## _FMT,                           \
-                            _mnl4c_ctx->writer.data.file.curtm,                \
-                            _mnl4c_ctx->cache.pid,                             \
+                    _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                      \
+                    _mnl4c_nwritten = mnl4c_ctx_prefix(                        \
+                            _mnl4c_ctx,                                        \
+                            mod ## _ ## msg ## _ID,                            \
                             mod ## _NAME,                                      \
-                            level_names[_mnl4c_minfo->flevel],                 \
-                            _mnl4c_minfo->                                     \
-                              nthrottled,                                      \
-                            ##__VA_ARGS__);                                    \
+                            _mnl4c_minfo->flevel,                              \
+                            _mnl4c_minfo->nthrottled);                         \
+                    if (_mnl4c_nwritten >= 0 &&                                \
+                            (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(      \
+                                    &_mnl4c_ctx->bs,                           \
+                                    _mnl4c_ctx->bsbufsz,                       \
+                                    ##__VA_ARGS__)) < 0) {                     \
+                        SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                  \
+                    }                                                          \
                     if (_mnl4c_nwritten < 0) {                                 \
                         bytestream_rewind(&_mnl4c_ctx->bs);                    \
                     } else {                                                   \
                         SADVANCEPOS(&_mnl4c_ctx->bs, -1);                      \
                         (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");        \
-                        if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {    \
-                            _mnl4c_ctx->writer.write(_mnl4c_ctx);              \
-                        }                                                      \
+                        mnl4c_ctx_commit(_mnl4c_ctx,                           \
+                                         _mnl4c_minfo->flevel,                 \
+                                         _mnl4c_start,                         \
+                                         false);                               \
                     }                                                          \
                     _mnl4c_minfo->nthrottled = 0;                              \
                 } else {                                                       \
                     ++_mnl4c_minfo->nthrottled;                                \
+                    ++_mnl4c_ctx->stats.nthrottled;                            \
+                    ++_mnl4c_minfo->nthrottled_total;                          \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >=                    \
+                                  _mnl4c_minfo->flevel)) {                     \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 _mnl4c_minfo->flevel,                         \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -193,7 +815,7 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                           \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             _mnl4c_minfo = ARRAY_GET(                                          \
                 mnl4c_minfo_t,                                                 \
                 &_mnl4c_ctx->minfos,                                           \
@@ -202,6 +824,7 @@ UNUSED static const char *level_names[] = {
                                    _mnl4c_minfo->flevel,                       \
                                    mod ## _ ## msg ## _ID)) {                  \
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 double _mnl4c_curtm;                                           \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
                 _mnl4c_curtm = mnl4c_now_posix();                              \
@@ -211,6 +834,7 @@ UNUSED static const char *level_names[] = {
                         _mnl4c_curtm) {                                        \
                     _mnl4c_ctx->writer.data.file.curtm =                       \
                         _mnl4c_curtm;                                          \
+                    _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                      \
                     _mnl4c_nwritten = bytestream_nprintf(                      \
                             &_mnl4c_ctx->bs,                                   \
                             _mnl4c_ctx->bsbufsz,                               \
@@ -230,16 +854,27 @@ UNUSED static const char *level_names[] = {
                     } else {                                                   \
                         SADVANCEPOS(&_mnl4c_ctx->bs, -1);                      \
                         (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");        \
-                        if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {    \
-                            _mnl4c_ctx->writer.write(_mnl4c_ctx);              \
-                        }                                                      \
+                        mnl4c_ctx_commit(_mnl4c_ctx,                           \
+                                         _mnl4c_minfo->flevel,                 \
+                                         _mnl4c_start,                         \
+                                         false);                               \
                     }                                                          \
                     _mnl4c_minfo->nthrottled = 0;                              \
                 } else {                                                       \
                     ++_mnl4c_minfo->nthrottled;                                \
+                    ++_mnl4c_ctx->stats.nthrottled;                            \
+                    ++_mnl4c_minfo->nthrottled_total;                          \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >=                    \
+                                  _mnl4c_minfo->flevel)) {                     \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 _mnl4c_minfo->flevel,                         \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 context                                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -254,9 +889,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 double _mnl4c_curtm;                                           \
                 mnl4c_minfo_t *_mnl4c_minfo;                                   \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
@@ -268,33 +904,44 @@ UNUSED static const char *level_names[] = {
                 if (_mnl4c_ctx->writer.data.file.curtm +                       \
                         _mnl4c_minfo->throttle_threshold <= _mnl4c_curtm) {    \
                     _mnl4c_ctx->writer.data.file.curtm = _mnl4c_curtm;         \
-                    _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,      \
-                                                  _mnl4c_ctx->bsbufsz,         \
-                                                  "%.06lf [%d] %s %s[%d]:\t"   \
-                                                  mod ## _ ## msg ## _FMT,     \
-                                                  _mnl4c_ctx->                 \
-                                                    writer.data.file.curtm,    \
-                                                  _mnl4c_ctx->cache.pid,       \
-                                                  mod ## _NAME,                \
-                                                  level_names[level],          \
-                                                  _mnl4c_minfo->               \
-                                                    nthrottled,                \
-                                                  ##__VA_ARGS__);              \
+                    _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                      \
+                    _mnl4c_nwritten = mnl4c_ctx_prefix(                        \
+                            _mnl4c_ctx,                                        \
+                            mod ## _ ## msg ## _ID,                            \
+                            mod ## _NAME,                                      \
+                            level,                                             \
+                            _mnl4c_minfo->nthrottled);                         \
+                    if (_mnl4c_nwritten >= 0 &&                                \
+                            (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(      \
+                                    &_mnl4c_ctx->bs,                           \
+                                    _mnl4c_ctx->bsbufsz,                       \
+                                    ##__VA_ARGS__)) < 0) {                     \
+                        SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                  \
+                    }                                                          \
                     if (_mnl4c_nwritten < 0) {                                 \
                         bytestream_rewind(&_mnl4c_ctx->bs);                    \
                     } else {                                                   \
                         SADVANCEPOS(&_mnl4c_ctx->bs, -1);                      \
                         (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");        \
-                        if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {    \
-                            _mnl4c_ctx->writer.write(_mnl4c_ctx);              \
-                        }                                                      \
+                        mnl4c_ctx_commit(_mnl4c_ctx,                           \
+                                         level,                                \
+                                         _mnl4c_start,                         \
+                                         false);                               \
                     }                                                          \
                     _mnl4c_minfo->nthrottled = 0;                              \
                 } else {                                                       \
                     ++_mnl4c_minfo->nthrottled;                                \
+                    ++_mnl4c_ctx->stats.nthrottled;                            \
+                    ++_mnl4c_minfo->nthrottled_total;                          \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -310,9 +957,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 double _mnl4c_curtm;                                           \
                 mnl4c_minfo_t *_mnl4c_minfo;                                   \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
@@ -325,6 +973,7 @@ UNUSED static const char *level_names[] = {
                 if (_mnl4c_ctx->writer.data.file.curtm +                       \
                         _mnl4c_minfo->throttle_threshold <= _mnl4c_curtm) {    \
                     _mnl4c_ctx->writer.data.file.curtm = _mnl4c_curtm;         \
+                    _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                      \
                     _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,      \
                                                   _mnl4c_ctx->bsbufsz,         \
                                                   "%.06lf [%d] %s %s[%d]:\t"   \
@@ -343,16 +992,26 @@ UNUSED static const char *level_names[] = {
                     } else {                                                   \
                         SADVANCEPOS(&_mnl4c_ctx->bs, -1);                      \
                         (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");        \
-                        if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {    \
-                            _mnl4c_ctx->writer.write(_mnl4c_ctx);              \
-                        }                                                      \
+                        mnl4c_ctx_commit(_mnl4c_ctx,                           \
+                                         level,                                \
+                                         _mnl4c_start,                         \
+                                         false);                               \
                     }                                                          \
                     _mnl4c_minfo->nthrottled = 0;                              \
                 } else {                                                       \
                     ++_mnl4c_minfo->nthrottled;                                \
+                    ++_mnl4c_ctx->stats.nthrottled;                            \
+                    ++_mnl4c_minfo->nthrottled_total;                          \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 context                                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -368,7 +1027,7 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                           \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             _mnl4c_minfo = ARRAY_GET(                                          \
                 mnl4c_minfo_t,                                                 \
                 &_mnl4c_ctx->minfos,                                           \
@@ -377,27 +1036,42 @@ UNUSED static const char *level_names[] = {
                                    _mnl4c_minfo->flevel,                       \
                                    mod ## _ ## msg ## _ID)) {                  \
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
                 _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();        \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s:\t"               \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[_mnl4c_minfo->flevel],   \
-                                          ##__VA_ARGS__);                      \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
+                _mnl4c_nwritten = mnl4c_ctx_prefix(                            \
+                        _mnl4c_ctx,                                            \
+                        mod ## _ ## msg ## _ID,                                \
+                        mod ## _NAME,                                          \
+                        _mnl4c_minfo->flevel,                                  \
+                        -1);                                                   \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
                 if (_mnl4c_nwritten < 0) {                                     \
                     bytestream_rewind(&_mnl4c_ctx->bs);                        \
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     _mnl4c_minfo->flevel,                     \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >=                    \
+                                  _mnl4c_minfo->flevel)) {                     \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 _mnl4c_minfo->flevel,                         \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -413,7 +1087,7 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                           \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             _mnl4c_minfo = ARRAY_GET(                                          \
                 mnl4c_minfo_t,                                                 \
                 &_mnl4c_ctx->minfos,                                           \
@@ -422,8 +1096,10 @@ UNUSED static const char *level_names[] = {
                                    _mnlc3_minfo->flevel,                       \
                                    mod ## _ ## msg ## _ID)) {                  \
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
                 _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();        \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                           _mnl4c_ctx->bsbufsz,                 \
                                           "%.06lf [%d] %s %s:\t"               \
@@ -440,10 +1116,21 @@ UNUSED static const char *level_names[] = {
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     _mnl4c_minfo->flevel,                     \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >=                    \
+                                  _mnl4c_minfo->flevel)) {                     \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 _mnl4c_minfo->flevel,                         \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 context                                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -458,30 +1145,44 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
                 _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();        \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
-                                              _mnl4c_ctx->bsbufsz,             \
-                                              "%.06lf [%d] %s %s:\t"           \
-                                              mod ## _ ## msg ## _FMT,         \
-                                              _mnl4c_ctx->                     \
-                                                writer.data.file.curtm,        \
-                                              _mnl4c_ctx->cache.pid,           \
-                                              mod ## _NAME,                    \
-                                              level_names[level],              \
-                                              ##__VA_ARGS__);                  \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
+                _mnl4c_nwritten = mnl4c_ctx_prefix(                            \
+                        _mnl4c_ctx,                                            \
+                        mod ## _ ## msg ## _ID,                                \
+                        mod ## _NAME,                                          \
+                        level,                                                 \
+                        -1);                                                   \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
                 if (_mnl4c_nwritten < 0) {                                     \
                     bytestream_rewind(&_mnl4c_ctx->bs);                        \
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     level,                                    \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -496,11 +1197,13 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 assert(_mnl4c_ctx->writer.write != NULL);                      \
                 _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();        \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                               _mnl4c_ctx->bsbufsz,             \
                                               "%.06lf [%d] %s %s:\t"           \
@@ -517,10 +1220,20 @@ UNUSED static const char *level_names[] = {
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     level,                                    \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 context                                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -535,9 +1248,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -549,24 +1263,39 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                               _mnl4c_ctx->bsbufsz,             \
-                                              "%s [%d] %s %s:\t"               \
-                                              mod ## _ ## msg ## _FMT,         \
+                                              "%s [%d] %s %s:\t",              \
                                               _mnl4c_now_str,                  \
                                               _mnl4c_ctx->cache.pid,           \
                                               mod ## _NAME,                    \
-                                              level_names[level],              \
-                                              ##__VA_ARGS__);                  \
+                                              level_names[level]);             \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
                 if (_mnl4c_nwritten < 0) {                                     \
                     bytestream_rewind(&_mnl4c_ctx->bs);                        \
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     level,                                    \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -582,9 +1311,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -596,6 +1326,7 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                               _mnl4c_ctx->bsbufsz,             \
                                               "%s [%d] %s %s:\t"               \
@@ -611,10 +1342,20 @@ UNUSED static const char *level_names[] = {
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     level,                                    \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 context                                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -629,9 +1370,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -643,25 +1385,40 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%lf %s [%d] %s %s:\t"               \
-                                          mod ## _ ## msg ## _FMT,             \
+                                          "%lf %s [%d] %s %s:\t",              \
                                           _mnl4c_ctx->writer.data.file.curtm,  \
                                           _mnl4c_now_str,                      \
                                           _mnl4c_ctx->cache.pid,               \
                                           mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
+                                          level_names[level]);                 \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
                 if (_mnl4c_nwritten < 0) {                                     \
                     bytestream_rewind(&_mnl4c_ctx->bs);                        \
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     level,                                    \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -677,9 +1434,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -691,6 +1449,7 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                           _mnl4c_ctx->bsbufsz,                 \
                                           "%lf %s [%d] %s %s:\t"               \
@@ -707,10 +1466,20 @@ UNUSED static const char *level_names[] = {
                 } else {                                                       \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);                      \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                               \
+                                     level,                                    \
+                                     _mnl4c_start,                             \
+                                     true);                                    \
                 }                                                              \
+            } else if (MNUNLIKELY(_mnl4c_ctx->rec.rlevel >= level)) {          \
+                mnl4c_ctx_record(_mnl4c_ctx,                                   \
+                                 level,                                        \
+                                 mod ## _ ## msg ## _ID,                       \
+                                 context                                       \
+                                 mod ## _ ## msg ## _FMT,                      \
+                                 ##__VA_ARGS__);                               \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
@@ -725,20 +1494,25 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();        \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
-                                              _mnl4c_ctx->bsbufsz,             \
-                                              "%.06lf [%d] %s %s:\t"           \
-                                              mod ## _ ## msg ## _FMT,         \
-                                              _mnl4c_ctx->                     \
-                                                writer.data.file.curtm,        \
-                                              _mnl4c_ctx->cache.pid,           \
-                                              mod ## _NAME,                    \
-                                              level_names[level],              \
-                                              ##__VA_ARGS__);                  \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
+                _mnl4c_nwritten = mnl4c_ctx_prefix(                            \
+                        _mnl4c_ctx,                                            \
+                        mod ## _ ## msg ## _ID,                                \
+                        mod ## _NAME,                                          \
+                        level,                                                 \
+                        -1);                                                   \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
 
 
 /*
@@ -750,10 +1524,12 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();        \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                               _mnl4c_ctx->bsbufsz,             \
                                               "%.06lf [%d] %s %s:\t"           \
@@ -775,9 +1551,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -788,15 +1565,21 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                               _mnl4c_ctx->bsbufsz,             \
-                                              "%s [%d] %s %s:\t"               \
-                                              mod ## _ ## msg ## _FMT,         \
+                                              "%s [%d] %s %s:\t",              \
                                               _mnl4c_now_str,                  \
                                               _mnl4c_ctx->cache.pid,           \
                                               mod ## _NAME,                    \
-                                              level_names[level],              \
-                                              ##__VA_ARGS__);                  \
+                                              level_names[level]);             \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
 
 
 /*
@@ -808,9 +1591,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -821,6 +1605,7 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                               _mnl4c_ctx->bsbufsz,             \
                                               "%s [%d] %s %s:\t"               \
@@ -841,9 +1626,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -854,16 +1640,22 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%lf %s [%d] %s %s:\t"               \
-                                          mod ## _ ## msg ## _FMT,             \
+                                          "%lf %s [%d] %s %s:\t",              \
                                           _mnl4c_ctx->writer.data.file.curtm,  \
                                           _mnl4c_now_str,                      \
                                           _mnl4c_ctx->cache.pid,               \
                                           mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
+                                          level_names[level]);                 \
+                if (_mnl4c_nwritten >= 0 &&                                    \
+                        (_mnl4c_nwritten = mod ## _ ## msg ## _WRITE(          \
+                                &_mnl4c_ctx->bs,                               \
+                                _mnl4c_ctx->bsbufsz,                           \
+                                ##__VA_ARGS__)) < 0) {                         \
+                    SEOD(&_mnl4c_ctx->bs) = _mnl4c_start;                      \
+                }                                                              \
 
 
 /*
@@ -875,9 +1667,10 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 ssize_t _mnl4c_nwritten;                                       \
+                off_t _mnl4c_start;                                            \
                 struct tm *_mnl4c_tm;                                          \
                 time_t _mtkl4c_now;                                            \
                 char _mnl4c_now_str[32];                                       \
@@ -888,6 +1681,7 @@ UNUSED static const char *level_names[] = {
                                sizeof(_mnl4c_now_str),                         \
                                "%Y-%m-%dT%H:%M:%S",                            \
                                _mnl4c_tm);                                     \
+                _mnl4c_start = SEOD(&_mnl4c_ctx->bs);                          \
                 _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
                                           _mnl4c_ctx->bsbufsz,                 \
                                           "%lf %s [%d] %s %s:\t"               \
@@ -931,15 +1725,17 @@ UNUSED static const char *level_names[] = {
                     bytestream_rewind(&_mnl4c_ctx->bs);                \
                 } else {                                               \
                     SADVANCEPOS(&_mnl4c_ctx->bs, -1);                  \
-                    (void)bytestream_nprintf(&_mnl4c_ctx->bs,          \
-                                             _mnl4c_ctx->bsbufsz,      \
-                                             mod ## _ ## msg ## _FMT,  \
-                                             ##__VA_ARGS__);           \
+                    (void)mod ## _ ## msg ## _WRITE(&_mnl4c_ctx->bs,   \
+                                                    _mnl4c_ctx->bsbufsz,\
+                                                    ##__VA_ARGS__);    \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");    \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);              \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                       \
+                                     level,                            \
+                                     _mnl4c_start,                     \
+                                     true);                            \
                 }                                                      \
             }                                                          \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);              \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                              \
         } else {                                                       \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);           \
         }                                                              \
@@ -962,10 +1758,13 @@ UNUSED static const char *level_names[] = {
                                              mod ## _ ## msg ## _FMT,  \
                                              ##__VA_ARGS__);           \
                     (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");    \
-                    _mnl4c_ctx->writer.write(_mnl4c_ctx);              \
+                    mnl4c_ctx_commit(_mnl4c_ctx,                       \
+                                     level,                            \
+                                     _mnl4c_start,                     \
+                                     true);                            \
                 }                                                      \
             }                                                          \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);              \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                              \
         } else {                                                       \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);           \
         }                                                              \
@@ -973,6 +1772,28 @@ UNUSED static const char *level_names[] = {
 
 
 
+/*
+ * sigsafe: no malloc, stdio, locale or locking, the record is written
+ * straight to the writer's descriptor.  Floating point conversions are
+ * rendered as fixed point, %n and wide conversions are not supported.
+ */
+#define MNL4C_WRITE_SIGSAFE(ld, level, mod, msg, ...)                          \
+    do {                                                                       \
+        mnl4c_ctx_t *_mnl4c_ctx;                                               \
+        _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
+        if (_mnl4c_ctx != NULL &&                                              \
+            mnl4c_ctx_allowed_sigsafe(_mnl4c_ctx,                              \
+                                      level,                                   \
+                                      mod ## _ ## msg ## _ID)) {               \
+            mnl4c_ctx_write_sigsafe(_mnl4c_ctx,                                \
+                                    level,                                     \
+                                    mod ## _NAME,                              \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    ##__VA_ARGS__);                            \
+        }                                                                      \
+    } while (0)                                                                \
+
+
 /*
  * do at
  */
@@ -981,11 +1802,11 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         if (_mnl4c_ctx != NULL) {                                              \
-            (void)pthread_mutex_lock(&_mnl4c_ctx->mtx);                        \
+            mnl4c_ctx_lock(_mnl4c_ctx);                                        \
             if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {\
                 __a1                                                           \
             }                                                                  \
-            (void)pthread_mutex_unlock(&_mnl4c_ctx->mtx);                      \
+            mnl4c_ctx_unlock(_mnl4c_ctx);                                      \
         } else {                                                               \
             TRACE("_mnl4c_ctx was NULL, not logging " #mod);                   \
         }                                                                      \
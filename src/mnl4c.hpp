@@ -0,0 +1,983 @@
+#ifndef MNL4C_HPP_DEFINED
+#define MNL4C_HPP_DEFINED
+
+/*
+ * C++17 front end.  Message formats from l4cdefgen --cxx descriptors are
+ * parsed at compile time, argument types are checked against them, and
+ * records are rendered by per-type writers straight into the context
+ * buffer, without a printf pass over the whole record.
+ *
+ *  mnl4c::log<foo_logdef::FOO::QWE>(logger, LOG_INFO, 1, 2.0, "x");
+ *  mnl4c::log_lt<foo_logdef::FOO::QWE>(logger, LOG_ERR, 1, 2.0, "x");
+ *  {
+ *      mnl4c::record<foo_logdef::FOO::ASD> r(logger, LOG_DEBUG, "start");
+ *      r << ' ' << 1 << ' ' << 2.0;
+ *  }
+ */
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/* mncommon headers carry no linkage of their own */
+extern "C" {
+#include <mnl4c.h>
+}
+
+namespace mnl4c {
+
+namespace detail {
+
+enum : unsigned char {
+    CONV_SINT,
+    CONV_UINT,
+    CONV_HEX,
+    CONV_UHEX,
+    CONV_OCT,
+    CONV_CHR,
+    CONV_DBL,       /* %f, rendered natively */
+    CONV_DBL_OTHER, /* %e %g %a, one snprintf per value */
+    CONV_STR,
+    CONV_PTR,
+};
+
+enum : unsigned char {
+    FL_LEFT = 0x01,
+    FL_ZERO = 0x02,
+    FL_PLUS = 0x04,
+    FL_SPACE = 0x08,
+    FL_ALT = 0x10,
+};
+
+struct spec {
+    /* literal text before the conversion */
+    unsigned short lit;
+    unsigned short litlen;
+    unsigned char conv;
+    unsigned char flags;
+    char c;
+    short width;
+    /* -1 if not given */
+    short prec;
+};
+
+template <std::size_t N>
+struct format_t {
+    spec specs[N > 0 ? N : 1];
+    unsigned short tail;
+    unsigned short taillen;
+};
+
+
+constexpr std::size_t
+count_specs(const char *f)
+{
+    std::size_t n = 0;
+
+    for (; *f != '\0'; ++f) {
+        if (*f == '%') {
+            if (f[1] == '%') {
+                ++f;
+            } else {
+                ++n;
+            }
+        }
+    }
+    return n;
+}
+
+
+/*
+ * Throws, and so fails compilation, on anything the writers below do not
+ * support.
+ */
+template <std::size_t N>
+constexpr format_t<N>
+parse(const char *f)
+{
+    format_t<N> res{};
+    std::size_t i = 0, n = 0, lit = 0;
+
+    while (f[i] != '\0') {
+        spec s{};
+
+        if (f[i] != '%') {
+            ++i;
+            continue;
+        }
+        if (f[i + 1] == '%') {
+            i += 2;
+            continue;
+        }
+        s.lit = lit;
+        s.litlen = i - lit;
+        s.prec = -1;
+        for (++i;; ++i) {
+            if (f[i] == '-') {
+                s.flags |= FL_LEFT;
+            } else if (f[i] == '0') {
+                s.flags |= FL_ZERO;
+            } else if (f[i] == '+') {
+                s.flags |= FL_PLUS;
+            } else if (f[i] == ' ') {
+                s.flags |= FL_SPACE;
+            } else if (f[i] == '#') {
+                s.flags |= FL_ALT;
+            } else {
+                break;
+            }
+        }
+        for (; f[i] >= '0' && f[i] <= '9'; ++i) {
+            s.width = s.width * 10 + (f[i] - '0');
+        }
+        if (f[i] == '.') {
+            s.prec = 0;
+            for (++i; f[i] >= '0' && f[i] <= '9'; ++i) {
+                s.prec = s.prec * 10 + (f[i] - '0');
+            }
+        }
+        if (f[i] == '*') {
+            throw "mnl4c: '*' width and precision are not supported";
+        }
+        /* the writers take the argument's own type */
+        while (f[i] == 'h' || f[i] == 'l' || f[i] == 'L' || f[i] == 'q' ||
+               f[i] == 'j' || f[i] == 'z' || f[i] == 't') {
+            ++i;
+        }
+        switch (f[i]) {
+        case 'd':
+        case 'i':
+            s.conv = CONV_SINT;
+            break;
+        case 'u':
+            s.conv = CONV_UINT;
+            break;
+        case 'x':
+            s.conv = CONV_HEX;
+            break;
+        case 'X':
+            s.conv = CONV_UHEX;
+            break;
+        case 'o':
+            s.conv = CONV_OCT;
+            break;
+        case 'c':
+            s.conv = CONV_CHR;
+            break;
+        case 'f':
+        case 'F':
+            s.conv = CONV_DBL;
+            break;
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            s.conv = CONV_DBL_OTHER;
+            break;
+        case 's':
+            s.conv = CONV_STR;
+            break;
+        case 'p':
+            s.conv = CONV_PTR;
+            break;
+        default:
+            throw "mnl4c: unsupported conversion";
+        }
+        s.c = f[i];
+        ++i;
+        lit = i;
+        res.specs[n++] = s;
+    }
+    res.tail = lit;
+    res.taillen = i - lit;
+    return res;
+}
+
+
+template <typename M>
+inline constexpr auto format_v = parse<count_specs(M::fmt)>(M::fmt);
+
+
+template <typename T>
+constexpr bool
+accepts(unsigned char conv)
+{
+    using U = std::decay_t<T>;
+
+    switch (conv) {
+    case CONV_SINT:
+    case CONV_UINT:
+    case CONV_HEX:
+    case CONV_UHEX:
+    case CONV_OCT:
+    case CONV_CHR:
+        return std::is_integral_v<U> || std::is_enum_v<U>;
+    case CONV_DBL:
+    case CONV_DBL_OTHER:
+        return std::is_floating_point_v<U>;
+    case CONV_STR:
+        return std::is_same_v<U, char *> ||
+               std::is_same_v<U, const char *> ||
+               std::is_convertible_v<const T &, std::string_view>;
+    case CONV_PTR:
+        return std::is_pointer_v<U> || std::is_null_pointer_v<U>;
+    default:
+        return false;
+    }
+}
+
+
+template <typename M, typename... A, std::size_t... I>
+constexpr bool
+args_match(std::index_sequence<I...>)
+{
+    return (accepts<A>(format_v<M>.specs[I].conv) && ...);
+}
+
+
+template <typename M, typename... A>
+constexpr void
+check()
+{
+    static_assert(count_specs(M::fmt) == sizeof...(A),
+                  "mnl4c: argument count does not match the message format");
+    if constexpr (count_specs(M::fmt) == sizeof...(A)) {
+        static_assert(args_match<M, A...>(std::index_sequence_for<A...>{}),
+                      "mnl4c: argument type does not match the message "
+                      "format");
+    }
+}
+
+
+/*
+ * Fixed buffer, truncating, snprintf semantics.
+ */
+class buffer_out {
+public:
+    buffer_out(char *buf, std::size_t sz) : buf_(buf), sz_(sz), len_(0) {}
+
+    void
+    put(const char *s, std::size_t n)
+    {
+        if (len_ + 1 < sz_) {
+            std::size_t avail = sz_ - 1 - len_;
+            std::memcpy(buf_ + len_, s, n < avail ? n : avail);
+        }
+        len_ += n;
+    }
+
+    void
+    fill(char c, std::size_t n)
+    {
+        if (len_ + 1 < sz_) {
+            std::size_t avail = sz_ - 1 - len_;
+            std::memset(buf_ + len_, c, n < avail ? n : avail);
+        }
+        len_ += n;
+    }
+
+    std::size_t
+    finish()
+    {
+        if (sz_ > 0) {
+            buf_[len_ < sz_ ? len_ : sz_ - 1] = '\0';
+        }
+        return len_;
+    }
+
+private:
+    char *buf_;
+    std::size_t sz_;
+    std::size_t len_;
+};
+
+
+/*
+ * Context bytestream, staged through a stack chunk.
+ */
+class stream_out {
+public:
+    explicit stream_out(mnbytestream_t *bs) : bs_(bs), n_(0) {}
+
+    ~stream_out()
+    {
+        flush();
+    }
+
+    stream_out(const stream_out &) = delete;
+    stream_out &operator=(const stream_out &) = delete;
+
+    void
+    put(const char *s, std::size_t n)
+    {
+        if (n_ + n > sizeof(chunk_)) {
+            flush();
+            if (n > sizeof(chunk_)) {
+                (void)bytestream_cat(bs_, n, s);
+                return;
+            }
+        }
+        std::memcpy(chunk_ + n_, s, n);
+        n_ += n;
+    }
+
+    void
+    fill(char c, std::size_t n)
+    {
+        while (n > 0) {
+            std::size_t k;
+
+            if (n_ == sizeof(chunk_)) {
+                flush();
+            }
+            k = sizeof(chunk_) - n_;
+            k = n < k ? n : k;
+            std::memset(chunk_ + n_, c, k);
+            n_ += k;
+            n -= k;
+        }
+    }
+
+    void
+    flush()
+    {
+        if (n_ > 0) {
+            (void)bytestream_cat(bs_, n_, chunk_);
+            n_ = 0;
+        }
+    }
+
+private:
+    mnbytestream_t *bs_;
+    std::size_t n_;
+    char chunk_[256];
+};
+
+
+template <typename Out>
+inline void
+put_literal(Out &out, const char *p, std::size_t n)
+{
+    const void *q;
+
+    /* "%%" */
+    while ((q = std::memchr(p, '%', n)) != nullptr) {
+        std::size_t k = static_cast<const char *>(q) - p + 1;
+
+        out.put(p, k);
+        p += k + 1;
+        n -= k + 1;
+    }
+    out.put(p, n);
+}
+
+
+template <typename Out>
+inline void
+put_field(Out &out,
+          const spec &s,
+          const char *pfx,
+          std::size_t npfx,
+          const char *p,
+          std::size_t n,
+          bool zeroable)
+{
+    std::size_t len = npfx + n;
+    std::size_t width = s.width;
+
+    if (width <= len) {
+        out.put(pfx, npfx);
+        out.put(p, n);
+    } else if (s.flags & FL_LEFT) {
+        out.put(pfx, npfx);
+        out.put(p, n);
+        out.fill(' ', width - len);
+    } else if ((s.flags & FL_ZERO) && zeroable) {
+        out.put(pfx, npfx);
+        out.fill('0', width - len);
+        out.put(p, n);
+    } else {
+        out.fill(' ', width - len);
+        out.put(pfx, npfx);
+        out.put(p, n);
+    }
+}
+
+
+inline char *
+utoa(char *end, unsigned long long u, unsigned base, bool upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    do {
+        *--end = digits[u % base];
+        u /= base;
+    } while (u != 0);
+    return end;
+}
+
+
+template <typename T>
+constexpr auto
+as_int(T v)
+{
+    if constexpr (std::is_enum_v<T>) {
+        return +static_cast<std::underlying_type_t<T>>(v);
+    } else {
+        /* integer promotions, as in a varargs call */
+        return +v;
+    }
+}
+
+
+template <typename Out, typename T>
+inline void
+write_int(Out &out, const spec &s, T v)
+{
+    using I = decltype(as_int(v));
+    char tmp[72];
+    char *end = tmp + sizeof(tmp);
+    char *p;
+    char pfx[2];
+    std::size_t npfx = 0;
+    unsigned long long u;
+    I x = as_int(v);
+
+    if (s.conv == CONV_CHR) {
+        char c = static_cast<char>(x);
+
+        put_field(out, s, nullptr, 0, &c, 1, false);
+        return;
+    }
+
+    if (s.conv == CONV_SINT) {
+        long long sx = static_cast<long long>(x);
+
+        if (sx < 0) {
+            pfx[npfx++] = '-';
+            u = 0ull - static_cast<unsigned long long>(sx);
+        } else {
+            u = static_cast<unsigned long long>(sx);
+            if (s.flags & FL_PLUS) {
+                pfx[npfx++] = '+';
+            } else if (s.flags & FL_SPACE) {
+                pfx[npfx++] = ' ';
+            }
+        }
+    } else {
+        u = static_cast<std::make_unsigned_t<I>>(x);
+    }
+
+    if (s.prec == 0 && u == 0) {
+        p = end;
+    } else if (s.conv == CONV_HEX || s.conv == CONV_UHEX) {
+        p = utoa(end, u, 16, s.conv == CONV_UHEX);
+        if ((s.flags & FL_ALT) && u != 0) {
+            pfx[npfx++] = '0';
+            pfx[npfx++] = s.c;
+        }
+    } else if (s.conv == CONV_OCT) {
+        p = utoa(end, u, 8, false);
+        if ((s.flags & FL_ALT) && *p != '0') {
+            *--p = '0';
+        }
+    } else {
+        p = utoa(end, u, 10, false);
+    }
+
+    if (s.prec >= 0) {
+        /* minimum number of digits, zero flag ignored */
+        while (end - p < s.prec && p > tmp) {
+            *--p = '0';
+        }
+        put_field(out, s, pfx, npfx, p, end - p, false);
+    } else {
+        put_field(out, s, pfx, npfx, p, end - p, true);
+    }
+}
+
+
+template <typename Out>
+inline void
+write_dbl_other(Out &out, const spec &s, double v)
+{
+    char fmt[32];
+    char *f = fmt;
+    char tmp[512];
+    char num[8];
+    char *end = num + sizeof(num);
+    char *p;
+    int n;
+
+    /* rebuild the conversion without its length modifiers */
+    *f++ = '%';
+    if (s.flags & FL_LEFT) {
+        *f++ = '-';
+    }
+    if (s.flags & FL_ZERO) {
+        *f++ = '0';
+    }
+    if (s.flags & FL_PLUS) {
+        *f++ = '+';
+    }
+    if (s.flags & FL_SPACE) {
+        *f++ = ' ';
+    }
+    if (s.flags & FL_ALT) {
+        *f++ = '#';
+    }
+    if (s.width > 0) {
+        p = utoa(end, s.width, 10, false);
+        std::memcpy(f, p, end - p);
+        f += end - p;
+    }
+    if (s.prec >= 0) {
+        *f++ = '.';
+        p = utoa(end, s.prec, 10, false);
+        std::memcpy(f, p, end - p);
+        f += end - p;
+    }
+    *f++ = s.c;
+    *f = '\0';
+    n = std::snprintf(tmp, sizeof(tmp), fmt, v);
+    if (n > 0) {
+        out.put(tmp, (std::size_t)n < sizeof(tmp) ? n : sizeof(tmp) - 1);
+    }
+}
+
+
+/*
+ * %f without printf for |v| < 1e15 and precision up to 9, the digits
+ * come from mnl4c_fixed(), as for the C serializers.
+ */
+template <typename Out>
+inline void
+write_fixed(Out &out, const spec &s, double v)
+{
+    int prec = s.prec < 0 ? 6 : s.prec;
+    char tmp[MNL4C_FIXED_MAXLEN + 1];
+    char pfx[1];
+    std::size_t npfx = 0;
+    std::size_t n;
+
+    if (!(std::fabs(v) < 1e15) || prec > 9) {
+        spec t = s;
+
+        t.conv = CONV_DBL_OTHER;
+        write_dbl_other(out, t, v);
+        return;
+    }
+    if (std::signbit(v)) {
+        pfx[npfx++] = '-';
+    } else if (s.flags & FL_PLUS) {
+        pfx[npfx++] = '+';
+    } else if (s.flags & FL_SPACE) {
+        pfx[npfx++] = ' ';
+    }
+
+    n = mnl4c_fixed(tmp, v, prec);
+    if (prec == 0 && (s.flags & FL_ALT)) {
+        tmp[n++] = '.';
+    }
+    put_field(out, s, pfx, npfx, tmp, n, true);
+}
+
+
+template <typename Out, typename T>
+inline void
+write_str(Out &out, const spec &s, const T &v)
+{
+    using U = std::decay_t<T>;
+    const char *p;
+    std::size_t n;
+
+    if constexpr (std::is_same_v<U, char *> ||
+                  std::is_same_v<U, const char *>) {
+        p = v;
+        if (p == nullptr) {
+            p = "(null)";
+        }
+        /* do not read past the precision */
+        n = s.prec >= 0 ? strnlen(p, s.prec) : std::strlen(p);
+    } else {
+        std::string_view sv(v);
+
+        p = sv.data();
+        n = sv.size();
+        if (s.prec >= 0 && (std::size_t)s.prec < n) {
+            n = s.prec;
+        }
+    }
+    put_field(out, s, nullptr, 0, p, n, false);
+}
+
+
+template <typename Out, typename T>
+inline void
+write_ptr(Out &out, const spec &s, T v)
+{
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    uintptr_t u = reinterpret_cast<uintptr_t>(
+        static_cast<const volatile void *>(v));
+
+    if (u == 0) {
+        put_field(out, s, nullptr, 0, "(nil)", 5, false);
+    } else {
+        char *p = utoa(end, u, 16, false);
+
+        put_field(out, s, "0x", 2, p, end - p, false);
+    }
+}
+
+
+template <typename Out, typename T>
+inline void
+write_value(Out &out, const spec &s, const T &v)
+{
+    using U = std::decay_t<T>;
+
+    if constexpr (std::is_integral_v<U> || std::is_enum_v<U>) {
+        write_int(out, s, v);
+    } else if constexpr (std::is_floating_point_v<U>) {
+        if (s.conv == CONV_DBL) {
+            write_fixed(out, s, static_cast<double>(v));
+        } else {
+            write_dbl_other(out, s, static_cast<double>(v));
+        }
+    } else if constexpr (std::is_null_pointer_v<U>) {
+        write_ptr(out, s, static_cast<const void *>(nullptr));
+    } else if constexpr (std::is_pointer_v<U> &&
+                         !std::is_same_v<U, char *> &&
+                         !std::is_same_v<U, const char *>) {
+        write_ptr(out, s, v);
+    } else if constexpr (std::is_same_v<U, char *> ||
+                         std::is_same_v<U, const char *>) {
+        if (s.conv == CONV_PTR) {
+            write_ptr(out, s, static_cast<const void *>(v));
+        } else {
+            write_str(out, s, v);
+        }
+    } else {
+        write_str(out, s, v);
+    }
+}
+
+
+template <typename M, typename Out, typename... A, std::size_t... I>
+inline void
+render_impl(Out &out, std::index_sequence<I...>, const A &...args)
+{
+    constexpr auto &f = format_v<M>;
+
+    ((put_literal(out, M::fmt + f.specs[I].lit, f.specs[I].litlen),
+      write_value(out, f.specs[I], args)), ...);
+    put_literal(out, M::fmt + f.tail, f.taillen);
+}
+
+
+template <typename M, typename Out, typename... A>
+inline void
+render(Out &out, const A &...args)
+{
+    check<M, A...>();
+    render_impl<M>(out, std::index_sequence_for<A...>{}, args...);
+}
+
+
+/*
+ * Default formatting of a bare value, for record::operator<<.
+ */
+template <typename T>
+constexpr char
+default_conv()
+{
+    using U = std::decay_t<T>;
+
+    if constexpr (std::is_same_v<U, char>) {
+        return 'c';
+    } else if constexpr (std::is_same_v<U, bool> || std::is_enum_v<U> ||
+                         (std::is_integral_v<U> && std::is_signed_v<U>)) {
+        return 'd';
+    } else if constexpr (std::is_integral_v<U>) {
+        return 'u';
+    } else if constexpr (std::is_floating_point_v<U>) {
+        return 'f';
+    } else if constexpr (std::is_pointer_v<U> &&
+                         !std::is_same_v<U, char *> &&
+                         !std::is_same_v<U, const char *>) {
+        return 'p';
+    } else {
+        return 's';
+    }
+}
+
+
+template <char C>
+struct bare {
+    static constexpr const char fmt[] = {'%', C, '\0'};
+};
+
+
+/*
+ * "%.06lf [%d] %s %s"
+ */
+template <typename Out>
+inline void
+put_prefix(Out &out, mnl4c_ctx_t *ctx, const char *mod, int level)
+{
+    spec s{};
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *p;
+
+    s.prec = 6;
+    write_fixed(out, s, ctx->writer.data.file.curtm);
+    out.put(" [", 2);
+    p = utoa(end, ctx->cache.pid, 10, false);
+    out.put(p, end - p);
+    out.put("] ", 2);
+    out.put(mod, std::strlen(mod));
+    out.put(" ", 1);
+    out.put(level_names[level], std::strlen(level_names[level]));
+}
+
+
+/*
+ * Compile-time floor, folded away for constant levels.
+ */
+template <typename M>
+constexpr bool
+compiled(int level)
+{
+    return level <= M::min_level && M::level <= M::min_level;
+}
+
+} /* namespace detail */
+
+
+/*
+ * snprintf(3) semantics, with the message's format.
+ */
+template <typename M, typename... A>
+inline std::size_t
+format(char *buf, std::size_t sz, const A &...args)
+{
+    detail::buffer_out out(buf, sz);
+
+    detail::render<M>(out, args...);
+    return out.finish();
+}
+
+
+/*
+ * The MNL4C_WRITE_MAYBE_PRINTFLIKE family: throttled, buffered.
+ */
+template <typename M, typename... A>
+inline void
+log(mnl4c_logger_t ld, int level, const A &...args)
+{
+    mnl4c_ctx_t *ctx;
+
+    detail::check<M, A...>();
+    if (!detail::compiled<M>(level)) {
+        return;
+    }
+    if ((ctx = mnl4c_get_ctx(ld)) == nullptr) {
+        return;
+    }
+    mnl4c_ctx_lock(ctx);
+    if (mnl4c_ctx_allowed(ctx, level, M::id())) {
+        mnl4c_minfo_t *minfo;
+        double curtm;
+
+        curtm = mnl4c_now_posix();
+        minfo = static_cast<mnl4c_minfo_t *>(array_get(&ctx->minfos, M::id()));
+        if (ctx->writer.data.file.curtm + minfo->throttle_threshold <= curtm) {
+            off_t start;
+            char tmp[24];
+            char *end = tmp + sizeof(tmp);
+            char *p;
+
+            ctx->writer.data.file.curtm = curtm;
+            start = SEOD(&ctx->bs);
+            {
+                detail::stream_out out(&ctx->bs);
+
+                detail::put_prefix(out, ctx, M::mod, level);
+                out.put("[", 1);
+                p = detail::utoa(end, minfo->nthrottled, 10, false);
+                out.put(p, end - p);
+                out.put("]:\t", 3);
+                detail::render<M>(out, args...);
+                out.put("\n", 1);
+            }
+            mnl4c_ctx_commit(ctx, level, start, false);
+            minfo->nthrottled = 0;
+        } else {
+            ++minfo->nthrottled;
+            ++ctx->stats.nthrottled;
+            ++minfo->nthrottled_total;
+        }
+    } else if (MNUNLIKELY(ctx->rec.rlevel >= level)) {
+        char buf[MNL4C_SIGSAFE_BUFSZ];
+
+        (void)format<M>(buf, sizeof(buf), args...);
+        mnl4c_ctx_record(ctx, level, M::id(), "%s", buf);
+    }
+    mnl4c_ctx_unlock(ctx);
+}
+
+
+/*
+ * The MNL4C_WRITE_ONCE_PRINTFLIKE_LT family: local time, flushed.
+ */
+template <typename M, typename... A>
+inline void
+log_lt(mnl4c_logger_t ld, int level, const A &...args)
+{
+    mnl4c_ctx_t *ctx;
+
+    detail::check<M, A...>();
+    if (!detail::compiled<M>(level)) {
+        return;
+    }
+    if ((ctx = mnl4c_get_ctx(ld)) == nullptr) {
+        return;
+    }
+    mnl4c_ctx_lock(ctx);
+    if (mnl4c_ctx_allowed(ctx, level, M::id())) {
+        off_t start;
+        time_t now;
+        struct tm *tm;
+        char now_str[32];
+        char tmp[24];
+        char *end = tmp + sizeof(tmp);
+        char *p;
+
+        ctx->writer.data.file.curtm = mnl4c_now_posix();
+        now = (time_t)ctx->writer.data.file.curtm;
+        tm = localtime(&now);
+        (void)strftime(now_str, sizeof(now_str), "%Y-%m-%dT%H:%M:%S", tm);
+        start = SEOD(&ctx->bs);
+        {
+            detail::stream_out out(&ctx->bs);
+
+            out.put(now_str, std::strlen(now_str));
+            out.put(" [", 2);
+            p = detail::utoa(end, ctx->cache.pid, 10, false);
+            out.put(p, end - p);
+            out.put("] ", 2);
+            out.put(M::mod, std::strlen(M::mod));
+            out.put(" ", 1);
+            out.put(level_names[level], std::strlen(level_names[level]));
+            out.put(":\t", 2);
+            detail::render<M>(out, args...);
+            out.put("\n", 1);
+        }
+        mnl4c_ctx_commit(ctx, level, start, true);
+    } else if (MNUNLIKELY(ctx->rec.rlevel >= level)) {
+        char buf[MNL4C_SIGSAFE_BUFSZ];
+
+        (void)format<M>(buf, sizeof(buf), args...);
+        mnl4c_ctx_record(ctx, level, M::id(), "%s", buf);
+    }
+    mnl4c_ctx_unlock(ctx);
+}
+
+
+/*
+ * Multi-part record, the START/NEXT/STOP family.  The constructor renders
+ * the message, the destructor terminates, commits and flushes it.  The
+ * context stays locked in between.
+ */
+template <typename M>
+class record {
+public:
+    template <typename... A>
+    record(mnl4c_logger_t ld, int level, const A &...args)
+        : ctx_(nullptr), level_(level), start_(0)
+    {
+        mnl4c_ctx_t *ctx;
+
+        detail::check<M, A...>();
+        if (!detail::compiled<M>(level)) {
+            return;
+        }
+        if ((ctx = mnl4c_get_ctx(ld)) == nullptr) {
+            return;
+        }
+        mnl4c_ctx_lock(ctx);
+        if (!mnl4c_ctx_allowed(ctx, level, M::id())) {
+            (void)pthread_mutex_unlock(&ctx->mtx);
+            return;
+        }
+        ctx_ = ctx;
+        ctx_->writer.data.file.curtm = mnl4c_now_posix();
+        start_ = SEOD(&ctx_->bs);
+        {
+            detail::stream_out out(&ctx_->bs);
+
+            detail::put_prefix(out, ctx_, M::mod, level);
+            out.put(":\t", 2);
+            detail::render<M>(out, args...);
+        }
+    }
+
+    ~record()
+    {
+        if (ctx_ != nullptr) {
+            (void)bytestream_cat(&ctx_->bs, 1, "\n");
+            mnl4c_ctx_commit(ctx_, level_, start_, true);
+            mnl4c_ctx_unlock(ctx_);
+        }
+    }
+
+    record(const record &) = delete;
+    record &operator=(const record &) = delete;
+
+    explicit operator bool() const
+    {
+        return ctx_ != nullptr;
+    }
+
+    /*
+     * Appends with a format of its own: F needs only a fmt member.
+     */
+    template <typename F, typename... A>
+    record &
+    append(const A &...args)
+    {
+        detail::check<F, A...>();
+        if (ctx_ != nullptr) {
+            detail::stream_out out(&ctx_->bs);
+
+            detail::render<F>(out, args...);
+        }
+        return *this;
+    }
+
+    template <typename T>
+    record &
+    operator<<(const T &v)
+    {
+        return append<detail::bare<detail::default_conv<T>()>>(v);
+    }
+
+private:
+    mnl4c_ctx_t *ctx_;
+    int level_;
+    off_t start_;
+};
+
+} /* namespace mnl4c */
+
+#endif /* MNL4C_HPP_DEFINED */
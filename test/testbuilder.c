@@ -0,0 +1,165 @@
+/*
+ * Records assembled in the thread-local builder while other threads log
+ * through the same logger.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTBUILDER_PATH "/tmp/mnl4c-testbuilder.log"
+#define TESTBUILDER_NTHREADS 4
+#define TESTBUILDER_NRECORDS 2000
+#define TESTBUILDER_NFRAGMENTS 50
+
+static mnl4c_logger_t logger;
+
+
+static void *
+builder_worker(UNUSED void *udata)
+{
+    unsigned i;
+
+    for (i = 0; i < TESTBUILDER_NRECORDS; ++i) {
+        UNUSED mnl4c_builder_t *nested;
+        mnl4c_builder_t *b;
+        unsigned j;
+        UNUSED int res;
+
+        b = FOO_LOG_BEGIN(logger, LOG_INFO, QWE1, 1, 2.0, "built");
+        assert(b != NULL);
+        for (j = 0; j < TESTBUILDER_NFRAGMENTS; ++j) {
+            res = mnl4c_builder_printf(b, " %u", j);
+            assert(res == 0);
+        }
+        if (i % 10 == 5) {
+            /* the open record is left alone */
+            nested = FOO_LOG_BEGIN(logger, LOG_INFO, QWE1, 5, 6.0, "nested");
+            assert(nested == NULL);
+        }
+        if (i % 10 == 0) {
+            mnl4c_builder_abort(b);
+            res = mnl4c_builder_commit(b);
+            assert(res == -1);
+        } else {
+            res = mnl4c_builder_commit(b);
+            assert(res == 0);
+        }
+    }
+    return NULL;
+}
+
+
+static void *
+plain_worker(UNUSED void *udata)
+{
+    unsigned i;
+
+    for (i = 0; i < TESTBUILDER_NRECORDS; ++i) {
+        FOO_LINFO(logger, QWE, 3, 4.0, "plain");
+    }
+    return NULL;
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    pthread_t threads[TESTBUILDER_NTHREADS];
+    char expected[1024];
+    char line[1024];
+    FILE *fp;
+    UNUSED mnl4c_builder_t *b;
+    unsigned nbuilt, nplain;
+    unsigned i;
+    int n;
+    UNUSED int res;
+
+    n = snprintf(expected,
+                 sizeof(expected),
+                 "Foo 1: Number 1, price 2.000000 name built");
+    for (i = 0; i < TESTBUILDER_NFRAGMENTS; ++i) {
+        n += snprintf(expected + n, sizeof(expected) - n, " %u", i);
+    }
+
+    remove_log(TESTBUILDER_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTBUILDER_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+
+    /* rejected by level, and no builder is handed out */
+    b = FOO_LOG_BEGIN(logger, LOG_DEBUG, QWE1, 1, 2.0, "x");
+    assert(b == NULL);
+    res = mnl4c_builder_printf(NULL, "x");
+    assert(res == -1);
+    res = mnl4c_builder_commit(NULL);
+    assert(res == -1);
+    mnl4c_builder_abort(NULL);
+
+    for (i = 0; i < TESTBUILDER_NTHREADS; ++i) {
+        if (pthread_create(&threads[i],
+                           NULL,
+                           i % 2 ? plain_worker : builder_worker,
+                           NULL) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+    for (i = 0; i < TESTBUILDER_NTHREADS; ++i) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTBUILDER_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    nbuilt = 0;
+    nplain = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p;
+
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        ++p;
+        p[strcspn(p, "\n")] = '\0';
+        if (strcmp(p, expected) == 0) {
+            ++nbuilt;
+        } else {
+            assert(strcmp(p,
+                          "Foo 0: Number 3, price 4.000000 name plain") == 0);
+            ++nplain;
+        }
+    }
+    fclose(fp);
+    assert(nbuilt == TESTBUILDER_NTHREADS / 2 *
+                     (TESTBUILDER_NRECORDS - TESTBUILDER_NRECORDS / 10));
+    assert(nplain == TESTBUILDER_NTHREADS / 2 * TESTBUILDER_NRECORDS);
+    remove_log(TESTBUILDER_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Numeric conversion kernels against printf, and their cost.
+ */
+#include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTCONV_NRANDOM 300000
+#define TESTCONV_NBENCH 2000000
+
+static mnbytestream_t bs;
+
+
+#define CHECK(call, fmt, ...)                                          \
+    do {                                                               \
+        char _buf[512];                                                \
+        ssize_t _n;                                                    \
+        int _m;                                                        \
+        SEOD(&bs) = 0;                                                 \
+        _n = call;                                                     \
+        _m = snprintf(_buf, sizeof(_buf), fmt, __VA_ARGS__);           \
+        if (_n != _m || (ssize_t)SEOD(&bs) != _n ||                    \
+            memcmp(SDATA(&bs, 0), _buf, _m) != 0) {                    \
+            TRACE("mismatch:\n%.*s\n%s",                               \
+                  (int)SEOD(&bs), SDATA(&bs, 0), _buf);                \
+            assert(0);                                                 \
+        }                                                              \
+    } while (0)                                                        \
+
+
+static uint64_t
+rnd64(void)
+{
+    return ((uint64_t)random() << 62) ^
+           ((uint64_t)random() << 31) ^
+           (uint64_t)random();
+}
+
+
+static void
+check_int(unsigned long long v)
+{
+    CHECK(mnl4c_bs_ull(&bs, v), "%llu", v);
+    CHECK(mnl4c_bs_ll(&bs, (long long)v), "%lld", (long long)v);
+    CHECK(mnl4c_bs_hex(&bs, v, false), "%llx", v);
+    CHECK(mnl4c_bs_hex(&bs, v, true), "%llX", v);
+}
+
+
+static void
+check_fixed(double v)
+{
+    int prec;
+
+    for (prec = 0; prec <= 9; ++prec) {
+        CHECK(mnl4c_bs_fixed(&bs, v, prec), "%.*f", prec, v);
+    }
+}
+
+
+static void
+test0(void)
+{
+    unsigned long long ints[] = {
+        0, 1, 9, 10, 11, 99, 100, 101, 999, 1000, 65535, 65536,
+        4294967295ull, 4294967296ull, 9999999999999999999ull,
+        10000000000000000000ull, ULLONG_MAX, (unsigned long long)LLONG_MAX,
+        (unsigned long long)LLONG_MIN, (unsigned long long)-1ll,
+        (unsigned long long)-10ll,
+    };
+    double dbls[] = {
+        0.0, -0.0, 0.5, 1.5, 2.5, -2.5, 0.05, 0.005, 0.0005, 0.125,
+        0.1, 0.2, 0.3, 1.0 / 3, 2.0 / 3, 999.9999999, 9.9999999995,
+        0.99999999995, 1e-7, 1e-300, DBL_MIN, DBL_EPSILON,
+        123456789.987654321, 4503599627370495.5, 999999999999999.9,
+        1e15, -1e15, 1e20, 1e300, DBL_MAX, -DBL_MAX, INFINITY, -INFINITY,
+        NAN, 1700000000.123456, 1700000000.1234565,
+    };
+    unsigned long long p10;
+    unsigned i;
+    int n;
+
+    for (i = 0; i < countof(ints); ++i) {
+        check_int(ints[i]);
+    }
+    for (n = 0; n < 64; ++n) {
+        check_int(1ull << n);
+        check_int((1ull << n) - 1);
+    }
+    for (n = 0, p10 = 1; n < 20; ++n, p10 *= 10) {
+        check_int(p10 - 1);
+        check_int(p10);
+        check_int(p10 + 1);
+    }
+    for (i = 0; i < countof(dbls); ++i) {
+        check_fixed(dbls[i]);
+        check_fixed(-dbls[i]);
+    }
+
+    srandom(0);
+    for (i = 0; i < TESTCONV_NRANDOM; ++i) {
+        uint64_t r;
+        double d;
+
+        r = rnd64();
+        check_int(r >> (r & 0x3f));
+
+        /* random magnitudes, and values right at decimal ties */
+        d = (double)(r >> 11) / (double)(1ull << 53) *
+            pow(10.0, (double)(int)(r % 20) - 6);
+        CHECK(mnl4c_bs_fixed(&bs, d, 6), "%.6f", d);
+        d = (double)(r % 100000000) / 1e8 + 5e-9;
+        CHECK(mnl4c_bs_fixed(&bs, d, 8), "%.8f", d);
+        memcpy(&d, &r, sizeof(d));
+        CHECK(mnl4c_bs_fixed(&bs, d, (int)(r % 10)),
+              "%.*f", (int)(r % 10), d);
+    }
+
+    CHECK(mnl4c_bs_prefix(&bs, 1700000000.25, 12345, "foo", "INFO", 3),
+          "%.06lf [%d] %s %s[%d]:\t", 1700000000.25, 12345, "foo", "INFO", 3);
+    CHECK(mnl4c_bs_prefix(&bs, 0.0, 1, "", "DEBUG", -1),
+          "%.06lf [%d] %s %s:\t", 0.0, 1, "", "DEBUG");
+}
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+#define TESTCONV_BENCH(name, stmt)                                     \
+    do {                                                               \
+        uint64_t _before;                                              \
+        unsigned i;                                                    \
+        _before = now_ns();                                            \
+        for (i = 0; i < TESTCONV_NBENCH; ++i) {                        \
+            SEOD(&bs) = 0;                                             \
+            stmt;                                                      \
+        }                                                              \
+        TRACE("%-24s %6.2f ns",                                        \
+              name,                                                    \
+              (double)(now_ns() - _before) / TESTCONV_NBENCH);         \
+    } while (0)                                                        \
+
+
+static void
+test1(void)
+{
+    volatile double tm = 1700000000.123456;
+    volatile long long v = -1234567890123ll;
+    volatile int pid = 12345;
+
+    TESTCONV_BENCH("ll kernel", mnl4c_bs_ll(&bs, v + i));
+    TESTCONV_BENCH("ll printf", bytestream_nprintf(&bs, 64, "%lld", v + i));
+    TESTCONV_BENCH("fixed kernel", mnl4c_bs_fixed(&bs, tm + i, 6));
+    TESTCONV_BENCH("fixed printf",
+                   bytestream_nprintf(&bs, 64, "%.06lf", tm + i));
+    TESTCONV_BENCH("prefix kernel",
+                   mnl4c_bs_prefix(&bs, tm + i, pid, "foo", "INFO", 0));
+    TESTCONV_BENCH("prefix printf",
+                   bytestream_nprintf(&bs, 64, "%.06lf [%d] %s %s[%d]:\t",
+                                      tm + i, pid, "foo", "INFO", 0));
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    bytestream_init(&bs, 1024);
+    test0();
+    test1();
+    bytestream_fini(&bs);
+    mnl4c_fini();
+    return 0;
+}
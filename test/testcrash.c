@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTCRASH_PATH "/tmp/mnl4c-testcrash.log"
+#define TESTCRASH_NRECORDS 1000
+
+static mnl4c_logger_t logger;
+
+
+static void
+sigusr1_handler(UNUSED int signo)
+{
+    FOO_LOG_SIGSAFE(logger, LOG_ERR, QWE, -42, 3.25, "from signal handler");
+}
+
+
+static void
+child_open(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+
+    mnl4c_init();
+    logger = mnl4c_open(MNL4C_OPEN_FILE, TESTCRASH_PATH, 0, 0.0, 4, 0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    /* large enough for nothing to be written before the crash */
+    (void)mnl4c_set_bufsz(logger, 1024 * 1024);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
+    if (mnl4c_install_crash_handler() != 0) {
+        FAIL("mnl4c_install_crash_handler");
+    }
+}
+
+
+static int
+count_lines(const char *needle)
+{
+    FILE *fp;
+    char buf[1024];
+    int res;
+
+    if ((fp = fopen(TESTCRASH_PATH, "r")) == NULL) {
+        return -1;
+    }
+    res = 0;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        if (strstr(buf, needle) != NULL) {
+            ++res;
+        }
+    }
+    fclose(fp);
+    return res;
+}
+
+
+static void
+cleanup(void)
+{
+    char buf[1024];
+    ssize_t nread;
+
+    if ((nread = readlink(TESTCRASH_PATH, buf, sizeof(buf) - 1)) > 0) {
+        buf[nread] = '\0';
+        (void)unlink(buf);
+    }
+    (void)unlink(TESTCRASH_PATH);
+}
+
+
+static pid_t
+run_child(int burst)
+{
+    pid_t pid;
+
+    cleanup();
+    if ((pid = fork()) == -1) {
+        FAIL("fork");
+    }
+
+    if (pid == 0) {
+        int i;
+
+        child_open();
+        if (signal(SIGUSR1, sigusr1_handler) == SIG_ERR) {
+            FAIL("signal");
+        }
+        (void)raise(SIGUSR1);
+
+        if (burst) {
+            for (i = 0; ; ++i) {
+                FOO_LDEBUG(logger, QWE1, i, 1.0, "burst");
+            }
+        } else {
+            for (i = 0; i < TESTCRASH_NRECORDS; ++i) {
+                FOO_LDEBUG(logger, QWE1, i, 1.0, "buffered");
+            }
+            abort();
+        }
+        _exit(0);
+    }
+
+    return pid;
+}
+
+
+static void
+test0(void)
+{
+    pid_t pid;
+    int status;
+    UNUSED int n;
+
+    /* all buffered records survive abort() */
+    pid = run_child(0);
+    if (waitpid(pid, &status, 0) != pid) {
+        FAIL("waitpid");
+    }
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    n = count_lines("name buffered");
+    assert(n == TESTCRASH_NRECORDS);
+    n = count_lines("Number -42, price 3.250000 name from signal handler");
+    assert(n == 1);
+}
+
+
+static void
+test1(void)
+{
+    pid_t pid;
+    int status;
+    UNUSED int n;
+    struct timespec ts = {0, 50000000};
+
+    /* killed mid-burst */
+    pid = run_child(1);
+    (void)nanosleep(&ts, NULL);
+    if (kill(pid, SIGSEGV) != 0) {
+        FAIL("kill");
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        FAIL("waitpid");
+    }
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    n = count_lines("name burst");
+    assert(n > 0);
+    cleanup();
+}
+
+
+int
+main(void)
+{
+    test0();
+    test1();
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+
+#include "unittest.h"
+#include "my-logdef.hpp"
+
+#define TESTCXX_PATH "/tmp/mnl4c-testcxx.log"
+
+using foo_logdef::FOO::QWE;
+using foo_logdef::FOO::ASD1;
+
+
+struct F1 {
+    static constexpr const char fmt[] =
+        "%d|%5d|%-5d|%05d|%+d|% d|%.3d|%ld|%lld|%hhd|%zd";
+};
+
+struct F2 {
+    static constexpr const char fmt[] =
+        "%u|%x|%X|%#x|%o|%#o|%08x|%c|%%|%-3c|";
+};
+
+struct F3 {
+    static constexpr const char fmt[] =
+        "%f|%.2f|%10.3f|%-10.1f|%010.4f|%+f|%.0f|%#.0f|%e|%.3g|%f|%f";
+};
+
+struct F4 {
+    static constexpr const char fmt[] = "%s|%.3s|%10s|%-10s|%s|%s|%p|%p";
+};
+
+struct F5 {
+    static constexpr const char fmt[] = "%d %x %d";
+};
+
+struct HEX {
+    static constexpr const char fmt[] = " %#x";
+};
+
+enum colour {
+    RED = 1,
+    GREEN,
+};
+
+
+#define COMPARE(F, ...)                                                \
+    do {                                                               \
+        char a[256], b[256];                                           \
+        size_t na;                                                     \
+        int nb;                                                        \
+        na = mnl4c::format<F>(a, sizeof(a), __VA_ARGS__);              \
+        nb = snprintf(b, sizeof(b), F::fmt, __VA_ARGS__);              \
+        if (na != (size_t)nb || strcmp(a, b) != 0) {                   \
+            TRACE("mismatch:\n%s\n%s", a, b);                          \
+            assert(0);                                                 \
+        }                                                              \
+    } while (0)                                                        \
+
+
+static void
+test0(void)
+{
+    char buf[8];
+    std::string s("std::string");
+    UNUSED size_t n;
+    int x;
+
+    COMPARE(F1, 1, 2, -3, 4, 5, 6, 7, -8L, 9LL, (signed char)-10,
+            (ssize_t)11);
+    COMPARE(F1, 0, -2147483647 - 1, 2147483647, -4, -5, -6, -7,
+            -9223372036854775807L - 1, 0LL, (signed char)127, (ssize_t)-1);
+    COMPARE(F2, 1u, 0xdeadbeefu, 0xdeadbeefu, 255u, 8u, 8u, 0x1234u, 'z',
+            'y');
+    COMPARE(F2, 0u, 0u, 4294967295u, 0u, 0u, 0u, 0u, 'A', 'B');
+    COMPARE(F3, 1.0, 22.22, -3.14159, 2.5, -1.25, 1e-7, 0.4, 0.6, 12345.678,
+            0.000123456, 123456789012.345678, -0.0);
+    COMPARE(F3, 999.9999999, 0.005, 1e20, -1e14, 1.0 / 3, 0.0, 99.5, 2.5,
+            -1e-300, 1e300, 4503599627370495.5, 0.1);
+    COMPARE(F4, "abc", "abcdef", "right", "left", "", "ab",
+            (void *)&x, (void *)NULL);
+
+    /* types the C path would not take */
+    n = mnl4c::format<F4>(buf, sizeof(buf), s, std::string_view("ab"),
+                          s, s, "", s, nullptr, &x);
+    assert(n > sizeof(buf));
+    assert(strlen(buf) == sizeof(buf) - 1);
+    assert(strncmp(buf, "std::st", 7) == 0);
+
+    (void)mnl4c::format<F5>(buf, sizeof(buf), GREEN, true, 'a');
+    assert(strcmp(buf, "2 1 97") == 0);
+}
+
+
+static void
+test1(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger;
+    mnl4c_stats_t stats;
+    FILE *fp;
+    char line[1024];
+    UNUSED const char *expected[] = {
+        "Foo 0: Number 1, price 2.500000 name cxx",
+        "Foo 0: Number -2, price 0.125000 name std::string",
+        "Foo 1: multi 1 2 3.500000 x 0xff",
+    };
+    unsigned i;
+
+    remove_log(TESTCXX_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTCXX_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+
+    mnl4c::log<QWE>(logger, LOG_INFO, 1, 2.5, "cxx");
+    mnl4c::log<QWE>(logger, LOG_DEBUG, 1, 2.5, "rejected");
+    mnl4c::log_lt<QWE>(logger, LOG_ERR, -2, 0.125, std::string("std::string"));
+    {
+        mnl4c::record<ASD1> r(logger, LOG_INFO, "multi");
+
+        assert(r);
+        r << ' ' << 1 << ' ' << 2u << ' ' << 3.5 << ' ' << "x";
+        r.append<HEX>(255);
+    }
+    {
+        mnl4c::record<ASD1> r(logger, LOG_DEBUG, "rejected");
+
+        assert(!r);
+        r << 1;
+    }
+
+    (void)mnl4c_get_stats(logger, &stats);
+    assert(stats.nrecords == 3);
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTCXX_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    i = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p;
+
+        /* ASD1 begins with a newline */
+        if (strchr(line, '\t') != NULL &&
+            line[strlen(line) - 2] == '\t') {
+            continue;
+        }
+        if ((p = strchr(line, '\t')) == NULL) {
+            p = line;
+        } else {
+            ++p;
+        }
+        p[strcspn(p, "\n")] = '\0';
+        TRACE("%s", p);
+        assert(i < countof(expected));
+        assert(strcmp(p, expected[i]) == 0);
+        ++i;
+    }
+    fclose(fp);
+    assert(i == countof(expected));
+    remove_log(TESTCXX_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    mnl4c_fini();
+    return 0;
+}
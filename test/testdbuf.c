@@ -0,0 +1,172 @@
+/*
+ * Double-buffered loggers: ordering across concurrent flushes, and
+ * resizing with records pending.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTDBUF_PATH "/tmp/mnl4c-testdbuf.log"
+#define TESTDBUF_NTHREADS 8
+#define TESTDBUF_NRECORDS 5000
+
+static mnl4c_logger_t logger;
+
+
+static void
+open_logger(ssize_t bufsz)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    UNUSED int res;
+
+    remove_log(TESTDBUF_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTDBUF_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    res = mnl4c_set_bufsz(logger, bufsz);
+    assert(res == 0);
+}
+
+
+static void *
+worker(void *udata)
+{
+    char name[16];
+    int i;
+
+    (void)snprintf(name, sizeof(name), "t%ld", (long)(intptr_t)udata);
+    for (i = 0; i < TESTDBUF_NRECORDS; ++i) {
+        FOO_LOG(logger, LOG_INFO, QWE, i, 0.0, name);
+    }
+    return NULL;
+}
+
+
+/*
+ * Each thread's records come out complete and in order.
+ */
+static void
+test0(void)
+{
+    pthread_t threads[TESTDBUF_NTHREADS];
+    int next[TESTDBUF_NTHREADS];
+    mnl4c_stats_t stats;
+    char line[256];
+    FILE *fp;
+    long i;
+    UNUSED int res;
+
+    open_logger(512);
+    for (i = 0; i < TESTDBUF_NTHREADS; ++i) {
+        if (pthread_create(&threads[i], NULL, worker, (void *)i) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+    for (i = 0; i < TESTDBUF_NTHREADS; ++i) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    res = mnl4c_get_stats(logger, &stats);
+    assert(res == 0);
+    TRACE("flushes %ju lock_waits %ju",
+          (uintmax_t)stats.nflushes,
+          (uintmax_t)stats.nlock_waits);
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTDBUF_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    memset(next, '\0', sizeof(next));
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        UNUSED double price;
+        int n, t;
+        char *p;
+
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        res = sscanf(p + 1,
+                     "Foo 0: Number %d, price %lf name t%d",
+                     &n, &price, &t);
+        assert(res == 3);
+        assert(t >= 0 && t < TESTDBUF_NTHREADS);
+        assert(n == next[t]);
+        ++next[t];
+    }
+    fclose(fp);
+    for (i = 0; i < TESTDBUF_NTHREADS; ++i) {
+        assert(next[i] == TESTDBUF_NRECORDS);
+    }
+    remove_log(TESTDBUF_PATH);
+}
+
+
+/*
+ * Pending records survive a resize, a smaller buffer than what is
+ * pending is written out.
+ */
+static void
+test1(void)
+{
+    mnl4c_stats_t stats;
+    FILE *fp;
+    char line[256];
+    UNUSED int n, res;
+
+    open_logger(4096);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    res = mnl4c_set_bufsz(logger, 8192);
+    assert(res == 0);
+    res = mnl4c_get_stats(logger, &stats);
+    assert(res == 0);
+    assert(stats.nflushes == 0);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    res = mnl4c_set_bufsz(logger, 16);
+    assert(res == 0);
+    res = mnl4c_get_stats(logger, &stats);
+    assert(res == 0);
+    assert(stats.nflushes == 1);
+    res = mnl4c_set_bufsz(logger, 0);
+    assert(res != 0);
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTDBUF_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        assert(strstr(line, "\tHey!\n") != NULL);
+        ++n;
+    }
+    fclose(fp);
+    assert(n == 3);
+    remove_log(TESTDBUF_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    mnl4c_fini();
+    return 0;
+}
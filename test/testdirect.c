@@ -0,0 +1,239 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTDIRECT_PATH "/tmp/mnl4c-testdirect.log"
+#define TESTDIRECT_NRECORDS 200000
+
+static mnl4c_logger_t logger;
+
+
+static void
+cleanup(void)
+{
+    glob_t g;
+    size_t i;
+
+    if (glob(TESTDIRECT_PATH ".*", 0, NULL, &g) == 0) {
+        for (i = 0; i < g.gl_pathc; ++i) {
+            (void)unlink(g.gl_pathv[i]);
+        }
+        globfree(&g);
+    }
+    (void)unlink(TESTDIRECT_PATH);
+}
+
+
+static void
+logger_open(int flags, size_t maxsz)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTDIRECT_PATH,
+                        maxsz,
+                        0.0,
+                        (size_t)0,
+                        flags);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
+}
+
+
+/*
+ * Count whole lines across all shadows, no padding may be left over.
+ * Also count the shadows' pages resident in the page cache.
+ */
+static int
+count_lines(size_t *npages, size_t *nresident)
+{
+    glob_t g;
+    size_t i;
+    int res;
+
+    res = 0;
+    *npages = 0;
+    *nresident = 0;
+    if (glob(TESTDIRECT_PATH ".*", 0, NULL, &g) != 0) {
+        FAIL("glob");
+    }
+    for (i = 0; i < g.gl_pathc; ++i) {
+        int fd;
+        struct stat sb;
+        char *m;
+        off_t j;
+
+        if ((fd = open(g.gl_pathv[i], O_RDONLY)) < 0) {
+            FAIL("open");
+        }
+        if (fstat(fd, &sb) != 0) {
+            FAIL("fstat");
+        }
+        if (sb.st_size == 0) {
+            (void)close(fd);
+            continue;
+        }
+        if ((m = mmap(NULL,
+                      sb.st_size,
+                      PROT_READ,
+                      MAP_SHARED,
+                      fd,
+                      0)) == MAP_FAILED) {
+            FAIL("mmap");
+        }
+        {
+            long pgsz = sysconf(_SC_PAGESIZE);
+            size_t n = (sb.st_size + pgsz - 1) / pgsz;
+            unsigned char vec[n];
+            size_t k;
+
+            /* before touching the pages */
+            if (mincore(m, sb.st_size, (void *)vec) != 0) {
+                FAIL("mincore");
+            }
+            for (k = 0; k < n; ++k) {
+                *nresident += vec[k] & 1;
+            }
+            *npages += n;
+        }
+        assert(m[sb.st_size - 1] == '\n');
+        for (j = 0; j < sb.st_size; ++j) {
+            assert(m[j] != '\0');
+            if (m[j] == '\n') {
+                ++res;
+            }
+        }
+        (void)munmap(m, sb.st_size);
+        (void)close(fd);
+    }
+    globfree(&g);
+    return res;
+}
+
+
+static void
+bench(const char *name, int flags)
+{
+    double before, after;
+    size_t npages, nresident;
+    UNUSED int n;
+    int i;
+
+    cleanup();
+    logger_open(flags, 16 * 1024 * 1024);
+    (void)mnl4c_set_bufsz(logger, 64 * 1024);
+
+    before = mnl4c_now_posix();
+    for (i = 0; i < TESTDIRECT_NRECORDS; ++i) {
+        FOO_LDEBUG(logger, QWE1, i, 1.0, "direct");
+    }
+    (void)mnl4c_close(logger);
+    after = mnl4c_now_posix();
+
+    n = count_lines(&npages, &nresident);
+    assert(n == TESTDIRECT_NRECORDS);
+    TRACE("%s: %.0f records/s, %zd of %zd pages cached",
+          name,
+          (double)TESTDIRECT_NRECORDS / (after - before),
+          nresident,
+          npages);
+    cleanup();
+}
+
+
+static void
+test0(void)
+{
+    size_t npages, nresident;
+    UNUSED int n;
+    int i;
+
+    /* partial tail blocks across close/reopen and rotation */
+    cleanup();
+    for (i = 0; i < 3; ++i) {
+        int j;
+
+        logger_open(MNL4C_OPEN_DIRECT, 10000);
+        for (j = 0; j < 100; ++j) {
+            FOO_LINFO(logger, QWE1, j, 1.0, "tail");
+        }
+        (void)mnl4c_close(logger);
+    }
+    n = count_lines(&npages, &nresident);
+    assert(n == 300);
+    cleanup();
+}
+
+
+static void
+test1(void)
+{
+    struct stat sb;
+    size_t npages, nresident;
+    UNUSED int n, res;
+
+    /* flushed, but the partial tail block is only written at close */
+    cleanup();
+    logger_open(MNL4C_OPEN_DIRECT, 0);
+    (void)mnl4c_set_bufsz(logger, 64);
+    FOO_LINFO(logger, QWE1, 1, 1.0, "tail");
+    res = stat(TESTDIRECT_PATH, &sb);
+    assert(res == 0);
+    assert(sb.st_size == 0);
+    (void)mnl4c_close(logger);
+    n = count_lines(&npages, &nresident);
+    assert(n == 1);
+    cleanup();
+}
+
+
+static void
+test2(void)
+{
+    size_t npages, nresident;
+    UNUSED int n;
+    int i;
+
+    /* the lockless paths leave the staging buffer alone */
+    cleanup();
+    logger_open(MNL4C_OPEN_DIRECT, 0);
+    for (i = 0; i < 100; ++i) {
+        FOO_LINFO(logger, QWE1, i, 1.0, "staged");
+        FOO_LOG_SIGSAFE(logger, LOG_INFO, QWE1, i, 1.0, "dropped");
+        mnl4c_crash_flush();
+    }
+    (void)mnl4c_close(logger);
+    n = count_lines(&npages, &nresident);
+    assert(n == 100);
+    cleanup();
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    test2();
+    bench("buffered", 0);
+    bench("direct", MNL4C_OPEN_DIRECT);
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * #timestamp-format and #context logdef directives.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTDIRECTIVES_PATH "/tmp/mnl4c-testdirectives.log"
+
+#define TS_EPOCH 0x01
+#define TS_DATETIME 0x02
+
+/* #context-args in logdef.txt */
+static int _my_number = 1;
+static mnbytes_t _lz = BYTES_INITIALIZER("L0");
+
+
+/*
+ * Parse the timestamps of a record prefix, return what it had, or -1.
+ */
+static int
+parse_prefix(char *line, char **rest)
+{
+    double tm;
+    int y, mo, d, h, mi, s, n;
+    int res;
+
+    *rest = line;
+    res = 0;
+    if (sscanf(line, "%d-%d-%dT%d:%d:%d %n",
+               &y, &mo, &d, &h, &mi, &s, &n) == 6) {
+        res |= TS_DATETIME;
+        line += n;
+    } else if (sscanf(line, "%lf %n", &tm, &n) == 1) {
+        res |= TS_EPOCH;
+        line += n;
+        if (sscanf(line, "%d-%d-%dT%d:%d:%d %n",
+                   &y, &mo, &d, &h, &mi, &s, &n) == 6) {
+            res |= TS_DATETIME;
+            line += n;
+        }
+    } else {
+        return -1;
+    }
+    *rest = line;
+    return res;
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_ep, "EP");
+    mnl4c_logger_t logger;
+    FILE *fp;
+    char line[1024];
+    /* nthrottled is -1 where the prefix has no throttled count */
+    UNUSED struct {
+        int ts;
+        const char *name;
+        const char *level;
+        int nthrottled;
+        const char *body;
+    } expected[] = {
+        {TS_EPOCH, "ep", "INFO", -1, "Hello ep"},
+        {TS_DATETIME, "dt", "INFO", -1, "Hello dt"},
+        /* throttled and buffered like DT_LOG, in the module's style */
+        {TS_DATETIME, "dt", "DEBUG", 0, "Hello debug"},
+        {TS_EPOCH | TS_DATETIME, "edt", "WARNING", -1, "Hello edt"},
+        {TS_EPOCH | TS_DATETIME, "edt", "DEBUG", 0, "Hello debug"},
+        {TS_EPOCH, "ep", "INFO", -1, "1 L0:Hello context"},
+        {TS_DATETIME, "bar", "ERROR", -1,
+            "1 L0:Bar 0: Number 2, price 3.000000 name context"},
+        {TS_EPOCH, "bar", "INFO", 0,
+            "1 L0:Bar 0: Number 4, price 5.000000 name context"},
+        /* the EP_LOG and both EP_LDEBUG above */
+        {TS_EPOCH, "ep", "DEBUG", 3, "Hello debug"},
+    };
+    unsigned i;
+
+    remove_log(TESTDIRECTIVES_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTDIRECTIVES_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, NULL);
+    (void)mnl4c_set_throttling(logger, 60.0, _ep);
+
+    EP_LINFO(logger, HELLO, "ep");
+    EP_LOG(logger, LOG_DEBUG, HELLO, "throttled");
+    /* throttled like EP_LOG */
+    EP_LDEBUG(logger, HELLO, "debug");
+    EP_LDEBUG(logger, HELLO, "debug");
+    DT_LINFO(logger, HELLO, "dt");
+    DT_LDEBUG(logger, HELLO, "debug");
+    EDT_LWARNING(logger, HELLO, "edt");
+    EDT_LDEBUG(logger, HELLO, "debug");
+    LZERO_EP_LINFO(logger, HELLO, "context");
+    LZERO_BAR_LERROR(logger, QWE, 2, 3.0, "context");
+    /* no #timestamp-format in BAR, LOG stays the plain family */
+    LZERO_BAR_LOG(logger, LOG_INFO, QWE, 4, 5.0, "context");
+    (void)mnl4c_set_throttling(logger, 0.0, _ep);
+    EP_LDEBUG(logger, HELLO, "debug");
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTDIRECTIVES_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    i = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        UNUSED int pid, nthrottled, n, res;
+        char name[32], level[32];
+        char *p, *rest;
+
+        TRACE("%s", line);
+        assert(i < countof(expected));
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        *p++ = '\0';
+        p[strcspn(p, "\n")] = '\0';
+        res = parse_prefix(line, &rest);
+        assert(res == expected[i].ts);
+        n = 0;
+        res = sscanf(rest, "[%d] %31s %31[A-Z]%n", &pid, name, level, &n);
+        assert(res == 3);
+        assert(pid == getpid());
+        assert(strcmp(name, expected[i].name) == 0);
+        assert(strcmp(level, expected[i].level) == 0);
+        nthrottled = -1;
+        if (rest[n] == '[') {
+            res = sscanf(rest + n, "[%d]", &nthrottled);
+            assert(res == 1);
+        }
+        assert(nthrottled == expected[i].nthrottled);
+        assert(strcmp(p, expected[i].body) == 0);
+        ++i;
+    }
+    fclose(fp);
+    assert(i == countof(expected));
+    remove_log(TESTDIRECTIVES_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Cost of a compiled-in but disabled log statement, per macro family.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTDISABLED_NCALLS 5000000
+#define TESTDISABLED_PATH "/tmp/mnl4c-testdisabled.log"
+#define TESTDISABLED_NTHREADS 4
+#define TESTDISABLED_NFLIPS 200
+
+static mnl4c_logger_t logger;
+static bool stop;
+static volatile sig_atomic_t ntraps;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+#define TESTDISABLED_RUN(name, stmt)                                   \
+    do {                                                               \
+        uint64_t _before;                                              \
+        int i;                                                         \
+        _before = now_ns();                                            \
+        for (i = 0; i < TESTDISABLED_NCALLS; ++i) {                    \
+            stmt;                                                      \
+        }                                                              \
+        printf("%-12s %8.2f ns/call\n",                                \
+               name,                                                   \
+               (double)(now_ns() - _before) / TESTDISABLED_NCALLS);    \
+    } while (0)                                                        \
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_stats_t stats;
+
+    logger = mnl4c_open(MNL4C_OPEN_STDOUT);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    /* everything below LOG_ERR is disabled */
+    (void)mnl4c_set_level(logger, LOG_ERR, _foo);
+
+    TESTDISABLED_RUN("maybe",
+                     FOO_LDEBUG(logger, QWE1, i, 1.0, "disabled"));
+    TESTDISABLED_RUN("lt",
+                     FOO_LINFO(logger, QWE1, i, 1.0, "disabled"));
+    TESTDISABLED_RUN("lt2",
+                     FOO_LINFO2(logger, QWE1, i, 1.0, "disabled"));
+    TESTDISABLED_RUN("flevel",
+                     FOO_LLOG(logger, QWE1, i, 1.0, "disabled"));
+    TESTDISABLED_RUN("startstop",
+                     FOO_LOG_START(logger, LOG_INFO, ASD1, "start:");
+                     FOO_LOG_NEXT(logger, LOG_INFO, ASD1, " %d", i);
+                     FOO_LOG_STOP(logger, LOG_INFO, ASD1, "disabled"));
+    TESTDISABLED_RUN("do_at",
+                     FOO_DO_AT(logger, LOG_INFO, QWE1, (void)i;));
+    TESTDISABLED_RUN("sigsafe",
+                     FOO_LOG_SIGSAFE(logger, LOG_INFO, QWE1, i, 1.0, "x"));
+
+    /* nothing must have been written */
+    (void)mnl4c_get_stats(logger, &stats);
+    assert(stats.nrecords == 0);
+
+    /* sites follow level changes both ways */
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    FOO_LINFO(logger, QWE1, 1, 1.0, "enabled");
+    (void)mnl4c_get_stats(logger, &stats);
+    assert(stats.nrecords == 1);
+    (void)mnl4c_set_level(logger, LOG_ERR, _foo);
+    FOO_LINFO(logger, QWE1, 2, 1.0, "disabled");
+    (void)mnl4c_get_stats(logger, &stats);
+    assert(stats.nrecords == 1);
+    (void)mnl4c_close(logger);
+}
+
+
+
+static void *
+flip_worker(UNUSED void *udata)
+{
+    int i;
+
+    for (i = 0; !__atomic_load_n(&stop, __ATOMIC_RELAXED); ++i) {
+        FOO_LINFO(logger, QWE1, i, 1.0, "flip");
+    }
+    return NULL;
+}
+
+
+/*
+ * Sites are patched while other threads run them.
+ */
+static void
+test1(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    pthread_t threads[TESTDISABLED_NTHREADS];
+    mnl4c_stats_t stats;
+    UNUSED uint64_t nrecords;
+    int i;
+
+    remove_log(TESTDISABLED_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTDISABLED_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_ERR, _foo);
+    stop = false;
+    for (i = 0; i < TESTDISABLED_NTHREADS; ++i) {
+        if (pthread_create(&threads[i], NULL, flip_worker, NULL) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+    for (i = 0; i < TESTDISABLED_NFLIPS; ++i) {
+        (void)mnl4c_set_level(logger, i % 2 ? LOG_ERR : LOG_INFO, _foo);
+    }
+    (void)mnl4c_set_level(logger, LOG_ERR, _foo);
+    (void)mnl4c_get_stats(logger, &stats);
+    nrecords = stats.nrecords;
+    usleep(10000);
+    (void)mnl4c_get_stats(logger, &stats);
+    /* a site may be past the check, at most one record each */
+    assert(stats.nrecords <= nrecords + TESTDISABLED_NTHREADS);
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (i = 0; i < TESTDISABLED_NTHREADS; ++i) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    (void)mnl4c_close(logger);
+    remove_log(TESTDISABLED_PATH);
+}
+
+
+static void
+trap_handler(UNUSED int sig)
+{
+    ++ntraps;
+}
+
+
+/*
+ * SIGTRAPs that are not from a site being patched reach whatever the
+ * application installed, whenever it did.
+ */
+static void
+test2(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    struct sigaction sa;
+    pid_t pid;
+    UNUSED int status;
+
+    remove_log(TESTDISABLED_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTDISABLED_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+
+    /* with no handler of its own, the default action is taken */
+    if ((pid = fork()) < 0) {
+        FAIL("fork");
+    }
+    if (pid == 0) {
+        struct rlimit rl;
+
+        rl.rlim_cur = 0;
+        rl.rlim_max = 0;
+        (void)setrlimit(RLIMIT_CORE, &rl);
+        (void)raise(SIGTRAP);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        FAIL("waitpid");
+    }
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGTRAP);
+
+    /* installed after the first patch, and kept behind the next one */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trap_handler;
+    (void)sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGTRAP, &sa, NULL) != 0) {
+        FAIL("sigaction");
+    }
+    (void)mnl4c_set_level(logger, LOG_ERR, _foo);
+#if defined(MNL4C_JUMP_LABELS) && defined(__x86_64__)
+    if (sigaction(SIGTRAP, NULL, &sa) != 0) {
+        FAIL("sigaction");
+    }
+    assert(sa.sa_flags & SA_SIGINFO);
+#endif
+    (void)raise(SIGTRAP);
+    assert(ntraps == 1);
+    (void)mnl4c_close(logger);
+    remove_log(TESTDISABLED_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    test2();
+    mnl4c_fini();
+    return 0;
+}
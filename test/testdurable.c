@@ -0,0 +1,232 @@
+/*
+ * Durability modes: group commit and periodic sync.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTDURABLE_PATH "/tmp/mnl4c-testdurable.log"
+#define TESTDURABLE_NRECORDS 200
+
+static mnl4c_logger_t logger;
+
+
+static void
+pause_for(double sec)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)sec;
+    ts.tv_nsec = (long)((sec - (double)ts.tv_sec) * 1000000000.0);
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+
+static void *
+worker(UNUSED void *udata)
+{
+    int i;
+
+    for (i = 0; i < TESTDURABLE_NRECORDS; ++i) {
+        FOO_LOG(logger, LOG_ERR, ZXC);
+    }
+    return NULL;
+}
+
+
+static void
+open_logger(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+
+    remove_log(TESTDURABLE_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTDURABLE_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+}
+
+
+static uint64_t
+count_lines(void)
+{
+    FILE *fp;
+    char line[256];
+    uint64_t n;
+
+    if ((fp = fopen(TESTDURABLE_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        ++n;
+    }
+    fclose(fp);
+    return n;
+}
+
+
+/*
+ * Commits per second against the number of threads waiting on a sync.
+ */
+static void
+test0(void)
+{
+    unsigned nthreads[] = {1, 2, 4, 8, 16};
+    unsigned i;
+
+    for (i = 0; i < countof(nthreads); ++i) {
+        pthread_t threads[16];
+        mnl4c_stats_t stats;
+        double before, elapsed;
+        unsigned j;
+        UNUSED uint64_t n;
+        UNUSED int res;
+
+        open_logger();
+        res = mnl4c_set_durability(logger,
+                                   MNL4C_DURABILITY_GROUP,
+                                   LOG_ERR,
+                                   0.0);
+        assert(res == 0);
+        before = mnl4c_now_posix();
+        for (j = 0; j < nthreads[i]; ++j) {
+            if (pthread_create(&threads[j], NULL, worker, NULL) != 0) {
+                FAIL("pthread_create");
+            }
+        }
+        for (j = 0; j < nthreads[i]; ++j) {
+            (void)pthread_join(threads[j], NULL);
+        }
+        elapsed = mnl4c_now_posix() - before;
+
+        /* every record was covered by a sync, few of them by their own */
+        res = mnl4c_get_stats(logger, &stats);
+        assert(res == 0);
+        assert(stats.nrecords == nthreads[i] * TESTDURABLE_NRECORDS);
+        assert(stats.nsyncs >= 1);
+        assert(stats.nsyncs <= stats.nrecords);
+        TRACE("waiters %u commits/s %.0lf syncs %ju sync_waits %ju",
+              nthreads[i],
+              (double)stats.nrecords / elapsed,
+              (uintmax_t)stats.nsyncs,
+              (uintmax_t)stats.nsync_waits);
+        (void)mnl4c_close(logger);
+        n = count_lines();
+        assert(n == nthreads[i] * TESTDURABLE_NRECORDS);
+    }
+}
+
+
+static void
+test1(void)
+{
+    mnl4c_stats_t stats;
+    UNUSED uint64_t n;
+    UNUSED int res;
+
+    open_logger();
+    res = mnl4c_set_durability(logger, 42, LOG_ERR, 0.0);
+    assert(res != 0);
+    res = mnl4c_set_durability(logger,
+                               MNL4C_DURABILITY_PERIODIC,
+                               LOG_ERR,
+                               0.0);
+    assert(res != 0);
+    res = mnl4c_set_durability(logger,
+                               MNL4C_DURABILITY_PERIODIC,
+                               LOG_ERR,
+                               0.05);
+    assert(res == 0);
+
+    /* buffered records are written out and synced by the flusher */
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    pause_for(0.3);
+    res = mnl4c_get_stats(logger, &stats);
+    assert(res == 0);
+    assert(stats.nsyncs >= 1);
+    n = count_lines();
+    assert(n == 1);
+
+    /* below the group commit level, nothing waits */
+    res = mnl4c_set_durability(logger,
+                               MNL4C_DURABILITY_GROUP,
+                               LOG_ERR,
+                               0.0);
+    assert(res == 0);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    n = count_lines();
+    assert(n == 1);
+    FOO_LOG(logger, LOG_ERR, ZXC);
+    n = count_lines();
+    assert(n == 3);
+
+    res = mnl4c_set_durability(logger,
+                               MNL4C_DURABILITY_NONE,
+                               LOG_ERR,
+                               0.0);
+    assert(res == 0);
+    FOO_LOG(logger, LOG_ERR, ZXC);
+    n = count_lines();
+    assert(n == 3);
+    (void)mnl4c_close(logger);
+    n = count_lines();
+    assert(n == 4);
+    remove_log(TESTDURABLE_PATH);
+}
+
+
+/*
+ * Loggers closed while the flusher writes and syncs them.
+ */
+static void
+test2(void)
+{
+    int i;
+
+    for (i = 0; i < 50; ++i) {
+        UNUSED int res;
+
+        open_logger();
+        res = mnl4c_set_durability(logger,
+                                   MNL4C_DURABILITY_PERIODIC,
+                                   LOG_ERR,
+                                   0.001);
+        assert(res == 0);
+        FOO_LOG(logger, LOG_INFO, ZXC);
+        pause_for(0.001 * (i % 4));
+        (void)mnl4c_close(logger);
+    }
+    remove_log(TESTDURABLE_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    test2();
+    mnl4c_fini();
+    return 0;
+}
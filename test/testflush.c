@@ -0,0 +1,183 @@
+/*
+ * Bounded flush latency on a logger with a large buffer.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTFLUSH_PATH "/tmp/mnl4c-testflush.log"
+#define TESTFLUSH_LATENCY 0.1
+
+
+static off_t
+logsz(void)
+{
+    struct stat sb;
+
+    if (stat(TESTFLUSH_PATH, &sb) != 0) {
+        return -1;
+    }
+    return sb.st_size;
+}
+
+
+static void
+pause_for(double sec)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)sec;
+    ts.tv_nsec = (long)((sec - (double)ts.tv_sec) * 1000000000.0);
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+
+/*
+ * A forked child gets its flusher back with its first record.
+ */
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger;
+    pid_t pid;
+    UNUSED int res, status;
+
+    remove_log(TESTFLUSH_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTFLUSH_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    (void)mnl4c_set_bufsz(logger, 4 * 1024 * 1024);
+    res = mnl4c_set_flush_latency(logger, TESTFLUSH_LATENCY);
+    assert(res == 0);
+
+    if ((pid = fork()) < 0) {
+        FAIL("fork");
+    }
+    if (pid == 0) {
+        double before;
+
+        before = mnl4c_now_posix();
+        FOO_LOG(logger, LOG_INFO, ZXC);
+        while (logsz() == 0) {
+            if (mnl4c_now_posix() - before >= 10 * TESTFLUSH_LATENCY) {
+                _exit(1);
+            }
+            pause_for(0.01);
+        }
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        FAIL("waitpid");
+    }
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    (void)mnl4c_close(logger);
+    remove_log(TESTFLUSH_PATH);
+}
+
+
+static void
+test1(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger;
+    mnl4c_stats_t stats;
+    UNUSED double before;
+    off_t sz;
+    UNUSED int res;
+
+    remove_log(TESTFLUSH_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTFLUSH_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    (void)mnl4c_set_bufsz(logger, 4 * 1024 * 1024);
+    res = mnl4c_set_flush_latency(logger, -1.0);
+    assert(res != 0);
+    res = mnl4c_set_flush_latency(logger, TESTFLUSH_LATENCY);
+    assert(res == 0);
+
+    /* a quiet logger is written out by the flusher */
+    assert(logsz() == 0);
+    before = mnl4c_now_posix();
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    while ((sz = logsz()) == 0) {
+        pause_for(0.01);
+        assert(mnl4c_now_posix() - before < 10 * TESTFLUSH_LATENCY);
+    }
+    TRACE("flushed after %lf", mnl4c_now_posix() - before);
+    res = mnl4c_get_stats(logger, &stats);
+    assert(res == 0);
+    assert(stats.ntimed_flushes == 1);
+
+    /* turned off, the record stays buffered */
+    res = mnl4c_set_flush_latency(logger, 0.0);
+    assert(res == 0);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    pause_for(3 * TESTFLUSH_LATENCY);
+    assert(logsz() == sz);
+
+    /* and is written out by mnl4c_fini() */
+}
+
+
+/*
+ * After mnl4c_fini(): both records are in the file.
+ */
+static void
+test2(void)
+{
+    FILE *fp;
+    char line[256];
+    int n;
+
+    if ((fp = fopen(TESTFLUSH_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        assert(strstr(line, "\tHey!\n") != NULL);
+        ++n;
+    }
+    fclose(fp);
+    assert(n == 2);
+    remove_log(TESTFLUSH_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    mnl4c_fini();
+    test2();
+    return 0;
+}
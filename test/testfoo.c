@@ -25,6 +25,7 @@ test0(void)
     UNUSED int res;
     mnl4c_logger_t logger0;
     mnl4c_logger_t logger1;
+    UNUSED mnl4c_stats_t stats;
     struct {
         long rnd;
         int in;
@@ -48,6 +49,13 @@ test0(void)
     assert(logger1 != -1);
     (void)mnl4c_set_bufsz(logger1, 256);
     foo_init_logdef(logger1);
+    /* rejected DEBUG records are replayed on the next error */
+    res = mnl4c_set_recorder(logger0, LOG_DEBUG, LOG_ERR, 16384, NULL);
+    assert(res == 0);
+    res = mnl4c_set_stats_interval(logger1, 10.0);
+    assert(res == 0);
+    res = mnl4c_set_profiling(logger1, true);
+    assert(res == 0);
 
     FOO_LERROR(logger0, QWE, 1, 2.0, "qwe123123123123123123123");
     FOO_LERROR(logger1, QWE, 1, 2.0, "qwe123123123123123123123");
@@ -91,6 +99,19 @@ test0(void)
         sleep(1);
     }
 
+    FOO_LDEBUG(logger0, QWE, 3, 4.0, "recorded");
+    FOO_LDEBUG(logger0, QWE1, 5, 6.0, "recorded");
+    FOO_LERROR(logger0, ZXC);
+
+    res = mnl4c_get_stats(logger1, &stats);
+    assert(res == 0);
+    assert(stats.nrecords > 0);
+    assert(stats.nflushes > 0 && stats.nbytes > 0);
+    res = mnl4c_dump_stats(logger1);
+    assert(res == 0);
+    res = mnl4c_profile_report(logger1, STDERR_FILENO);
+    assert(res == 0);
+
     (void)mnl4c_close(logger0);
     (void)mnl4c_close(logger1);
     mnl4c_fini();
@@ -0,0 +1,88 @@
+/*
+ * Built with -DMNL4C_MIN_LEVEL=LOG_INFO -DBAR_MIN_LEVEL=LOG_ERR.
+ */
+#include <assert.h>
+#include <stdio.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+static mnl4c_logger_t logger;
+
+
+static bool
+registered(int id)
+{
+    mnl4c_minfo_t *minfo;
+
+    if ((minfo = array_get(&mnl4c_get_ctx(logger)->minfos, id)) == NULL) {
+        return false;
+    }
+    return minfo->name != NULL;
+}
+
+
+static void
+test0(void)
+{
+    mnl4c_stats_t stats;
+    int debug_only = 42;
+    int level = LOG_INFO;
+    UNUSED bool res;
+
+    logger = mnl4c_open(MNL4C_OPEN_STDOUT);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, NULL);
+
+    /* messages defined below the floor are not registered */
+    res = registered(FOO_QWE_ID);
+    assert(res);
+    res = registered(FOO_QWE1_ID);
+    assert(res);
+    res = registered(FOO_ASD_ID);
+    assert(!res);
+    res = registered(FOO_ASD1_ID);
+    assert(!res);
+    res = registered(BAR_QWE_ID);
+    assert(!res);
+    res = registered(BAR_ASD1_ID);
+    assert(!res);
+
+    /* compiled out, yet the arguments are type-checked and "used" */
+    FOO_LDEBUG(logger, QWE1, debug_only, 1.0, "debug");
+    FOO_LLOG(logger, ASD, "flevel debug");
+    FOO_LOG_START(logger, LOG_DEBUG, QWE1, 1, 1.0, "start");
+    FOO_LOG_NEXT(logger, LOG_DEBUG, QWE1, " %d", debug_only);
+    FOO_LOG_STOP(logger, LOG_DEBUG, QWE1, 2, 2.0, "stop");
+    BAR_LERROR(logger, QWE, debug_only, 1.0, "bar");
+
+    /* compiled in */
+    FOO_LINFO(logger, QWE1, 1, 1.0, "info");
+    FOO_LLOG(logger, QWE, 2, 2.0, "flevel info");
+    FOO_LOG(logger, level, QWE1, 3, 3.0, "runtime level");
+    level = LOG_DEBUG;
+    FOO_LOG(logger, level, QWE1, 4, 4.0, "runtime level debug");
+
+    (void)mnl4c_get_stats(logger, &stats);
+    TRACE("nrecords %ld", (long)stats.nrecords);
+    assert(stats.nrecords == 3);
+    (void)mnl4c_close(logger);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Message descriptors of two libraries registered with the same logger.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+#include "my-logdef2.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+
+static const char *
+msgname(mnl4c_logger_t logger, int id)
+{
+    mnl4c_minfo_t *minfo;
+
+    if ((minfo = array_get(&mnl4c_get_ctx(logger)->minfos, id)) == NULL ||
+        minfo->name == NULL) {
+        return NULL;
+    }
+    assert(minfo->id == id);
+    return BCDATA(minfo->name);
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger0, logger1;
+    UNUSED mnl4c_ctx_t *ctx;
+    UNUSED const char *name;
+    UNUSED int nids;
+    UNUSED int res;
+
+    /* ids come in definition order, libraries get disjoint ranges */
+    assert(foo_logdef_base >= 0);
+    assert(baz_logdef_base >= 0);
+    assert(BAR_QWE_ID == foo_logdef_base);
+    assert(FOO_QWE_ID == foo_logdef_base + 2);
+    assert(QUX_TWO_ID == baz_logdef_base + 1);
+    assert(baz_logdef_base >= SER_BLOB_ID + 1 ||
+           foo_logdef_base >= QUX_TWO_ID + 1);
+    nids = (SER_BLOB_ID > QUX_TWO_ID ? SER_BLOB_ID : QUX_TWO_ID) + 1;
+
+    logger0 = mnl4c_open(MNL4C_OPEN_STDOUT);
+    assert(logger0 != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger0);
+    baz_init_logdef(logger0);
+    ctx = mnl4c_get_ctx(logger0);
+    assert(ARRAY_ELNUM(&ctx->minfos) == (size_t)nids);
+    name = msgname(logger0, FOO_ZXC_ID);
+    assert(name != NULL && strcmp(name, "FOO_ZXC") == 0);
+    name = msgname(logger0, SER_BLOB_ID);
+    assert(name != NULL && strcmp(name, "SER_BLOB") == 0);
+    name = msgname(logger0, QUX_ONE_ID);
+    assert(name != NULL && strcmp(name, "QUX_ONE") == 0);
+    name = msgname(logger0, QUX_TWO_ID);
+    assert(name != NULL && strcmp(name, "QUX_TWO") == 0);
+    FOO_LINFO(logger0, ZXC);
+    QUX_LINFO(logger0, ONE, 1);
+    res = mnl4c_set_level(logger0, LOG_DEBUG, _foo);
+    assert(res == 5);
+
+    /* one library only, the other one's ids are left unregistered */
+    logger1 = mnl4c_open(MNL4C_OPEN_STDERR);
+    assert(logger1 != MNL4C_LOGGER_INVALID);
+    baz_init_logdef(logger1);
+    name = msgname(logger1, FOO_ZXC_ID);
+    assert(name == NULL);
+    name = msgname(logger1, QUX_ONE_ID);
+    assert(name != NULL && strcmp(name, "QUX_ONE") == 0);
+    res = mnl4c_set_level(logger1, LOG_DEBUG, _foo);
+    assert(res == 0);
+    QUX_LINFO(logger1, ONE, 2);
+
+    /* all of them */
+    res = mnl4c_msgdefs_register(logger1, NULL);
+    assert(res == 0);
+    name = msgname(logger1, FOO_ZXC_ID);
+    assert(name != NULL && strcmp(name, "FOO_ZXC") == 0);
+    res = mnl4c_msgdefs_register(MNL4C_LOGGER_INVALID, NULL);
+    assert(res != 0);
+
+    /* the table is not capped */
+    mnl4c_register_msg(logger1, LOG_INFO, 5000, "BIG");
+    name = msgname(logger1, 5000);
+    assert(name != NULL && strcmp(name, "BIG") == 0);
+    name = msgname(logger1, 4999);
+    assert(name == NULL);
+    res = mnl4c_set_level(logger1, LOG_DEBUG, _foo);
+    assert(res == 5);
+
+    (void)mnl4c_close(logger1);
+    (void)mnl4c_close(logger0);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Per-thread diagnostic context.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTNDC_PATH "/tmp/mnl4c-testndc.log"
+
+static mnl4c_logger_t logger;
+
+
+static void *
+worker(UNUSED void *udata)
+{
+    UNUSED int res;
+
+    /* the thread tag was set by the main thread only */
+    res = mnl4c_ndc_push_kv("req", "%d", 2);
+    assert(res == 1);
+    FOO_LINFO(logger, ZXC);
+    return NULL;
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    pthread_t thread;
+    FILE *fp;
+    char line[1024];
+    UNUSED const char *expected[] = {
+        "Hey!",
+        "main#1 Hey!",
+        "main#1 req=1 user=alice Hey!",
+        "req=2 Hey!",
+        "main#1 req=1 Hey!",
+        "main#1 req=1 Foo 0: Number 1, price 2.000000 name x",
+        "w#1 req=1 Hey!",
+        "Hey!",
+    };
+    unsigned i;
+    UNUSED int res;
+
+    remove_log(TESTNDC_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTNDC_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+
+    FOO_LINFO(logger, ZXC);
+    res = mnl4c_ndc_set_thread("main");
+    assert(res == 0);
+    FOO_LINFO(logger, ZXC);
+    res = mnl4c_ndc_push_kv("req", "%d", 1);
+    assert(res == 1);
+    res = mnl4c_ndc_push("user=%s", "alice");
+    assert(res == 2);
+    FOO_LINFO(logger, ZXC);
+
+    if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+        FAIL("pthread_create");
+    }
+    (void)pthread_join(thread, NULL);
+
+    res = mnl4c_ndc_pop();
+    assert(res == 1);
+    res = FOO_LOG_PAYLOAD(logger, LOG_INFO, ZXC, "", 0, MNL4C_PAYLOAD_RAW);
+    assert(res == 0);
+    res = mnl4c_builder_commit(
+            FOO_LOG_BEGIN(logger, LOG_INFO, QWE, 1, 2.0, "x"));
+    assert(res == 0);
+    /* renaming keeps the entries */
+    res = mnl4c_ndc_set_thread("w");
+    assert(res == 0);
+    FOO_LINFO(logger, ZXC);
+    res = mnl4c_ndc_set_thread(NULL);
+    assert(res == 0);
+    res = mnl4c_ndc_pop();
+    assert(res == 0);
+    res = mnl4c_ndc_pop();
+    assert(res == -1);
+    FOO_LINFO(logger, ZXC);
+
+    /* bounded */
+    for (i = 0; i < MNL4C_NDC_MAXDEPTH; ++i) {
+        res = mnl4c_ndc_push("%u", i);
+        assert(res == (int)i + 1);
+    }
+    res = mnl4c_ndc_push("x");
+    assert(res == -1);
+    while (mnl4c_ndc_pop() > 0) {
+    }
+    memset(line, 'x', MNL4C_NDC_BUFSZ);
+    line[MNL4C_NDC_BUFSZ] = '\0';
+    res = mnl4c_ndc_push("%s", line);
+    assert(res == -1);
+    res = mnl4c_ndc_push("%.*s", MNL4C_NDC_BUFSZ - 2, line);
+    assert(res == 1);
+    res = mnl4c_ndc_pop();
+    assert(res == 0);
+
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTNDC_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    i = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p;
+
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        ++p;
+        p[strcspn(p, "\n")] = '\0';
+        TRACE("%s", p);
+        assert(i < countof(expected));
+        assert(strcmp(p, expected[i]) == 0);
+        ++i;
+    }
+    fclose(fp);
+    assert(i == countof(expected));
+    remove_log(TESTNDC_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
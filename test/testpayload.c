@@ -0,0 +1,303 @@
+/*
+ * Payloads attached to records by reference, and their encodings.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTPAYLOAD_PATH "/tmp/mnl4c-testpayload.log"
+#define TESTPAYLOAD_SZ (64 * 1024)
+#define TESTPAYLOAD_NTHREADS 4
+#define TESTPAYLOAD_NRECORDS 50
+
+
+static void
+test0(void)
+{
+    struct {
+        const char *in;
+        const char *expected;
+    } data[] = {
+        {"", ""},
+        {"f", "Zg=="},
+        {"fo", "Zm8="},
+        {"foo", "Zm9v"},
+        {"foob", "Zm9vYg=="},
+        {"fooba", "Zm9vYmE="},
+        {"foobar", "Zm9vYmFy"},
+    };
+    mnbytestream_t bs;
+    unsigned char buf[100];
+    char expected[256];
+    unsigned i;
+    UNUSED ssize_t n;
+
+    bytestream_init(&bs, 1024);
+
+    for (i = 0; i < countof(data); ++i) {
+        SEOD(&bs) = 0;
+        n = mnl4c_bs_base64(&bs, data[i].in, strlen(data[i].in));
+        assert(n == (ssize_t)strlen(data[i].expected));
+        assert(memcmp(SDATA(&bs, 0),
+                      data[i].expected,
+                      strlen(data[i].expected)) == 0);
+    }
+
+    srandom(0);
+    for (i = 0; i < sizeof(buf); ++i) {
+        unsigned j;
+
+        buf[i] = random();
+        for (j = 0; j <= i; ++j) {
+            (void)snprintf(expected + 2 * j, 3, "%02x", buf[j]);
+        }
+        SEOD(&bs) = 0;
+        n = mnl4c_bs_hexdump(&bs, buf, i + 1);
+        assert(n == 2 * (i + 1));
+        assert(memcmp(SDATA(&bs, 0), expected, 2 * (i + 1)) == 0);
+    }
+
+    bytestream_fini(&bs);
+}
+
+
+static char *
+read_body(FILE *fp, char *line, size_t sz)
+{
+    char *p;
+
+    if (fgets(line, sz, fp) == NULL) {
+        return NULL;
+    }
+    p = strchr(line, '\t');
+    assert(p != NULL);
+    ++p;
+    assert(p[strlen(p) - 1] == '\n');
+    p[strlen(p) - 1] = '\0';
+    return p;
+}
+
+
+static void
+test1(void)
+{
+    BYTES_ALLOCA(_ser, "SER");
+    mnl4c_logger_t logger;
+    mnl4c_stats_t stats;
+    char *payload;
+    char *line;
+    size_t linesz;
+    UNUSED char *p;
+    FILE *fp;
+    UNUSED int res;
+
+    if ((payload = malloc(TESTPAYLOAD_SZ)) == NULL) {
+        FAIL("malloc");
+    }
+    for (linesz = 0; linesz < TESTPAYLOAD_SZ; ++linesz) {
+        payload[linesz] = 'a' + linesz % 26;
+    }
+    linesz = 4 * TESTPAYLOAD_SZ;
+    if ((line = malloc(linesz)) == NULL) {
+        FAIL("malloc");
+    }
+
+    remove_log(TESTPAYLOAD_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTPAYLOAD_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _ser);
+    /* the payload is not limited by the buffer size */
+    (void)mnl4c_set_bufsz(logger, 256);
+
+    /* written with writev, nothing copied into the record buffer */
+    SER_LINFO(logger, BLOB, "before");
+    res = SER_LOG_PAYLOAD(logger, LOG_INFO, BLOB,
+                          payload, TESTPAYLOAD_SZ, MNL4C_PAYLOAD_RAW,
+                          "raw");
+    assert(res == 0);
+    res = SER_LOG_PAYLOAD(logger, LOG_DEBUG, BLOB,
+                          payload, TESTPAYLOAD_SZ, MNL4C_PAYLOAD_RAW,
+                          "rejected");
+    assert(res == 0);
+    res = mnl4c_get_stats(logger, &stats);
+    assert(res == 0);
+    assert(stats.nrecords == 2);
+    assert(stats.nbytes > TESTPAYLOAD_SZ);
+    res = SER_LOG_PAYLOAD(logger, LOG_INFO, BLOB,
+                          "\x01\xfe", 2, MNL4C_PAYLOAD_HEX,
+                          "hex");
+    assert(res == 0);
+    res = SER_LOG_PAYLOAD(logger, LOG_INFO, BLOB,
+                          "foobar", 6, MNL4C_PAYLOAD_BASE64,
+                          "base64");
+    assert(res == 0);
+    res = SER_LOG_PAYLOAD(logger, LOG_INFO, BLOB,
+                          "", 0, 42,
+                          "bad encoding");
+    assert(res != 0);
+
+    /* sanitized records are copied, and escaped */
+    res = mnl4c_set_sanitize(logger, true, 0);
+    assert(res == 0);
+    res = SER_LOG_PAYLOAD(logger, LOG_INFO, BLOB,
+                          "a\nb", 3, MNL4C_PAYLOAD_RAW,
+                          "copied");
+    assert(res == 0);
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTPAYLOAD_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    p = read_body(fp, line, linesz);
+    assert(p != NULL && strcmp(p, "blob before: ") == 0);
+    p = read_body(fp, line, linesz);
+    assert(p != NULL);
+    assert(strncmp(p, "blob raw: ", 10) == 0);
+    assert(strlen(p + 10) == TESTPAYLOAD_SZ);
+    assert(memcmp(p + 10, payload, TESTPAYLOAD_SZ) == 0);
+    p = read_body(fp, line, linesz);
+    assert(p != NULL && strcmp(p, "blob hex: 01fe") == 0);
+    p = read_body(fp, line, linesz);
+    assert(p != NULL && strcmp(p, "blob base64: Zm9vYmFy") == 0);
+    p = read_body(fp, line, linesz);
+    assert(p != NULL && strcmp(p, "blob copied: a\\nb") == 0);
+    p = read_body(fp, line, linesz);
+    assert(p == NULL);
+    fclose(fp);
+    remove_log(TESTPAYLOAD_PATH);
+
+    free(line);
+    free(payload);
+}
+
+
+static mnl4c_logger_t wlogger;
+static char *wpayload;
+
+
+static void *
+worker(UNUSED void *arg)
+{
+    int i;
+
+    for (i = 0; i < TESTPAYLOAD_NRECORDS; ++i) {
+        UNUSED int res;
+
+        res = SER_LOG_PAYLOAD(wlogger, LOG_INFO, BLOB,
+                              wpayload, TESTPAYLOAD_SZ, MNL4C_PAYLOAD_RAW,
+                              "raw");
+        assert(res == 0);
+        SER_LINFO(wlogger, BLOB, "plain");
+    }
+    return NULL;
+}
+
+
+static void
+test2(void)
+{
+    BYTES_ALLOCA(_ser, "SER");
+    pthread_t threads[TESTPAYLOAD_NTHREADS];
+    mnl4c_stats_t stats;
+    char *line;
+    size_t linesz;
+    char *p;
+    FILE *fp;
+    UNUSED int nraw, nplain;
+    unsigned i;
+    UNUSED int res;
+
+    if ((wpayload = malloc(TESTPAYLOAD_SZ)) == NULL) {
+        FAIL("malloc");
+    }
+    memset(wpayload, 'x', TESTPAYLOAD_SZ);
+    linesz = 4 * TESTPAYLOAD_SZ;
+    if ((line = malloc(linesz)) == NULL) {
+        FAIL("malloc");
+    }
+
+    /* payloads written with the lock released, and synced after it */
+    remove_log(TESTPAYLOAD_PATH);
+    wlogger = mnl4c_open(MNL4C_OPEN_FILE,
+                         TESTPAYLOAD_PATH,
+                         (size_t)0,
+                         0.0,
+                         (size_t)0,
+                         0);
+    assert(wlogger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(wlogger);
+    (void)mnl4c_set_level(wlogger, LOG_INFO, _ser);
+    res = mnl4c_set_durability(wlogger,
+                               MNL4C_DURABILITY_GROUP,
+                               LOG_INFO,
+                               0.0);
+    assert(res == 0);
+    for (i = 0; i < countof(threads); ++i) {
+        if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+    for (i = 0; i < countof(threads); ++i) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    res = mnl4c_get_stats(wlogger, &stats);
+    assert(res == 0);
+    assert(stats.nrecords ==
+           2 * TESTPAYLOAD_NTHREADS * TESTPAYLOAD_NRECORDS);
+    assert(stats.nsyncs > 0);
+    (void)mnl4c_close(wlogger);
+
+    if ((fp = fopen(TESTPAYLOAD_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    nraw = 0;
+    nplain = 0;
+    while ((p = read_body(fp, line, linesz)) != NULL) {
+        if (strcmp(p, "blob plain: ") == 0) {
+            ++nplain;
+        } else {
+            assert(strncmp(p, "blob raw: ", 10) == 0);
+            assert(strlen(p + 10) == TESTPAYLOAD_SZ);
+            assert(memcmp(p + 10, wpayload, TESTPAYLOAD_SZ) == 0);
+            ++nraw;
+        }
+    }
+    fclose(fp);
+    assert(nraw == TESTPAYLOAD_NTHREADS * TESTPAYLOAD_NRECORDS);
+    assert(nplain == TESTPAYLOAD_NTHREADS * TESTPAYLOAD_NRECORDS);
+    remove_log(TESTPAYLOAD_PATH);
+
+    free(line);
+    free(wpayload);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    test2();
+    mnl4c_fini();
+    return 0;
+}
@@ -1,15 +1,83 @@
+/*
+ * Throughput and per-call latency of the logging macros, over a matrix
+ * of thread counts, macro families, sinks, buffer sizes and
+ * enabled/disabled levels.  Results are written as JSON, one result per
+ * line, and optionally compared against a stored baseline.
+ *
+ * Without arguments a single quick configuration is run.
+ */
 #include <assert.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <mncommon/dumpm.h>
 #include <mncommon/bytes.h>
-#include <mncommon/profile.h>
-#include <mncommon/unittest.h>
+#include <mncommon/util.h>
 
 #include <mnl4c.h>
 
 #include "my-logdef.h"
 
-mnl4c_logger_t logger;
+#define BENCH_PATH "/tmp/mnl4c-perf.log"
+#define BENCH_NINPUTS 1024
+#define BENCH_MAXLIST 16
+/* time one call in so many, the clock reads stay out of the others */
+#define BENCH_SAMPLE 16
+#define BENCH_NSAMPLES(n) (((n) + BENCH_SAMPLE - 1) / BENCH_SAMPLE)
+
+#define BENCH_FAMILY_MAYBE 0
+#define BENCH_FAMILY_ONCE 1
+#define BENCH_FAMILY_LT 2
+#define BENCH_FAMILY_LT2 3
+#define BENCH_FAMILY_STARTSTOP 4
+static const char *family_names[] = {
+    "maybe",
+    "once",
+    "lt",
+    "lt2",
+    "startstop",
+};
+
+#define BENCH_SINK_FILE 0
+#define BENCH_SINK_STDOUT 1
+#define BENCH_SINK_DEVNULL 2
+static const char *sink_names[] = {
+    "file",
+    "stdout",
+    "devnull",
+};
+
+static const char *enabled_names[] = {
+    "disabled",
+    "enabled",
+};
+
+typedef struct _bench_conf {
+    int nthreads;
+    int family;
+    int sink;
+    ssize_t bufsz;
+    int enabled;
+    size_t nrecords;
+} bench_conf_t;
+
+typedef struct _bench_thread {
+    pthread_t thread;
+    const bench_conf_t *conf;
+    uint32_t *lat;
+} bench_thread_t;
+
+static mnl4c_logger_t logger;
+static mnbytes_t *inputs[BENCH_NINPUTS];
+static volatile int go;
+
 
 #define WLEN 50
 static int
@@ -30,7 +98,7 @@ randword(unsigned char *p)
 
 
 static mnbytes_t *
-randline(UNUSED unsigned n)
+randline(unsigned n)
 {
     mnbytes_t *s;
     unsigned char *p;
@@ -47,44 +115,446 @@ randline(UNUSED unsigned n)
 }
 
 
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+#define BENCH_LOOP(t, stmt)                                    \
+    for (i = 0; i < (t)->conf->nrecords; ++i) {                \
+        const char *s;                                         \
+        s = (const char *)BDATA(inputs[i % BENCH_NINPUTS]);    \
+        if (i % BENCH_SAMPLE == 0) {                           \
+            uint64_t _before;                                  \
+            _before = now_ns();                                \
+            stmt;                                              \
+            (t)->lat[i / BENCH_SAMPLE] =                       \
+                (uint32_t)(now_ns() - _before);                \
+        } else {                                               \
+            stmt;                                              \
+        }                                                      \
+    }                                                          \
+
+
+static void *
+bench_thread(void *udata)
+{
+    bench_thread_t *t = udata;
+    size_t i;
+
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE)) {
+        ;
+    }
+
+    switch (t->conf->family) {
+    case BENCH_FAMILY_MAYBE:
+        BENCH_LOOP(t, FOO_LOG(logger, LOG_INFO, QWE1, (int)i, 1.0, s));
+        break;
+
+    case BENCH_FAMILY_ONCE:
+        BENCH_LOOP(t, MNL4C_WRITE_ONCE_PRINTFLIKE(logger,
+                                                  LOG_INFO,
+                                                  FOO,
+                                                  QWE1,
+                                                  (int)i,
+                                                  1.0,
+                                                  s));
+        break;
+
+    case BENCH_FAMILY_LT:
+        BENCH_LOOP(t, FOO_LOG_LT(logger, LOG_INFO, QWE1, (int)i, 1.0, s));
+        break;
+
+    case BENCH_FAMILY_LT2:
+        BENCH_LOOP(t, FOO_LOG_LT2(logger, LOG_INFO, QWE1, (int)i, 1.0, s));
+        break;
+
+    case BENCH_FAMILY_STARTSTOP:
+        BENCH_LOOP(t,
+            FOO_LOG_START(logger, LOG_INFO, ASD1, "start:");
+            FOO_LOG_NEXT(logger, LOG_INFO, ASD1, " %d", (int)i);
+            FOO_LOG_NEXT(logger, LOG_INFO, ASD1, " %.*s", 16, s);
+            FOO_LOG_STOP(logger, LOG_INFO, ASD1, s));
+        break;
+
+    default:
+        FAIL("bench_thread");
+    }
+
+    return NULL;
+}
+
+
 static void
-dosomething(int d, float f, mnbytes_t *s)
+cleanup(void)
 {
-    //FOO_LINFO(logger, QWE1, d, f, BDATA(s));
-    FOO_LDEBUG(logger, QWE1, d, f, BDATA(s));
+    glob_t g;
+    size_t i;
+
+    if (glob(BENCH_PATH "*", 0, NULL, &g) == 0) {
+        for (i = 0; i < g.gl_pathc; ++i) {
+            (void)unlink(g.gl_pathv[i]);
+        }
+        globfree(&g);
+    }
 }
 
-int
-main(int argc, UNUSED char *argv[static argc])
+
+static void
+logger_open(const bench_conf_t *conf)
 {
-    struct {
-        int rnd;
-    } data[] = {
-        {0,},
-    };
-    UNITTEST_PROLOG_RAND;
-    unsigned n;
     BYTES_ALLOCA(_foo, "FOO");
 
-    mnl4c_init();
+    switch (conf->sink) {
+    case BENCH_SINK_STDOUT:
+        logger = mnl4c_open(MNL4C_OPEN_STDOUT);
+        break;
+
+    case BENCH_SINK_FILE:
+    case BENCH_SINK_DEVNULL:
+        cleanup();
+        logger = mnl4c_open(MNL4C_OPEN_FILE,
+                            BENCH_PATH,
+                            (size_t)(64 * 1024 * 1024),
+                            0.0,
+                            (size_t)2,
+                            0);
+        if (conf->sink == BENCH_SINK_DEVNULL) {
+            int fd;
+
+            /* no rotation ever reopens it */
+            if ((fd = open("/dev/null", O_WRONLY)) < 0) {
+                FAIL("open");
+            }
+            (void)dup2(fd, mnl4c_get_ctx(logger)->writer.data.file.fd);
+            (void)close(fd);
+            mnl4c_get_ctx(logger)->writer.data.file.maxsz = 0;
+        }
+        break;
 
-    logger = mnl4c_open(MNL4C_OPEN_FILE, "/tmp/mnl4c-perf.log", 1024*1024*16, 0.0, 10, 0);
-    (void)mnl4c_set_bufsz(logger, 1024*1024*4);
+    default:
+        FAIL("logger_open");
+    }
+    assert(logger != MNL4C_LOGGER_INVALID);
+
+    (void)mnl4c_set_bufsz(logger, conf->bufsz);
     foo_init_logdef(logger);
-    (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
-    (void)mnl4c_set_throttling(logger, 0.1, _foo);
+    (void)mnl4c_set_level(logger,
+                          conf->enabled ? LOG_DEBUG : LOG_WARNING,
+                          _foo);
+}
+
+
+static int
+lat_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+static double
+baseline_get(const char *path, const char *name, const char *key)
+{
+    FILE *fp;
+    char buf[1024];
+    char needle[256];
+    double res;
 
-    n = 2230;
-    while (n--) {
-        mnbytes_t *s;
+    res = -1.0;
+    if ((fp = fopen(path, "r")) == NULL) {
+        return res;
+    }
+    snprintf(needle, sizeof(needle), "\"name\": \"%s\"", name);
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        char *p;
 
-        s = randline(n);
-        dosomething(n, (float)(n * 2), s);
-        BYTES_DECREF(&s);
+        if (strstr(buf, needle) == NULL) {
+            continue;
+        }
+        snprintf(needle, sizeof(needle), "\"%s\": ", key);
+        if ((p = strstr(buf, needle)) != NULL) {
+            res = strtod(p + strlen(needle), NULL);
+        }
+        break;
     }
+    fclose(fp);
+    return res;
+}
+
+
+/*
+ * Returns non-zero if throughput regressed past threshold percent.
+ */
+static int
+bench_run(const bench_conf_t *conf,
+          FILE *out,
+          bool first,
+          const char *baseline,
+          double threshold)
+{
+    bench_thread_t threads[conf->nthreads];
+    uint32_t *lat;
+    size_t nlat;
+    char name[256];
+    uint64_t before, after;
+    double throughput, p50, p99, p999;
+    int i;
+    int res;
 
+    nlat = BENCH_NSAMPLES(conf->nrecords) * conf->nthreads;
+    if ((lat = malloc(nlat * sizeof(uint32_t))) == NULL) {
+        FAIL("malloc");
+    }
 
+    logger_open(conf);
+    go = 0;
+    for (i = 0; i < conf->nthreads; ++i) {
+        threads[i].conf = conf;
+        threads[i].lat = lat + BENCH_NSAMPLES(conf->nrecords) * i;
+        if (pthread_create(&threads[i].thread,
+                           NULL,
+                           bench_thread,
+                           &threads[i]) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+    before = now_ns();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < conf->nthreads; ++i) {
+        (void)pthread_join(threads[i].thread, NULL);
+    }
+    after = now_ns();
     (void)mnl4c_close(logger);
+    cleanup();
+
+    qsort(lat, nlat, sizeof(uint32_t), lat_cmp);
+    throughput = (double)(conf->nrecords * conf->nthreads) /
+                 ((double)(after - before) / 1000000000.0);
+    p50 = lat[(size_t)((nlat - 1) * 0.5)];
+    p99 = lat[(size_t)((nlat - 1) * 0.99)];
+    p999 = lat[(size_t)((nlat - 1) * 0.999)];
+    free(lat);
+
+    snprintf(name,
+             sizeof(name),
+             "%s/%s/t%d/b%zd/%s",
+             family_names[conf->family],
+             sink_names[conf->sink],
+             conf->nthreads,
+             conf->bufsz,
+             enabled_names[conf->enabled]);
+    fprintf(out,
+            "%s{\"name\": \"%s\", \"family\": \"%s\", \"sink\": \"%s\", "
+            "\"threads\": %d, \"bufsz\": %zd, \"enabled\": %s, "
+            "\"records\": %zu, \"seconds\": %.6f, \"throughput\": %.0f, "
+            "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f}",
+            first ? "  " : ",\n  ",
+            name,
+            family_names[conf->family],
+            sink_names[conf->sink],
+            conf->nthreads,
+            conf->bufsz,
+            conf->enabled ? "true" : "false",
+            conf->nrecords * conf->nthreads,
+            (double)(after - before) / 1000000000.0,
+            throughput,
+            p50,
+            p99,
+            p999);
+
+    res = 0;
+    if (baseline != NULL) {
+        double bthroughput, bp99;
+
+        bthroughput = baseline_get(baseline, name, "throughput");
+        bp99 = baseline_get(baseline, name, "p99_ns");
+        if (bthroughput > 0.0 && bp99 > 0.0) {
+            double d;
+
+            d = (throughput - bthroughput) * 100.0 / bthroughput;
+            fprintf(stderr,
+                    "%-40s throughput %+7.1f%% p99 %+7.1f%%\n",
+                    name,
+                    d,
+                    (p99 - bp99) * 100.0 / bp99);
+            if (threshold > 0.0 && -d > threshold) {
+                res = 1;
+            }
+        } else {
+            fprintf(stderr, "%-40s not in baseline\n", name);
+        }
+    }
+
+    return res;
+}
+
+
+static int
+parse_list(const char *s, const char **names, int nnames, int *list)
+{
+    char *buf, *tok, *last;
+    int n;
+
+    buf = strdup(s);
+    n = 0;
+    for (tok = strtok_r(buf, ",", &last);
+         tok != NULL && n < BENCH_MAXLIST;
+         tok = strtok_r(NULL, ",", &last)) {
+        if (names == NULL) {
+            list[n++] = (int)strtol(tok, NULL, 10);
+        } else {
+            int i;
+
+            for (i = 0; i < nnames; ++i) {
+                if (strcmp(tok, names[i]) == 0) {
+                    list[n++] = i;
+                    break;
+                }
+            }
+            if (i == nnames) {
+                fprintf(stderr, "unknown: %s\n", tok);
+                exit(1);
+            }
+        }
+    }
+    free(buf);
+    return n;
+}
+
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads,...] [-f maybe,once,lt,lt2,startstop] "
+            "[-s file,stdout,devnull] [-b bufsz,...] "
+            "[-l enabled,disabled] [-n records] [-o out.json] "
+            "[-B baseline.json] [-T percent] [-S seed]\n",
+            prog);
+    exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int threads[BENCH_MAXLIST] = {1}, nthreads = 1;
+    int families[BENCH_MAXLIST] = {BENCH_FAMILY_MAYBE}, nfamilies = 1;
+    int sinks[BENCH_MAXLIST] = {BENCH_SINK_FILE}, nsinks = 1;
+    int bufszs[BENCH_MAXLIST] = {4096}, nbufszs = 1;
+    int enableds[BENCH_MAXLIST] = {1}, nenableds = 1;
+    size_t nrecords = 100000;
+    const char *outpath = NULL;
+    const char *baseline = NULL;
+    double threshold = 0.0;
+    unsigned seed = 1;
+    FILE *out;
+    bench_conf_t conf;
+    int a, b, c, d, e;
+    int ch;
+    bool first;
+    int res;
+
+    while ((ch = getopt(argc, argv, "t:f:s:b:l:n:o:B:T:S:")) != -1) {
+        switch (ch) {
+        case 't':
+            nthreads = parse_list(optarg, NULL, 0, threads);
+            break;
+        case 'f':
+            nfamilies = parse_list(optarg,
+                                   family_names,
+                                   countof(family_names),
+                                   families);
+            break;
+        case 's':
+            nsinks = parse_list(optarg,
+                                sink_names,
+                                countof(sink_names),
+                                sinks);
+            break;
+        case 'b':
+            nbufszs = parse_list(optarg, NULL, 0, bufszs);
+            break;
+        case 'l':
+            nenableds = parse_list(optarg,
+                                   enabled_names,
+                                   countof(enabled_names),
+                                   enableds);
+            break;
+        case 'n':
+            nrecords = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            outpath = optarg;
+            break;
+        case 'B':
+            baseline = optarg;
+            break;
+        case 'T':
+            threshold = strtod(optarg, NULL);
+            break;
+        case 'S':
+            seed = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (outpath == NULL) {
+        out = stderr;
+    } else if ((out = fopen(outpath, "w")) == NULL) {
+        FAIL("fopen");
+    }
+
+    /* the same inputs every run, comparable against a baseline */
+    srandom(seed);
+    for (a = 0; a < BENCH_NINPUTS; ++a) {
+        inputs[a] = randline(random() % 16 + 1);
+    }
+
+    mnl4c_init();
+    fprintf(out, "{\"results\": [\n");
+    first = true;
+    res = 0;
+    for (a = 0; a < nthreads; ++a) {
+        for (b = 0; b < nfamilies; ++b) {
+            for (c = 0; c < nsinks; ++c) {
+                for (d = 0; d < nbufszs; ++d) {
+                    for (e = 0; e < nenableds; ++e) {
+                        conf.nthreads = threads[a];
+                        conf.family = families[b];
+                        conf.sink = sinks[c];
+                        conf.bufsz = bufszs[d];
+                        conf.enabled = enableds[e];
+                        conf.nrecords = nrecords;
+                        res |= bench_run(&conf,
+                                         out,
+                                         first,
+                                         baseline,
+                                         threshold);
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
     mnl4c_fini();
-    return 0;
+
+    if (out != stderr) {
+        fclose(out);
+    }
+    for (a = 0; a < BENCH_NINPUTS; ++a) {
+        BYTES_DECREF(&inputs[a]);
+    }
+    return res;
 }
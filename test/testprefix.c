@@ -0,0 +1,127 @@
+/*
+ * Pre-rendered record prefixes, across levels and fork().
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTPREFIX_PATH "/tmp/mnl4c-testprefix.log"
+
+
+static void
+flush(mnl4c_logger_t logger)
+{
+    UNUSED int res;
+
+    res = mnl4c_builder_commit(
+            FOO_LOG_BEGIN(logger, LOG_INFO, QWE, 0, 0.0, "flush"));
+    assert(res == 0);
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger;
+    pid_t parent, child;
+    int status;
+    FILE *fp;
+    char line[1024];
+    UNUSED struct {
+        pid_t *pid;
+        const char *level;
+    } expected[] = {
+        {&parent, "ERROR"},
+        {&parent, "WARNING"},
+        {&parent, "INFO"},
+        {&parent, "ERROR"},
+        {&parent, "INFO"},
+        {&child, "INFO"},
+        {&child, "INFO"},
+        {&parent, "INFO"},
+    };
+    unsigned i;
+
+    parent = getpid();
+    remove_log(TESTPREFIX_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTPREFIX_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+
+    /* the same message at several levels */
+    FOO_LOG(logger, LOG_ERR, ZXC);
+    FOO_LOG(logger, LOG_WARNING, ZXC);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    FOO_LOG(logger, LOG_ERR, ZXC);
+    flush(logger);
+
+    if ((child = fork()) == -1) {
+        FAIL("fork");
+    }
+    if (child == 0) {
+        FOO_LOG(logger, LOG_INFO, ZXC);
+        flush(logger);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child) {
+        FAIL("waitpid");
+    }
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    FOO_LOG(logger, LOG_INFO, ZXC);
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTPREFIX_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    i = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        UNUSED double tm;
+        UNUSED int pid, res;
+        UNUSED char name[32], level[32];
+        char *p;
+
+        TRACE("%s", line);
+        assert(i < countof(expected));
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        *p = '\0';
+        res = sscanf(line, "%lf [%d] %31s %31[A-Z]:", &tm, &pid, name, level);
+        assert(res == 4);
+        assert(pid == *expected[i].pid);
+        assert(strcmp(name, "foo") == 0);
+        assert(strcmp(level, expected[i].level) == 0);
+        ++i;
+    }
+    fclose(fp);
+    assert(i == countof(expected));
+    remove_log(TESTPREFIX_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Per-message call site counters, as mnl4c_profile_report() prints them,
+ * after enabled, disabled and throttled calls.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTPROFILE_PATH "/tmp/mnl4c-testprofile.log"
+#define TESTPROFILE_REPORT "/tmp/mnl4c-testprofile.report"
+
+typedef struct _counters {
+    uintmax_t ncalls;
+    uintmax_t nemitted;
+    uintmax_t nrejected;
+    uintmax_t nthrottled;
+} counters_t;
+
+
+/*
+ * Fill c with the report row of the named message, all zeroes if it has
+ * none.
+ */
+static void
+get_counters(mnl4c_logger_t logger, const char *name, counters_t *c)
+{
+    int fd;
+    FILE *fp;
+    char line[1024];
+    UNUSED int res;
+
+    if ((fd = open(TESTPROFILE_REPORT,
+                   O_RDWR | O_CREAT | O_TRUNC,
+                   0644)) == -1) {
+        FAIL("open");
+    }
+    res = mnl4c_profile_report(logger, fd);
+    assert(res == 0);
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        FAIL("lseek");
+    }
+    if ((fp = fdopen(fd, "r")) == NULL) {
+        FAIL("fdopen");
+    }
+    memset(c, 0, sizeof(*c));
+    /* the header */
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        FAIL("fgets");
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        uintmax_t cycles, fmt_cycles, write_cycles, per_record;
+        counters_t rc;
+        char rname[64];
+
+        TRACE("%s", line);
+        res = sscanf(line,
+                     "%ju %ju %ju %ju %ju %ju %ju %ju %63s",
+                     &cycles,
+                     &rc.ncalls,
+                     &rc.nemitted,
+                     &rc.nrejected,
+                     &rc.nthrottled,
+                     &fmt_cycles,
+                     &write_cycles,
+                     &per_record,
+                     rname);
+        assert(res == 9);
+        if (strcmp(rname, name) == 0) {
+            *c = rc;
+        }
+    }
+    fclose(fp);
+    (void)unlink(TESTPROFILE_REPORT);
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    BYTES_ALLOCA(_qwe1, "FOO_QWE1");
+    mnl4c_logger_t logger;
+    UNUSED int res;
+    counters_t c;
+    int i;
+
+    remove_log(TESTPROFILE_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTPROFILE_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    /* slim sites count their rejects only while profiling */
+    res = mnl4c_set_profiling(logger, true);
+    assert(res == 0);
+    /* the last record, at open, is well within the threshold */
+    res = mnl4c_set_throttling(logger, 3600.0, _qwe1);
+    assert(res == 1);
+
+    for (i = 0; i < 3; ++i) {
+        FOO_LOG(logger, LOG_INFO, ZXC);
+    }
+    for (i = 0; i < 2; ++i) {
+        FOO_LOG(logger, LOG_DEBUG, ZXC);
+    }
+    for (i = 0; i < 4; ++i) {
+        FOO_LDEBUG(logger, ASD, "rejected");
+    }
+    for (i = 0; i < 5; ++i) {
+        FOO_LOG(logger, LOG_INFO, QWE1, i, 1.0, "throttled");
+    }
+    FOO_LOG(logger, LOG_DEBUG, QWE1, i, 1.0, "rejected");
+
+    get_counters(logger, "FOO_ZXC", &c);
+    assert(c.ncalls == 5);
+    assert(c.nemitted == 3);
+    assert(c.nrejected == 2);
+    assert(c.nthrottled == 0);
+
+    get_counters(logger, "FOO_ASD", &c);
+    assert(c.ncalls == 4);
+    assert(c.nemitted == 0);
+    assert(c.nrejected == 4);
+    assert(c.nthrottled == 0);
+
+    get_counters(logger, "FOO_QWE1", &c);
+    assert(c.ncalls == 6);
+    assert(c.nemitted == 0);
+    assert(c.nrejected == 1);
+    assert(c.nthrottled == 5);
+
+    /* a message never called */
+    get_counters(logger, "FOO_QWE", &c);
+    assert(c.ncalls == 0);
+
+    (void)mnl4c_close(logger);
+    remove_log(TESTPROFILE_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
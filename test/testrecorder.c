@@ -0,0 +1,178 @@
+/*
+ * Flight recorder: the dump comes ahead of the record that triggered
+ * it, and a damaged ring file is reset rather than trusted.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTRECORDER_PATH "/tmp/mnl4c-testrecorder.log"
+#define TESTRECORDER_RING "/tmp/mnl4c-testrecorder.ring"
+#define TESTRECORDER_RINGSZ 16384
+
+/* the ring file layout, see mnl4c.c */
+struct ring_hdr {
+    uint64_t magic;
+    uint64_t sz;
+    uint64_t head;
+    uint64_t tail;
+};
+
+struct ring_entry {
+    double ts;
+    int32_t id;
+    int16_t level;
+    uint16_t len;
+};
+
+
+static mnl4c_logger_t
+open_logger(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger;
+    UNUSED int res;
+
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTRECORDER_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    res = mnl4c_set_recorder(logger,
+                             LOG_DEBUG,
+                             LOG_ERR,
+                             TESTRECORDER_RINGSZ,
+                             TESTRECORDER_RING);
+    assert(res == 0);
+    return logger;
+}
+
+
+/*
+ * Read the log back into lines, return their number.
+ */
+static int
+read_log(char lines[][256], int nlines)
+{
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(TESTRECORDER_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    for (i = 0; i < nlines && fgets(lines[i], 256, fp) != NULL; ++i) {
+        TRACE("%s", lines[i]);
+    }
+    fclose(fp);
+    return i;
+}
+
+
+static void
+test0(void)
+{
+    mnl4c_logger_t logger;
+    char lines[16][256];
+    UNUSED int n;
+
+    remove_log(TESTRECORDER_PATH);
+    (void)unlink(TESTRECORDER_RING);
+    logger = open_logger();
+    FOO_LDEBUG(logger, QWE, 1, 1.0, "recorded");
+    FOO_LDEBUG(logger, QWE1, 2, 2.0, "recorded");
+    FOO_LERROR(logger, QWE, 3, 3.0, "trigger");
+    (void)mnl4c_close(logger);
+
+    n = read_log(lines, countof(lines));
+    assert(n == 5);
+    assert(strstr(lines[0], "flight recorder begin") != NULL);
+    assert(strstr(lines[1], "DEBUG:\tFoo 0: Number 1") != NULL);
+    assert(strstr(lines[2], "DEBUG:\tFoo 1: Number 2") != NULL);
+    assert(strstr(lines[3], "flight recorder end") != NULL);
+    assert(strstr(lines[4], "ERROR:\tFoo 0: Number 3") != NULL);
+    remove_log(TESTRECORDER_PATH);
+}
+
+
+static void
+test1(void)
+{
+    mnl4c_logger_t logger;
+    struct ring_hdr *hdr;
+    struct ring_entry *e;
+    char lines[16][256];
+    size_t mapsz;
+    UNUSED int n;
+    int fd, i;
+
+    remove_log(TESTRECORDER_PATH);
+    (void)unlink(TESTRECORDER_RING);
+    logger = open_logger();
+    for (i = 0; i < 3; ++i) {
+        FOO_LDEBUG(logger, QWE, i, 1.0, "recorded");
+    }
+    (void)mnl4c_close(logger);
+
+    /* as left behind by a process that died writing the second entry */
+    mapsz = sizeof(struct ring_hdr) + TESTRECORDER_RINGSZ;
+    if ((fd = open(TESTRECORDER_RING, O_RDWR)) < 0) {
+        FAIL("open");
+    }
+    hdr = mmap(NULL, mapsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        FAIL("mmap");
+    }
+    assert(hdr->head > hdr->tail);
+    e = (struct ring_entry *)((char *)(hdr + 1) + hdr->tail % hdr->sz);
+    e = (struct ring_entry *)((char *)e +
+        ((sizeof(*e) + e->len + 7) & ~(size_t)7));
+    e->level = 99;
+    e->len = 60000;
+    (void)munmap(hdr, mapsz);
+    (void)close(fd);
+
+    logger = open_logger();
+    FOO_LERROR(logger, QWE, 3, 3.0, "trigger");
+    /* nothing left to dump */
+    FOO_LERROR(logger, QWE, 4, 4.0, "trigger");
+    (void)mnl4c_close(logger);
+
+    n = read_log(lines, countof(lines));
+    assert(n == 5);
+    assert(strstr(lines[0], "flight recorder begin") != NULL);
+    assert(strstr(lines[1], "DEBUG:\tFoo 0: Number 0") != NULL);
+    assert(strstr(lines[2], "flight recorder end") != NULL);
+    assert(strstr(lines[3], "ERROR:\tFoo 0: Number 3") != NULL);
+    assert(strstr(lines[4], "ERROR:\tFoo 0: Number 4") != NULL);
+    remove_log(TESTRECORDER_PATH);
+    (void)unlink(TESTRECORDER_RING);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTSANITIZE_PATH "/tmp/mnl4c-testsanitize.log"
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t logger;
+    FILE *fp;
+    char line[1024];
+    char longs[200];
+    UNUSED const char *expected[] = {
+        "\\nFoo 0: This is the test: a\\tb\\x01c\\\\d\\r\\x7f",
+        "Foo 0: Number 1, price 2.000000 name clean na\xc3\xafve",
+        NULL,
+        "\\nFoo 1: start 1\\n2\\nFoo 1:  stop",
+        "Foo 0: Number 1, pri [truncated]",
+        "Foo 0: Number 1, price 2.000000 name \\n [truncated]",
+        "Foo 0: Number 3, price 4.000000 name \\n",
+    };
+    char long_expected[256];
+    UNUSED int res;
+    unsigned i;
+
+    memset(longs, 'x', sizeof(longs));
+    longs[150] = '\n';
+    longs[sizeof(longs) - 1] = '\0';
+    (void)snprintf(long_expected, sizeof(long_expected),
+                   "Foo 0: Number 1, price 2.000000 name %.150s\\n%s",
+                   longs, longs + 151);
+    expected[2] = long_expected;
+
+    remove_log(TESTSANITIZE_PATH);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTSANITIZE_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
+    res = mnl4c_set_sanitize(logger, true, 0);
+    assert(res == 0);
+
+    FOO_LDEBUG(logger, ASD, "a\tb\x01" "c\\d\r\x7f");
+    FOO_LINFO(logger, QWE, 1, 2.0, "clean na\xc3\xafve");
+    FOO_LINFO(logger, QWE, 1, 2.0, longs);
+    FOO_LOG_START(logger, LOG_INFO, ASD1, "start");
+    FOO_LOG_NEXT(logger, LOG_INFO, ASD1, " %d\n%d", 1, 2);
+    FOO_LOG_STOP(logger, LOG_INFO, ASD1, " stop");
+
+    /* the cap applies to the escaped body, an escape is never split */
+    res = mnl4c_set_sanitize(logger, true, 20);
+    assert(res == 0);
+    FOO_LINFO(logger, QWE, 1, 2.0, longs);
+    res = mnl4c_set_sanitize(logger, true, 40);
+    assert(res == 0);
+    FOO_LINFO(logger, QWE, 1, 2.0, "\n\n\n");
+    FOO_LINFO(logger, QWE, 3, 4.0, "\n");
+    (void)mnl4c_close(logger);
+
+    if ((fp = fopen(TESTSANITIZE_PATH, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    i = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p;
+
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        ++p;
+        assert(strchr(p, '\t') == NULL);
+        p[strcspn(p, "\n")] = '\0';
+        TRACE("%s", p);
+        assert(i < countof(expected));
+        assert(strcmp(p, expected[i]) == 0);
+        ++i;
+    }
+    fclose(fp);
+    assert(i == countof(expected));
+    remove_log(TESTSANITIZE_PATH);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
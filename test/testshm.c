@@ -0,0 +1,238 @@
+#include <assert.h>
+#include <glob.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTSHM_PATH "/tmp/mnl4c-testshm.log"
+#define TESTSHM_NWORKERS 4
+#define TESTSHM_NRECORDS 20000
+
+static mnl4c_logger_t logger;
+
+
+static void
+cleanup(void)
+{
+    glob_t g;
+    size_t i;
+
+    if (glob(TESTSHM_PATH ".*", 0, NULL, &g) == 0) {
+        for (i = 0; i < g.gl_pathc; ++i) {
+            (void)unlink(g.gl_pathv[i]);
+        }
+        globfree(&g);
+    }
+    (void)unlink(TESTSHM_PATH);
+}
+
+
+/*
+ * Count lines across all shadows, per worker; every line must be a
+ * whole record.
+ */
+static void
+count_lines(int *counts)
+{
+    glob_t g;
+    size_t i;
+
+    memset(counts, '\0', sizeof(int) * TESTSHM_NWORKERS);
+    if (glob(TESTSHM_PATH ".*", 0, NULL, &g) != 0) {
+        FAIL("glob");
+    }
+    for (i = 0; i < g.gl_pathc; ++i) {
+        FILE *fp;
+        char buf[1024];
+
+        if ((fp = fopen(g.gl_pathv[i], "r")) == NULL) {
+            FAIL("fopen");
+        }
+        while (fgets(buf, sizeof(buf), fp) != NULL) {
+            char *p;
+            int n;
+
+            if ((p = strstr(buf, "name worker")) == NULL) {
+                TRACE("garbled: %s", buf);
+                FAIL("count_lines");
+            }
+            n = p[sizeof("name worker") - 1] - '0';
+            assert(n >= 0 && n < TESTSHM_NWORKERS);
+            assert(strcmp(p + sizeof("name worker"), "\n") == 0);
+            ++counts[n];
+        }
+        fclose(fp);
+    }
+    globfree(&g);
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    pid_t pids[TESTSHM_NWORKERS];
+    int counts[TESTSHM_NWORKERS];
+    int i;
+
+    cleanup();
+    /* small maxsz to have the workers' output rotated many times */
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTSHM_PATH,
+                        (size_t)(256 * 1024),
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
+    assert(mnl4c_set_shmring(logger, 100) != 0);
+    assert(mnl4c_set_shmring(logger, 64 * 1024) == 0);
+    assert(mnl4c_set_shmring(logger, 64 * 1024) != 0);
+
+    for (i = 0; i < TESTSHM_NWORKERS; ++i) {
+        if ((pids[i] = fork()) == -1) {
+            FAIL("fork");
+        }
+        if (pids[i] == 0) {
+            char name[16];
+            int j;
+
+            snprintf(name, sizeof(name), "worker%d", i);
+            for (j = 0; j < TESTSHM_NRECORDS; ++j) {
+                FOO_LDEBUG(logger, QWE1, j, 1.0, name);
+            }
+            (void)mnl4c_close(logger);
+            _exit(0);
+        }
+    }
+
+    for (i = 0; i < TESTSHM_NWORKERS; ++i) {
+        int status;
+
+        if (waitpid(pids[i], &status, 0) != pids[i]) {
+            FAIL("waitpid");
+        }
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    (void)mnl4c_shmring_drain(logger);
+    (void)mnl4c_close(logger);
+
+    count_lines(counts);
+    for (i = 0; i < TESTSHM_NWORKERS; ++i) {
+        TRACE("worker%d: %d", i, counts[i]);
+        assert(counts[i] == TESTSHM_NRECORDS);
+    }
+    cleanup();
+}
+
+
+/*
+ * Workers killed at random points, some of them between reserving a
+ * chunk and committing it: the ring does not stall, and only whole
+ * records reach the file.
+ */
+static void
+test1(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    pid_t pids[TESTSHM_NWORKERS];
+    struct timespec ts = {0, 20000000};
+    glob_t g;
+    size_t i;
+    int nparent;
+    int round;
+
+    cleanup();
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        TESTSHM_PATH,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
+    (void)mnl4c_set_bufsz(logger, 4096);
+    if (mnl4c_set_shmring(logger, 64 * 1024) != 0) {
+        FAIL("mnl4c_set_shmring");
+    }
+
+    for (round = 0; round < 10; ++round) {
+        for (i = 0; i < TESTSHM_NWORKERS; ++i) {
+            if ((pids[i] = fork()) == -1) {
+                FAIL("fork");
+            }
+            if (pids[i] == 0) {
+                int j;
+
+                for (j = 0; ; ++j) {
+                    FOO_LDEBUG(logger, QWE1, j, 1.0, "worker0");
+                }
+            }
+        }
+        (void)nanosleep(&ts, NULL);
+        for (i = 0; i < TESTSHM_NWORKERS; ++i) {
+            int status;
+
+            (void)kill(pids[i], SIGKILL);
+            if (waitpid(pids[i], &status, 0) != pids[i]) {
+                FAIL("waitpid");
+            }
+        }
+        FOO_LERROR(logger, QWE1, round, 1.0, "parent");
+        (void)mnl4c_shmring_drain(logger);
+    }
+    (void)mnl4c_close(logger);
+
+    if (glob(TESTSHM_PATH ".*", 0, NULL, &g) != 0) {
+        FAIL("glob");
+    }
+    nparent = 0;
+    for (i = 0; i < g.gl_pathc; ++i) {
+        FILE *fp;
+        char buf[1024];
+
+        if ((fp = fopen(g.gl_pathv[i], "r")) == NULL) {
+            FAIL("fopen");
+        }
+        while (fgets(buf, sizeof(buf), fp) != NULL) {
+            if (strstr(buf, "name parent\n") != NULL) {
+                ++nparent;
+            } else if (strstr(buf, "name worker0\n") == NULL) {
+                TRACE("garbled: %s", buf);
+                FAIL("test1");
+            }
+        }
+        fclose(fp);
+    }
+    globfree(&g);
+    TRACE("parent: %d", nparent);
+    assert(nparent == 10);
+    cleanup();
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    mnl4c_fini();
+    return 0;
+}
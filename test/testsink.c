@@ -0,0 +1,194 @@
+/*
+ * Fan-out to sinks: per-sink levels, per-record flush, and the owner or
+ * sink rule of mnl4c_add_sink().
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+#define TESTSINK_OWNER "/tmp/mnl4c-testsink-owner.log"
+#define TESTSINK_WARN "/tmp/mnl4c-testsink-warn.log"
+#define TESTSINK_INFO "/tmp/mnl4c-testsink-info.log"
+#define TESTSINK_OTHER "/tmp/mnl4c-testsink-other.log"
+
+
+static mnl4c_logger_t
+open_logger(const char *path)
+{
+    mnl4c_logger_t logger;
+
+    remove_log(path);
+    logger = mnl4c_open(MNL4C_OPEN_FILE,
+                        path,
+                        (size_t)0,
+                        0.0,
+                        (size_t)0,
+                        0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    return logger;
+}
+
+
+static off_t
+log_size(const char *path)
+{
+    struct stat sb;
+
+    if (stat(path, &sb) != 0) {
+        FAIL("stat");
+    }
+    return sb.st_size;
+}
+
+
+/*
+ * Return the levels of the records in path, one letter each, in order.
+ */
+static void
+log_levels(const char *path, char *buf, size_t sz)
+{
+    FILE *fp;
+    char line[1024];
+    size_t i;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    i = 0;
+    while (i < sz - 1 && fgets(line, sizeof(line), fp) != NULL) {
+        UNUSED double tm;
+        UNUSED int pid, res;
+        UNUSED char name[32], level[32];
+        char *p;
+
+        TRACE("%s: %s", path, line);
+        p = strchr(line, '\t');
+        assert(p != NULL);
+        *p = '\0';
+        res = sscanf(line, "%lf [%d] %31s %31[A-Z]:", &tm, &pid, name, level);
+        assert(res == 4);
+        buf[i++] = level[0];
+    }
+    fclose(fp);
+    buf[i] = '\0';
+}
+
+
+static void
+test0(void)
+{
+    BYTES_ALLOCA(_foo, "FOO");
+    mnl4c_logger_t owner, warn, info;
+    UNUSED int res;
+    char levels[16];
+
+    owner = open_logger(TESTSINK_OWNER);
+    warn = open_logger(TESTSINK_WARN);
+    info = open_logger(TESTSINK_INFO);
+    (void)mnl4c_set_level(owner, LOG_DEBUG, _foo);
+
+    res = mnl4c_add_sink(owner, warn, LOG_WARNING, MNL4C_SINK_FLUSH_RECORD);
+    assert(res == 0);
+    res = mnl4c_add_sink(owner, info, LOG_INFO, MNL4C_SINK_FLUSH_FULL);
+    assert(res == 0);
+
+    /* a per-record sink has the record on disk right away */
+    FOO_LOG(owner, LOG_ERR, ZXC);
+    res = (log_size(TESTSINK_WARN) > 0);
+    assert(res);
+    log_levels(TESTSINK_WARN, levels, sizeof(levels));
+    assert(strcmp(levels, "E") == 0);
+
+    FOO_LOG(owner, LOG_WARNING, ZXC);
+    FOO_LOG(owner, LOG_INFO, ZXC);
+    FOO_LOG(owner, LOG_DEBUG, ZXC);
+    log_levels(TESTSINK_WARN, levels, sizeof(levels));
+    assert(strcmp(levels, "EW") == 0);
+
+    /* the sinks go with their last reference */
+    (void)mnl4c_close(owner);
+    (void)mnl4c_close(warn);
+    (void)mnl4c_close(info);
+
+    log_levels(TESTSINK_OWNER, levels, sizeof(levels));
+    assert(strcmp(levels, "EWID") == 0);
+    log_levels(TESTSINK_WARN, levels, sizeof(levels));
+    assert(strcmp(levels, "EW") == 0);
+    log_levels(TESTSINK_INFO, levels, sizeof(levels));
+    assert(strcmp(levels, "EWI") == 0);
+
+    remove_log(TESTSINK_OWNER);
+    remove_log(TESTSINK_WARN);
+    remove_log(TESTSINK_INFO);
+}
+
+
+static void
+test1(void)
+{
+    mnl4c_logger_t owner, sink, other;
+    UNUSED int res;
+
+    owner = open_logger(TESTSINK_OWNER);
+    sink = open_logger(TESTSINK_WARN);
+    other = open_logger(TESTSINK_OTHER);
+
+    res = mnl4c_add_sink(owner, owner, LOG_INFO, 0);
+    assert(res == -1);
+    res = mnl4c_add_sink(owner, sink, LOG_INFO, 0);
+    assert(res == 0);
+    /* the same sink again only updates it */
+    res = mnl4c_add_sink(owner, sink, LOG_WARNING, 0);
+    assert(res == 0);
+
+    /* an owner cannot become a sink */
+    res = mnl4c_add_sink(sink, owner, LOG_INFO, 0);
+    assert(res == -1);
+    res = mnl4c_add_sink(other, owner, LOG_INFO, 0);
+    assert(res == -1);
+    /* a sink cannot fan out */
+    res = mnl4c_add_sink(sink, other, LOG_INFO, 0);
+    assert(res == -1);
+
+    /* once removed, the sink is free to fan out */
+    res = mnl4c_remove_sink(owner, sink);
+    assert(res == 0);
+    res = mnl4c_remove_sink(owner, sink);
+    assert(res == -1);
+    res = mnl4c_add_sink(sink, other, LOG_INFO, 0);
+    assert(res == 0);
+    res = mnl4c_add_sink(owner, sink, LOG_INFO, 0);
+    assert(res == -1);
+
+    (void)mnl4c_close(sink);
+    (void)mnl4c_close(owner);
+    (void)mnl4c_close(other);
+
+    remove_log(TESTSINK_OWNER);
+    remove_log(TESTSINK_WARN);
+    remove_log(TESTSINK_OTHER);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    test1();
+    mnl4c_fini();
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Generated per-message serializers against printf.
+ */
+#include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mncommon/dumpm.h>
+#include <mnl4c.h>
+
+#include "unittest.h"
+#include "my-logdef.h"
+
+#ifndef NDEBUG
+const char *_malloc_options = "AJ";
+#endif
+
+
+#define COMPARE(mod, msg, ...)                                         \
+    do {                                                               \
+        char _buf[4096];                                               \
+        ssize_t _n;                                                    \
+        int _m;                                                        \
+        bytestream_rewind(&bs);                                        \
+        SEOD(&bs) = 0;                                                 \
+        _n = mod ## _ ## msg ## _WRITE(&bs, 4096, ##__VA_ARGS__);      \
+        _m = snprintf(_buf, sizeof(_buf),                              \
+                      mod ## _ ## msg ## _FMT, ##__VA_ARGS__);         \
+        if (_n != _m ||                                                \
+            memcmp(SDATA(&bs, 0), _buf, _m) != 0) {                    \
+            TRACE("mismatch:\n%.*s\n%s",                               \
+                  (int)SEOD(&bs), SDATA(&bs, 0), _buf);                \
+            assert(0);                                                 \
+        }                                                              \
+    } while (0)                                                        \
+
+
+static void
+test0(void)
+{
+    mnbytestream_t bs;
+    struct {
+        int i;
+        long l;
+        long long ll;
+        ssize_t z;
+        unsigned u;
+        unsigned long lu;
+        unsigned long long llu;
+        size_t zu;
+        int c;
+        const char *s;
+        double f;
+    } data[] = {
+        {0, 0, 0, 0, 0, 0, 0, 0, 'a', "", 0.0},
+        {-1, -1, -1, -1, 1, 1, 1, 1, 'Z', "qwe", -0.0},
+        {INT_MIN, LONG_MIN, LLONG_MIN, -12345,
+         UINT_MAX, ULONG_MAX, ULLONG_MAX, (size_t)-1, '%', "%d", 0.005},
+        {INT_MAX, LONG_MAX, LLONG_MAX, 12345,
+         0xdeadbeef, 0xabcdefUL, 1ULL << 63, 4096, ' ', NULL, -2.5},
+        {42, 100000, 1000000000000LL, 7,
+         10, 16, 255, 256, '\t', "a b c", 123456789.987654321},
+        {7, 8, 9, 10, 11, 12, 13, 14, 'x', "y", 1e20},
+        {7, 8, 9, 10, 11, 12, 13, 14, 'x', "y", -1e300},
+        {7, 8, 9, 10, 11, 12, 13, 14, 'x', "y", 0.125},
+        {7, 8, 9, 10, 11, 12, 13, 14, 'x', "y", 999.9999999},
+        {7, 8, 9, 10, 11, 12, 13, 14, 'x', "y", DBL_MIN},
+        {7, 8, 9, 10, 11, 12, 13, 14, 'x', "y", 4503599627370495.5},
+    };
+    unsigned i;
+
+    bytestream_init(&bs, 1024);
+
+    for (i = 0; i < countof(data); ++i) {
+        COMPARE(SER, ALL,
+                data[i].i,
+                data[i].l,
+                data[i].ll,
+                data[i].z,
+                data[i].u,
+                data[i].lu,
+                data[i].llu,
+                data[i].zu,
+                data[i].u,
+                data[i].lu,
+                data[i].c,
+                data[i].s,
+                data[i].f,
+                data[i].f,
+                data[i].f,
+                data[i].f);
+        COMPARE(SER, ESC, data[i].s);
+        COMPARE(SER, FALLBACK, data[i].i, data[i].s, data[i].f);
+        COMPARE(FOO, QWE, data[i].i, data[i].f, data[i].s);
+        COMPARE(FOO, ASD1, data[i].s);
+    }
+    COMPARE(FOO, ZXC);
+
+    /* over the size limit, nothing is left behind */
+    bytestream_rewind(&bs);
+    SEOD(&bs) = 0;
+    assert(SER_ESC_WRITE(&bs, 8, "long enough") == -1);
+    assert(SEOD(&bs) == 0);
+    assert(SER_ESC_WRITE(&bs, 64, "short") > 0);
+
+    bytestream_fini(&bs);
+}
+
+
+int
+main(void)
+{
+    mnl4c_init();
+    test0();
+    mnl4c_fini();
+    return 0;
+}
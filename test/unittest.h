@@ -1,8 +1,10 @@
 #ifndef UNITTEST_H
 #define UNITTEST_H
 
+#include <limits.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 //#include "mncommon/util.h"
 #ifndef countof
 #   define countof(a) (sizeof(a)/sizeof(a[0]))
@@ -55,6 +57,24 @@ extern "C" {
 
 #define SHUFFLE _SHUFFLE(data, i)
 
+/*
+ * Remove a file logger's path and the shadow behind the link.  Shadows
+ * are named after the second they were created in, this lets the next
+ * logger start from scratch.
+ */
+static inline void
+remove_log(const char *path)
+{
+    char shadow[PATH_MAX];
+    ssize_t sz;
+
+    if ((sz = readlink(path, shadow, sizeof(shadow) - 1)) > 0) {
+        shadow[sz] = '\0';
+        (void)unlink(shadow);
+    }
+    (void)unlink(path);
+}
+
 #ifdef __cplusplus
 }
 #endif